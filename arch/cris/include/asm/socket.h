@@ -24,7 +24,7 @@
 #define SO_PRIORITY	12
 #define SO_LINGER	13
 #define SO_BSDCOMPAT	14
-/* To add :#define SO_REUSEPORT 15 */
+#define SO_REUSEPORT	15
 #define SO_PASSCRED	16
 #define SO_PEERCRED	17
 #define SO_RCVLOWAT	18
@@ -64,6 +64,8 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_BUSY_POLL		46
+
 #endif /* _ASM_SOCKET_H */
 
 
@@ -577,12 +577,18 @@ static int macvtap_skb_to_vnet_hdr(const struct sk_buff *skb,
 		/* This is a hint as to how much should be linear. */
 		vnet_hdr->hdr_len = skb_headlen(skb);
 		vnet_hdr->gso_size = sinfo->gso_size;
-		if (sinfo->gso_type & SKB_GSO_TCPV4)
+		/* no virtio_net_hdr type for GRE encapsulated TCP */
+		if (sinfo->gso_type & SKB_GSO_GRE)
+			return -EINVAL;
+		else if (sinfo->gso_type & SKB_GSO_TCPV4)
 			vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
 		else if (sinfo->gso_type & SKB_GSO_TCPV6)
 			vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
 		else if (sinfo->gso_type & SKB_GSO_UDP)
 			vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_UDP;
+		/* no virtio_net_hdr type for UDP segmentation */
+		else if (sinfo->gso_type & SKB_GSO_UDP_L4)
+			return -EINVAL;
 		else
 			BUG();
 		if (sinfo->gso_type & SKB_GSO_TCP_ECN)
@@ -784,12 +784,18 @@ static ssize_t tun_put_user(struct tun_struct *tun,
 			/* This is a hint as to how much should be linear. */
 			gso.hdr_len = skb_headlen(skb);
 			gso.gso_size = sinfo->gso_size;
-			if (sinfo->gso_type & SKB_GSO_TCPV4)
+			/* no virtio_net_hdr type for GRE encapsulated TCP */
+			if (sinfo->gso_type & SKB_GSO_GRE)
+				return -EINVAL;
+			else if (sinfo->gso_type & SKB_GSO_TCPV4)
 				gso.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
 			else if (sinfo->gso_type & SKB_GSO_TCPV6)
 				gso.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
 			else if (sinfo->gso_type & SKB_GSO_UDP)
 				gso.gso_type = VIRTIO_NET_HDR_GSO_UDP;
+			/* no virtio_net_hdr type for UDP segmentation */
+			else if (sinfo->gso_type & SKB_GSO_UDP_L4)
+				return -EINVAL;
 			else {
 				pr_err("unexpected GSO type: "
 				       "0x%x, gso_size %d, hdr_len %d\n",
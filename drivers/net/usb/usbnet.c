@@ -324,13 +324,13 @@ static int rx_submit (struct usbnet *dev, struct urb *urb, gfp_t flags)
 	unsigned long		lockflags;
 	size_t			size = dev->rx_urb_size;
 
-	if ((skb = alloc_skb (size + NET_IP_ALIGN, flags)) == NULL) {
+	skb = __netdev_alloc_skb_ip_align(dev->net, size, flags);
+	if (!skb) {
 		netif_dbg(dev, rx_err, dev->net, "no rx skb\n");
 		usbnet_defer_kevent (dev, EVENT_RX_MEMORY);
 		usb_free_urb (urb);
 		return -ENOMEM;
 	}
-	skb_reserve (skb, NET_IP_ALIGN);
 
 	entry = (struct skb_data *) skb->cb;
 	entry->urb = urb;
@@ -679,6 +679,7 @@ int usbnet_stop (struct net_device *net)
 	dev->flags = 0;
 	del_timer_sync (&dev->delay);
 	tasklet_kill (&dev->bh);
+	netdev_reset_queue(net);
 	if (info->manage_power)
 		info->manage_power(dev, 0);
 	else
@@ -1115,6 +1116,7 @@ netdev_tx_t usbnet_start_xmit (struct sk_buff *skb,
 	if (test_bit(EVENT_DEV_ASLEEP, &dev->flags)) {
 		/* transmission will be done in resume */
 		usb_anchor_urb(urb, &dev->deferred);
+		netdev_sent_queue(net, length);
 		/* no use to process more packets */
 		netif_stop_queue(net);
 		spin_unlock_irqrestore(&dev->txq.lock, flags);
@@ -1136,6 +1138,7 @@ netdev_tx_t usbnet_start_xmit (struct sk_buff *skb,
 		break;
 	case 0:
 		net->trans_start = jiffies;
+		netdev_sent_queue(net, length);
 		__skb_queue_tail (&dev->txq, skb);
 		if (dev->txq.qlen >= TX_QLEN (dev))
 			netif_stop_queue (net);
@@ -1169,6 +1172,7 @@ static void usbnet_bh (unsigned long param)
 	struct usbnet		*dev = (struct usbnet *) param;
 	struct sk_buff		*skb;
 	struct skb_data		*entry;
+	unsigned int		tx_packets = 0, tx_bytes = 0;
 
 	while ((skb = skb_dequeue (&dev->done))) {
 		entry = (struct skb_data *) skb->cb;
@@ -1178,6 +1182,9 @@ static void usbnet_bh (unsigned long param)
 			rx_process (dev, skb);
 			continue;
 		case tx_done:
+			tx_packets++;
+			tx_bytes += entry->length;
+			/* FALLTHROUGH */
 		case rx_cleanup:
 			usb_free_urb (entry->urb);
 			dev_kfree_skb (skb);
@@ -1186,6 +1193,7 @@ static void usbnet_bh (unsigned long param)
 			netdev_dbg(dev->net, "bogus skb state %d\n", entry->state);
 		}
 	}
+	netdev_completed_queue(dev->net, tx_packets, tx_bytes);
 
 	// waiting for all pending urbs to complete?
 	if (dev->wait) {
@@ -1372,6 +1380,8 @@ usbnet_probe (struct usb_interface *udev, const struct usb_device_id *prod)
 
 	net->netdev_ops = &usbnet_netdev_ops;
 	net->watchdog_timeo = TX_TIMEOUT_JIFFIES;
+	/* rx buffers come from pages, refilled from the completion */
+	net->priv_flags |= IFF_RX_HEAD_FRAG;
 	net->ethtool_ops = &usbnet_ethtool_ops;
 
 	// allow device-specific bind/init procedures
@@ -1511,20 +1521,26 @@ int usbnet_resume (struct usb_interface *intf)
 	struct sk_buff          *skb;
 	struct urb              *res;
 	int                     retval;
+	struct sk_buff_head     failed;
 
 	if (!--dev->suspend_count) {
 		/* resume interrupt URBs */
 		if (dev->interrupt && test_bit(EVENT_DEV_OPEN, &dev->flags))
 			usb_submit_urb(dev->interrupt, GFP_NOIO);
 
+		__skb_queue_head_init(&failed);
 		spin_lock_irq(&dev->txq.lock);
 		while ((res = usb_get_from_anchor(&dev->deferred))) {
 
 			skb = (struct sk_buff *)res->context;
 			retval = usb_submit_urb(res, GFP_ATOMIC);
 			if (retval < 0) {
-				dev_kfree_skb_any(skb);
-				usb_free_urb(res);
+				/* let usbnet_bh() free it, the byte queue
+				 * accounting expects it to complete there.
+				 * dev->done is queued to after txq.lock is
+				 * dropped, the two don't nest */
+				((struct skb_data *)skb->cb)->state = tx_done;
+				__skb_queue_tail(&failed, skb);
 				usb_autopm_put_interface_async(dev->intf);
 			} else {
 				dev->net->trans_start = jiffies;
@@ -1536,6 +1552,9 @@ int usbnet_resume (struct usb_interface *intf)
 		clear_bit(EVENT_DEV_ASLEEP, &dev->flags);
 		spin_unlock_irq(&dev->txq.lock);
 
+		while ((skb = __skb_dequeue(&failed)))
+			skb_queue_tail(&dev->done, skb);
+
 		if (test_bit(EVENT_DEV_OPEN, &dev->flags)) {
 			if (!(dev->txq.qlen >= TX_QLEN(dev)))
 				netif_start_queue(dev->net);
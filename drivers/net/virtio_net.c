@@ -20,12 +20,14 @@
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
 #include <linux/ethtool.h>
+#include <linux/interrupt.h>
 #include <linux/module.h>
 #include <linux/virtio.h>
 #include <linux/virtio_net.h>
 #include <linux/scatterlist.h>
 #include <linux/if_vlan.h>
 #include <linux/slab.h>
+#include <net/busy_poll.h>
 
 static int napi_weight = 128;
 module_param(napi_weight, int, 0444);
@@ -71,6 +73,9 @@ struct virtnet_info {
 	/* Work struct for refilling if we run low on memory. */
 	struct delayed_work refill;
 
+	/* Frees what the host sent once it told us, under the tx lock. */
+	struct tasklet_struct tx_reclaim;
+
 	/* Chain pages by the private ptr. */
 	struct page *pages;
 
@@ -136,8 +141,7 @@ static void skb_xmit_done(struct virtqueue *svq)
 	/* Suppress further interrupts. */
 	virtqueue_disable_cb(svq);
 
-	/* We were probably waiting for more output buffers. */
-	netif_wake_queue(vi->dev);
+	tasklet_schedule(&vi->tx_reclaim);
 }
 
 static void set_skb_frag(struct sk_buff *skb, struct page *page,
@@ -333,6 +337,7 @@ static void receive_buf(struct net_device *dev, void *buf, unsigned int len)
 		skb_shinfo(skb)->gso_segs = 0;
 	}
 
+	skb_mark_napi_id(skb, &vi->napi);
 	netif_receive_skb(skb);
 	return;
 
@@ -531,6 +536,7 @@ static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
 	struct sk_buff *skb;
 	unsigned int len, tot_sgs = 0;
+	unsigned int packets = 0, bytes = 0;
 	struct virtnet_stats __percpu *stats = this_cpu_ptr(vi->stats);
 
 	while ((skb = virtqueue_get_buf(vi->svq, &len)) != NULL) {
@@ -541,12 +547,34 @@ static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 		stats->tx_packets++;
 		u64_stats_update_end(&stats->syncp);
 
+		packets++;
+		bytes += skb->len;
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		dev_kfree_skb_any(skb);
 	}
+	netdev_completed_queue(vi->dev, packets, bytes);
 	return tot_sgs;
 }
 
+static void virtnet_tx_reclaim(unsigned long data)
+{
+	struct virtnet_info *vi = (struct virtnet_info *)data;
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev, 0);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	free_old_xmit_skbs(vi);
+
+	/* We were probably waiting for more output buffers. */
+	netif_tx_wake_queue(txq);
+
+	/* Over the byte queue limit only completions restart the queue,
+	 * so keep asking the host for them. */
+	if (unlikely(netif_xmit_stopped(txq)) &&
+	    unlikely(!virtqueue_enable_cb_delayed(vi->svq)))
+		tasklet_schedule(&vi->tx_reclaim);
+	__netif_tx_unlock(txq);
+}
+
 static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 {
 	struct skb_vnet_hdr *hdr = skb_vnet_hdr(skb);
@@ -597,6 +625,8 @@ static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	struct netdev_queue *txq = netdev_get_tx_queue(dev, 0);
+	bool kick = !skb->xmit_more;
 	int capacity;
 
 	/* Free up any pending old buffers before queueing new ones. */
@@ -620,9 +650,11 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 		}
 		dev->stats.tx_dropped++;
 		kfree_skb(skb);
+		/* Earlier skbs of the batch may still be waiting for a kick. */
+		virtqueue_kick(vi->svq);
 		return NETDEV_TX_OK;
 	}
-	virtqueue_kick(vi->svq);
+	netdev_tx_sent_queue(txq, skb->len);
 
 	/* Don't wait up for transmitted skbs to be freed. */
 	skb_orphan(skb);
@@ -637,11 +669,22 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 			capacity += free_old_xmit_skbs(vi);
 			if (capacity >= 2+MAX_SKB_FRAGS) {
 				netif_start_queue(dev);
-				virtqueue_disable_cb(vi->svq);
+				if (!netif_xmit_stopped(txq))
+					virtqueue_disable_cb(vi->svq);
 			}
 		}
+	} else if (unlikely(netif_xmit_stopped(txq)) &&
+		   unlikely(!virtqueue_enable_cb_delayed(vi->svq))) {
+		/* Over the byte queue limit, but the host already used
+		 * enough for a completion to restart us. */
+		tasklet_schedule(&vi->tx_reclaim);
 	}
 
+	/* More skbs are on their way: let the host pick them all up at once,
+	 * unless the queue got stopped and the batch is cut short here. */
+	if (kick || netif_xmit_stopped(txq))
+		virtqueue_kick(vi->svq);
+
 	return NETDEV_TX_OK;
 }
 
@@ -1002,6 +1045,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 		goto free;
 
 	INIT_DELAYED_WORK(&vi->refill, refill_work);
+	tasklet_init(&vi->tx_reclaim, virtnet_tx_reclaim, (unsigned long)vi);
 	sg_init_table(vi->rx_sg, ARRAY_SIZE(vi->rx_sg));
 	sg_init_table(vi->tx_sg, ARRAY_SIZE(vi->tx_sg));
 
@@ -1063,6 +1107,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 unregister:
 	unregister_netdev(dev);
 	cancel_delayed_work_sync(&vi->refill);
+	tasklet_kill(&vi->tx_reclaim);
 free_vqs:
 	vdev->config->del_vqs(vdev);
 free_stats:
@@ -1104,6 +1149,7 @@ static void __devexit virtnet_remove(struct virtio_device *vdev)
 
 	unregister_netdev(vi->dev);
 	cancel_delayed_work_sync(&vi->refill);
+	tasklet_kill(&vi->tx_reclaim);
 
 	/* Free unused buffers in both send and recv, if any. */
 	free_unused_bufs(vi);
@@ -950,6 +950,8 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	INIT_LIST_HEAD(&epi->pwqlist);
 	epi->ep = ep;
 	ep_set_ffd(&epi->ffd, tfile, fd);
+	/* POLL_BUSY_LOOP is select()/poll() internal, not an event */
+	event->events &= ~POLL_BUSY_LOOP;
 	epi->event = *event;
 	epi->nwait = 0;
 	epi->next = EP_UNACTIVE_PTR;
@@ -1044,6 +1046,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * otherwise we might miss an event that happens between the
 	 * f_op->poll() call and the new event set registering.
 	 */
+	event->events &= ~POLL_BUSY_LOOP;
 	epi->event.events = event->events;
 	epi->event.data = event->data; /* protected by mtx */
 
@@ -1099,7 +1102,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 		list_del_init(&epi->rdllink);
 
 		revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL) &
-			epi->event.events;
+			epi->event.events & ~POLL_BUSY_LOOP;
 
 		/*
 		 * If the event mask intersect the caller-requested one,
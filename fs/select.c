@@ -381,10 +381,11 @@ get_max:
 #define POLLEX_SET (POLLPRI)
 
 static inline void wait_key_set(poll_table *wait, unsigned long in,
-				unsigned long out, unsigned long bit)
+				unsigned long out, unsigned long bit,
+				unsigned int busy_flag)
 {
 	if (wait) {
-		wait->key = POLLEX_SET;
+		wait->key = POLLEX_SET | busy_flag;
 		if (in & bit)
 			wait->key |= POLLIN_SET;
 		if (out & bit)
@@ -399,6 +400,7 @@ int do_select(int n, fd_set_bits *fds, struct timespec *end_time)
 	poll_table *wait;
 	int retval, i, timed_out = 0;
 	unsigned long slack = 0;
+	unsigned int busy_flag = POLL_BUSY_LOOP;
 
 	rcu_read_lock();
 	retval = max_select_fd(n, fds);
@@ -449,10 +451,14 @@ int do_select(int n, fd_set_bits *fds, struct timespec *end_time)
 					f_op = file->f_op;
 					mask = DEFAULT_POLLMASK;
 					if (f_op && f_op->poll) {
-						wait_key_set(wait, in, out, bit);
+						wait_key_set(wait, in, out, bit,
+							     busy_flag);
 						mask = (*f_op->poll)(file, wait);
 					}
 					fput_light(file, fput_needed);
+					/* One busy poll per call */
+					if (mask & busy_flag)
+						busy_flag = 0;
 					if ((mask & POLLIN_SET) && (in & bit)) {
 						res_in |= bit;
 						retval++;
@@ -719,7 +725,8 @@ struct poll_list {
  * pwait poll_table will be used by the fd-provided poll handler for waiting,
  * if non-NULL.
  */
-static inline unsigned int do_pollfd(struct pollfd *pollfd, poll_table *pwait)
+static inline unsigned int do_pollfd(struct pollfd *pollfd, poll_table *pwait,
+				     unsigned int *busy_flag)
 {
 	unsigned int mask;
 	int fd;
@@ -737,8 +744,11 @@ static inline unsigned int do_pollfd(struct pollfd *pollfd, poll_table *pwait)
 			if (file->f_op && file->f_op->poll) {
 				if (pwait)
 					pwait->key = pollfd->events |
-							POLLERR | POLLHUP;
+						POLLERR | POLLHUP | *busy_flag;
 				mask = file->f_op->poll(file, pwait);
+				/* One busy poll per call */
+				if (mask & *busy_flag)
+					*busy_flag = 0;
 			}
 			/* Mask out unneeded events. */
 			mask &= pollfd->events | POLLERR | POLLHUP;
@@ -757,6 +767,7 @@ static int do_poll(unsigned int nfds,  struct poll_list *list,
 	ktime_t expire, *to = NULL;
 	int timed_out = 0, count = 0;
 	unsigned long slack = 0;
+	unsigned int busy_flag = POLL_BUSY_LOOP;
 
 	/* Optimise the no-wait case */
 	if (end_time && !end_time->tv_sec && !end_time->tv_nsec) {
@@ -783,7 +794,7 @@ static int do_poll(unsigned int nfds,  struct poll_list *list,
 				 * this. They'll get immediately deregistered
 				 * when we break out and return.
 				 */
-				if (do_pollfd(pfd, pt)) {
+				if (do_pollfd(pfd, pt, &busy_flag)) {
 					count++;
 					pt = NULL;
 				}
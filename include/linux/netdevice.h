@@ -33,6 +33,7 @@
 #ifdef __KERNEL__
 #include <linux/pm_qos_params.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
 #include <linux/delay.h>
 #include <linux/atomic.h>
 #include <asm/cache.h>
@@ -43,6 +44,7 @@
 #include <linux/rculist.h>
 #include <linux/dmaengine.h>
 #include <linux/workqueue.h>
+#include <linux/dynamic_queue_limits.h>
 
 #include <linux/ethtool.h>
 #include <net/net_namespace.h>
@@ -342,17 +344,26 @@ struct napi_struct {
 #endif
 
 	unsigned int		gro_count;
+	/* packets seen by GRO since the last completion */
+	unsigned int		gro_rx;
 
 	struct net_device	*dev;
 	struct list_head	dev_list;
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
+	/* flushes the packets held past a completion */
+	struct hrtimer		timer;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+	struct hlist_node	napi_hash_node;
+#endif
 };
 
 enum {
 	NAPI_STATE_SCHED,	/* Poll is scheduled */
 	NAPI_STATE_DISABLE,	/* Disable pending */
 	NAPI_STATE_NPSVC,	/* Netpoll - don't dequeue from poll_list */
+	NAPI_STATE_IN_BUSY_POLL,/* A socket owns it, don't complete it */
 };
 
 enum gro_result {
@@ -480,6 +491,7 @@ static inline void napi_disable(struct napi_struct *n)
 	set_bit(NAPI_STATE_DISABLE, &n->state);
 	while (test_and_set_bit(NAPI_STATE_SCHED, &n->state))
 		msleep(1);
+	hrtimer_cancel(&n->timer);
 	clear_bit(NAPI_STATE_DISABLE, &n->state);
 }
 
@@ -515,10 +527,18 @@ static inline void napi_synchronize(const struct napi_struct *n)
 # define napi_synchronize(n)	barrier()
 #endif
 
+/*
+ * __QUEUE_STATE_XOFF is owned by the driver (netif_tx_stop_queue() and
+ * friends), __QUEUE_STATE_STACK_XOFF by the stack, which sets it when the
+ * byte queue limit of the queue is exceeded.
+ */
 enum netdev_queue_state_t {
 	__QUEUE_STATE_XOFF,
+	__QUEUE_STATE_STACK_XOFF,
 	__QUEUE_STATE_FROZEN,
-#define QUEUE_STATE_XOFF_OR_FROZEN ((1 << __QUEUE_STATE_XOFF)		| \
+#define QUEUE_STATE_ANY_XOFF ((1 << __QUEUE_STATE_XOFF)		| \
+			      (1 << __QUEUE_STATE_STACK_XOFF))
+#define QUEUE_STATE_XOFF_OR_FROZEN (QUEUE_STATE_ANY_XOFF		| \
 				    (1 << __QUEUE_STATE_FROZEN))
 };
 
@@ -530,7 +550,7 @@ struct netdev_queue {
 	struct Qdisc		*qdisc;
 	unsigned long		state;
 	struct Qdisc		*qdisc_sleeping;
-#if defined(CONFIG_RPS) || defined(CONFIG_XPS)
+#if defined(CONFIG_RPS) || defined(CONFIG_XPS) || defined(CONFIG_BQL)
 	struct kobject		kobj;
 #endif
 #if defined(CONFIG_XPS) && defined(CONFIG_NUMA)
@@ -545,6 +565,9 @@ struct netdev_queue {
 	 * please use this field instead of dev->trans_start
 	 */
 	unsigned long		trans_start;
+#ifdef CONFIG_BQL
+	struct dql		dql;
+#endif
 } ____cacheline_aligned_in_smp;
 
 static inline int netdev_queue_numa_node_read(const struct netdev_queue *q)
@@ -601,36 +624,44 @@ struct rps_dev_flow_table {
 
 /*
  * The rps_sock_flow_table contains mappings of flows to the last CPU
- * on which they were processed by the application (set in recvmsg).
+ * on which they were processed by the application (set in recvmsg and
+ * poll).  Each entry holds the CPU in the bits of rps_cpu_mask, and the
+ * other bits of the flow hash, so that flows sharing an entry are told
+ * apart.
  */
 struct rps_sock_flow_table {
 	unsigned int mask;
-	u16 ents[0];
+	u32 ents[0];
 };
 #define	RPS_SOCK_FLOW_TABLE_SIZE(_num) (sizeof(struct rps_sock_flow_table) + \
-    (_num * sizeof(u16)))
+    (_num * sizeof(u32)))
 
 #define RPS_NO_CPU 0xffff
 
+extern u32 rps_cpu_mask;
+
 static inline void rps_record_sock_flow(struct rps_sock_flow_table *table,
-					u32 hash)
+					u32 hash, unsigned int cpu)
 {
 	if (table && hash) {
-		unsigned int cpu, index = hash & table->mask;
-
-		/* We only give a hint, preemption can change cpu under us */
-		cpu = raw_smp_processor_id();
+		unsigned int index = hash & table->mask;
+		u32 val = (hash & ~rps_cpu_mask) | cpu;
 
-		if (table->ents[index] != cpu)
-			table->ents[index] = cpu;
+		if (table->ents[index] != val)
+			table->ents[index] = val;
 	}
 }
 
 static inline void rps_reset_sock_flow(struct rps_sock_flow_table *table,
 				       u32 hash)
 {
-	if (table && hash)
-		table->ents[hash & table->mask] = RPS_NO_CPU;
+	if (table && hash) {
+		unsigned int index = hash & table->mask;
+
+		/* Leave alone the entry of another flow */
+		if (!((table->ents[index] ^ hash) & ~rps_cpu_mask))
+			table->ents[index] = RPS_NO_CPU;
+	}
 }
 
 extern struct rps_sock_flow_table __rcu *rps_sock_flow_table;
@@ -1040,12 +1071,14 @@ struct net_device {
 #define NETIF_F_TSO_ECN		(SKB_GSO_TCP_ECN << NETIF_F_GSO_SHIFT)
 #define NETIF_F_TSO6		(SKB_GSO_TCPV6 << NETIF_F_GSO_SHIFT)
 #define NETIF_F_FSO		(SKB_GSO_FCOE << NETIF_F_GSO_SHIFT)
+#define NETIF_F_GSO_UDP_L4	(SKB_GSO_UDP_L4 << NETIF_F_GSO_SHIFT)
+#define NETIF_F_GSO_GRE		(SKB_GSO_GRE << NETIF_F_GSO_SHIFT)
 
 	/* Features valid for ethtool to change */
 	/* = all defined minus driver/device-class-related */
 #define NETIF_F_NEVER_CHANGE	(NETIF_F_VLAN_CHALLENGED | \
 				  NETIF_F_LLTX | NETIF_F_NETNS_LOCAL)
-#define NETIF_F_ETHTOOL_BITS	(0xff3fffff & ~NETIF_F_NEVER_CHANGE)
+#define NETIF_F_ETHTOOL_BITS	(0xffffffff & ~NETIF_F_NEVER_CHANGE)
 
 	/* List of features with software fallbacks. */
 #define NETIF_F_GSO_SOFTWARE	(NETIF_F_TSO | NETIF_F_TSO_ECN | \
@@ -1179,9 +1212,11 @@ struct net_device {
 
 	unsigned char		broadcast[MAX_ADDR_LEN];	/* hw bcast add	*/
 
-#if defined(CONFIG_RPS) || defined(CONFIG_XPS)
+#if defined(CONFIG_RPS) || defined(CONFIG_XPS) || defined(CONFIG_BQL)
 	struct kset		*queues_kset;
+#endif
 
+#if defined(CONFIG_RPS) || defined(CONFIG_XPS)
 	struct netdev_rx_queue	*_rx;
 
 	/* Number of RX queues allocated at register_netdev() time */
@@ -1203,6 +1238,9 @@ struct net_device {
 
 	struct netdev_queue __rcu *ingress_queue;
 
+	/* ns GRO keeps packets held once a poll completes, 0 to flush */
+	unsigned long		gro_flush_timeout;
+
 /*
  * Cache lines mostly used on transmit path
  */
@@ -1498,6 +1536,14 @@ struct napi_gro_cb {
 
 	/* Free the skb? */
 	int free;
+
+	/* Offset of the network header of the current layer, relative to
+	 * skb->data: it moves inwards through tunnel headers.
+	 */
+	int network_offset;
+
+	/* Upper layer protocol of an IPv6 header, past its extensions. */
+	int proto;
 };
 
 #define NAPI_GRO_CB(skb) ((struct napi_gro_cb *)(skb)->cb)
@@ -1695,7 +1741,19 @@ static inline void *skb_gro_mac_header(struct sk_buff *skb)
 static inline void *skb_gro_network_header(struct sk_buff *skb)
 {
 	return (NAPI_GRO_CB(skb)->frag0 ?: skb->data) +
-	       skb_network_offset(skb);
+	       NAPI_GRO_CB(skb)->network_offset;
+}
+
+/*
+ * Header of the held packet p at the offset skb is at in its headers.
+ * p and skb being of the same flow so far, their headers up to there
+ * have the same layout.
+ */
+static inline void *skb_gro_held_header(struct sk_buff *p,
+					const struct sk_buff *skb,
+					unsigned int offset)
+{
+	return skb_network_header(p) + offset - skb_network_offset(skb);
 }
 
 static inline int dev_hard_header(struct sk_buff *skb, struct net_device *dev,
@@ -1741,6 +1799,12 @@ struct softnet_data {
 	unsigned int		time_squeeze;
 	unsigned int		cpu_collision;
 	unsigned int		received_rps;
+	unsigned int		rps_flow_hit;	/* flows found in the sock table */
+	unsigned int		rps_flow_miss;	/* flows with no or a stale entry */
+	unsigned int		rps_steered;	/* packets queued to another CPU */
+	unsigned int		gro_merged;	/* packets GRO merged */
+	unsigned int		gro_flushed;	/* packets GRO held and passed up */
+	unsigned int		skb_recycled;	/* skbs from the free skb cache */
 
 #ifdef CONFIG_RPS
 	struct softnet_data	*rps_ipi_list;
@@ -1778,7 +1842,7 @@ extern void __netif_schedule(struct Qdisc *q);
 
 static inline void netif_schedule_queue(struct netdev_queue *txq)
 {
-	if (!test_bit(__QUEUE_STATE_XOFF, &txq->state))
+	if (!(txq->state & QUEUE_STATE_ANY_XOFF))
 		__netif_schedule(txq->qdisc);
 }
 
@@ -1897,11 +1961,121 @@ static inline int netif_queue_stopped(const struct net_device *dev)
 	return netif_tx_queue_stopped(netdev_get_tx_queue(dev, 0));
 }
 
+/**
+ *	netif_xmit_stopped - test if the stack holds back a transmit queue
+ *	@dev_queue: transmit queue
+ *
+ *	Like netif_tx_queue_stopped(), but also true while the queue is over
+ *	its byte queue limit.
+ */
+static inline int netif_xmit_stopped(const struct netdev_queue *dev_queue)
+{
+	return dev_queue->state & QUEUE_STATE_ANY_XOFF;
+}
+
 static inline int netif_tx_queue_frozen_or_stopped(const struct netdev_queue *dev_queue)
 {
 	return dev_queue->state & QUEUE_STATE_XOFF_OR_FROZEN;
 }
 
+/**
+ *	netdev_tx_sent_queue - account bytes handed to the device
+ *	@dev_queue: transmit queue
+ *	@bytes: bytes just queued to the hardware
+ *
+ *	Called by the driver from ndo_start_xmit() for every packet it put on
+ *	the ring.  Stops the queue for the stack once the byte queue limit is
+ *	exceeded; netdev_tx_completed_queue() starts it again.
+ */
+static inline void netdev_tx_sent_queue(struct netdev_queue *dev_queue,
+					unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	dql_queued(&dev_queue->dql, bytes);
+
+	if (likely(dql_avail(&dev_queue->dql) >= 0))
+		return;
+
+	set_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+
+	/*
+	 * The XOFF flag must be set before checking the dql_avail below,
+	 * because in netdev_tx_completed_queue we update the dql_completed
+	 * before checking the XOFF flag.
+	 */
+	smp_mb();
+
+	/* check again in case another CPU has just made room avail */
+	if (unlikely(dql_avail(&dev_queue->dql) >= 0))
+		clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+#endif
+}
+
+static inline void netdev_sent_queue(struct net_device *dev, unsigned int bytes)
+{
+	netdev_tx_sent_queue(netdev_get_tx_queue(dev, 0), bytes);
+}
+
+/**
+ *	netdev_tx_completed_queue - account bytes the device is done with
+ *	@dev_queue: transmit queue
+ *	@pkts: packets completed
+ *	@bytes: bytes completed
+ *
+ *	Called by the driver from its transmit completion path, with the sum
+ *	of what netdev_tx_sent_queue() was told about the completed packets.
+ */
+static inline void netdev_tx_completed_queue(struct netdev_queue *dev_queue,
+					     unsigned int pkts,
+					     unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	if (unlikely(!bytes))
+		return;
+
+	dql_completed(&dev_queue->dql, bytes);
+
+	/*
+	 * Without the memory barrier there is a small possiblity that
+	 * netdev_tx_sent_queue will miss the update and cause the queue to
+	 * be stopped forever
+	 */
+	smp_mb();
+
+	if (dql_avail(&dev_queue->dql) < 0)
+		return;
+
+	if (test_and_clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state))
+		netif_schedule_queue(dev_queue);
+#endif
+}
+
+static inline void netdev_completed_queue(struct net_device *dev,
+					  unsigned int pkts, unsigned int bytes)
+{
+	netdev_tx_completed_queue(netdev_get_tx_queue(dev, 0), pkts, bytes);
+}
+
+/**
+ *	netdev_tx_reset_queue - forget the byte queue accounting of a queue
+ *	@q: transmit queue
+ *
+ *	For drivers that drop what is on their ring without completing it,
+ *	typically when the device is brought up again.
+ */
+static inline void netdev_tx_reset_queue(struct netdev_queue *q)
+{
+#ifdef CONFIG_BQL
+	clear_bit(__QUEUE_STATE_STACK_XOFF, &q->state);
+	dql_reset(&q->dql);
+#endif
+}
+
+static inline void netdev_reset_queue(struct net_device *dev_queue)
+{
+	netdev_tx_reset_queue(netdev_get_tx_queue(dev_queue, 0));
+}
+
 /**
  *	netif_running - test if up
  *	@dev: network device
@@ -2058,6 +2232,8 @@ extern gro_result_t	napi_skb_finish(gro_result_t ret, struct sk_buff *skb);
 extern gro_result_t	napi_gro_receive(struct napi_struct *napi,
 					 struct sk_buff *skb);
 extern void		napi_gro_flush(struct napi_struct *napi);
+extern struct packet_type *gro_find_receive_by_type(__be16 type);
+extern struct packet_type *gro_find_complete_by_type(__be16 type);
 extern struct sk_buff *	napi_get_frags(struct napi_struct *napi);
 extern gro_result_t	napi_frags_finish(struct napi_struct *napi,
 					  struct sk_buff *skb,
@@ -2093,7 +2269,8 @@ extern int		dev_set_mac_address(struct net_device *,
 					    struct sockaddr *);
 extern int		dev_hard_start_xmit(struct sk_buff *skb,
 					    struct net_device *dev,
-					    struct netdev_queue *txq);
+					    struct netdev_queue *txq,
+					    bool more);
 extern int		dev_forward_skb(struct net_device *dev,
 					struct sk_buff *skb);
 
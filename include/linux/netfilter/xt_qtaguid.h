@@ -1,6 +1,8 @@
 #ifndef _XT_QTAGUID_MATCH_H
 #define _XT_QTAGUID_MATCH_H
 
+#include <linux/types.h>
+
 /* For now we just replace the xt_owner.
  * FIXME: make iptables aware of qtaguid. */
 #include <linux/netfilter/xt_owner.h>
@@ -10,4 +12,66 @@
 #define XT_QTAGUID_SOCKET XT_OWNER_SOCKET
 #define xt_qtaguid_match_info xt_owner_match_info
 
+/*
+ * Binary stats, as an alternative to parsing xt_qtaguid/stats.
+ *
+ * They are dumped (NLM_F_DUMP) via the QTAGUID_GENL_NAME generic netlink
+ * family with QTAGUID_CMD_GET_STATS.
+ * The first message of a dump carries QTAGUID_A_SEQ, and QTAGUID_A_FULL
+ * when the dump contains all the rows. Every following message is a row:
+ * QTAGUID_A_IFNAME + QTAGUID_A_STATS.
+ *
+ * Passing the QTAGUID_A_SEQ of a previous dump as QTAGUID_A_SINCE_SEQ only
+ * returns the rows that changed since then. The counters are always
+ * absolute. If some stats were deleted in the meantime, or the seq is
+ * unknown, a full dump is returned instead.
+ * Rows for other uids are only returned if xt_qtaguid/stats would show them.
+ */
+#define QTAGUID_GENL_NAME	"qtaguid"
+#define QTAGUID_GENL_VERSION	1
+
+enum {
+	QTAGUID_CMD_UNSPEC,
+	QTAGUID_CMD_GET_STATS,
+	__QTAGUID_CMD_MAX,
+};
+#define QTAGUID_CMD_MAX (__QTAGUID_CMD_MAX - 1)
+
+enum {
+	QTAGUID_A_UNSPEC,
+	QTAGUID_A_SINCE_SEQ,	/* u64 */
+	QTAGUID_A_SEQ,		/* u64 */
+	QTAGUID_A_FULL,		/* flag */
+	QTAGUID_A_IFNAME,	/* string */
+	QTAGUID_A_STATS,	/* struct qtaguid_stats */
+	__QTAGUID_A_MAX,
+};
+#define QTAGUID_A_MAX (__QTAGUID_A_MAX - 1)
+
+#define QTAGUID_MAX_COUNTER_SETS 2
+
+enum {
+	QTAGUID_TX,
+	QTAGUID_RX,
+	QTAGUID_MAX_DIRECTIONS
+};
+
+enum {
+	QTAGUID_TCP,
+	QTAGUID_UDP,
+	QTAGUID_PROTO_OTHER,
+	QTAGUID_MAX_PROTOS
+};
+
+struct qtaguid_stats {
+	__u64	acct_tag;	/* as the acct_tag_hex column */
+	__u32	uid;
+	__u32	__pad;
+	struct {
+		__u64	bytes;
+		__u64	packets;
+	} counters[QTAGUID_MAX_COUNTER_SETS][QTAGUID_MAX_DIRECTIONS]
+		  [QTAGUID_MAX_PROTOS];
+};
+
 #endif /* _XT_QTAGUID_MATCH_H */
@@ -25,6 +25,12 @@ extern struct ctl_table epoll_table[]; /* for sysctl */
 
 #define DEFAULT_POLLMASK (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM)
 
+/*
+ * In a poll_table key: select()/poll() lets a socket busy poll.
+ * In the returned mask: the socket did, the others in the set won't.
+ */
+#define POLL_BUSY_LOOP	0x8000
+
 struct poll_table_struct;
 
 /* 
@@ -46,7 +52,8 @@ static inline void poll_wait(struct file * filp, wait_queue_head_t * wait_addres
 static inline void init_poll_funcptr(poll_table *pt, poll_queue_proc qproc)
 {
 	pt->qproc = qproc;
-	pt->key   = ~0UL; /* all events enabled */
+	/* all events enabled, no busy poll */
+	pt->key   = ~(unsigned long)POLL_BUSY_LOOP;
 }
 
 struct poll_table_entry {
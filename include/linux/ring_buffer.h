@@ -174,6 +174,13 @@ void ring_buffer_free_read_page(struct ring_buffer *buffer, void *data);
 int ring_buffer_read_page(struct ring_buffer *buffer, void **data_page,
 			  size_t len, int cpu, int full);
 
+int ring_buffer_map(struct ring_buffer *buffer, int cpu);
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu);
+bool ring_buffer_mapped(struct ring_buffer *buffer);
+struct page *ring_buffer_map_to_page(struct ring_buffer *buffer, int cpu,
+				     unsigned long pgoff);
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu);
+
 struct trace_seq;
 
 int ring_buffer_print_entry_header(struct trace_seq *s);
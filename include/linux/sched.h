@@ -363,6 +363,9 @@ extern signed long schedule_timeout_killable(signed long timeout);
 extern signed long schedule_timeout_uninterruptible(signed long timeout);
 asmlinkage void schedule(void);
 extern int mutex_spin_on_owner(struct mutex *lock, struct task_struct *owner);
+struct rt_mutex;
+extern int rt_mutex_spin_on_owner(struct rt_mutex *lock,
+				  struct task_struct *owner);
 
 struct nsproxy;
 struct user_namespace;
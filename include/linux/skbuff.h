@@ -94,6 +94,7 @@
 struct net_device;
 struct scatterlist;
 struct pipe_inode_info;
+struct splice_pipe_desc;
 
 #if defined(CONFIG_NF_CONNTRACK) || defined(CONFIG_NF_CONNTRACK_MODULE)
 struct nf_conntrack {
@@ -264,6 +265,12 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* This indicates a UDP datagram train, gso_size bytes each. */
+	SKB_GSO_UDP_L4 = 1 << 6,
+
+	/* This indicates the segments are carried in GRE over IPv4. */
+	SKB_GSO_GRE = 1 << 7,
 };
 
 #if BITS_PER_LONG > 32
@@ -322,8 +329,12 @@ typedef unsigned char *sk_buff_data_t;
  *	@queue_mapping: Queue mapping for multiqueue devices
  *	@ndisc_nodetype: router type (from link layer)
  *	@ooo_okay: allow the mapping of a socket to a queue to be changed
+ *	@xmit_more: more skbs of the same batch follow, the driver may defer
+ *		notifying the hardware
+ *	@head_frag: head is a page fragment, see build_skb()
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
+ *	@napi_id: id of the NAPI struct this skb came from
  *	@secmark: security marking
  *	@mark: Generic packet mark
  *	@dropcount: total number of sk_receive_queue overflows
@@ -414,13 +425,18 @@ struct sk_buff {
 	__u8			ndisc_nodetype:2;
 #endif
 	__u8			ooo_okay:1;
+	__u8			xmit_more:1;
+	__u8			head_frag:1;
 	kmemcheck_bitfield_end(flags2);
 
-	/* 0/13 bit hole */
+	/* 0/11 bit hole */
 
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+#endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
 #endif
@@ -521,6 +537,7 @@ static inline struct sk_buff *alloc_skb_fclone(unsigned int size,
 	return __alloc_skb(size, priority, 1, NUMA_NO_NODE);
 }
 
+extern struct sk_buff *build_skb(void *data, unsigned int frag_size);
 extern bool skb_recycle_check(struct sk_buff *skb, int skb_size);
 
 extern struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src);
@@ -1558,6 +1575,8 @@ static inline struct sk_buff *__dev_alloc_skb(unsigned int length,
 
 extern struct sk_buff *dev_alloc_skb(unsigned int length);
 
+extern void *netdev_alloc_frag(unsigned int fragsz);
+
 extern struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask);
 
@@ -1898,11 +1917,18 @@ extern int	       skb_store_bits(struct sk_buff *skb, int offset,
 extern __wsum	       skb_copy_and_csum_bits(const struct sk_buff *skb,
 					      int offset, u8 *to, int len,
 					      __wsum csum);
+extern ssize_t		skb_socket_splice(struct sock *sk,
+					  struct pipe_inode_info *pipe,
+					  struct splice_pipe_desc *spd);
 extern int             skb_splice_bits(struct sk_buff *skb,
+						struct sock *sk,
 						unsigned int offset,
 						struct pipe_inode_info *pipe,
 						unsigned int len,
-						unsigned int flags);
+						unsigned int flags,
+						ssize_t (*splice_cb)(struct sock *,
+							struct pipe_inode_info *,
+							struct splice_pipe_desc *));
 extern void	       skb_copy_and_csum_dev(const struct sk_buff *skb, u8 *to);
 extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
@@ -265,6 +265,7 @@ struct ucred {
 #define MSG_NOSIGNAL	0x4000	/* Do not generate SIGPIPE */
 #define MSG_MORE	0x8000	/* Sender will send more */
 #define MSG_WAITFORONE	0x10000	/* recvmmsg(): block until 1+ packets avail */
+#define MSG_FASTOPEN	0x20000000	/* Send data in TCP SYN */
 
 #define MSG_EOF         MSG_FIN
 
@@ -106,12 +106,14 @@ enum {
 #define TCP_THIN_LINEAR_TIMEOUTS 16      /* Use linear timeouts for thin streams*/
 #define TCP_THIN_DUPACK         17      /* Fast retrans. after 1 dupack */
 #define TCP_USER_TIMEOUT	18	/* How long for loss retry before timeout */
+#define TCP_FASTOPEN		23	/* Enable FastOpen on listeners */
 
 /* for TCP_INFO socket option */
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
 #define TCPI_OPT_WSCALE		4
 #define TCPI_OPT_ECN		8
+#define TCPI_OPT_SYN_DATA	32 /* SYN-ACK acked data in SYN sent or rcvd */
 
 enum tcp_ca_state {
 	TCP_CA_Open = 0,
@@ -207,10 +209,21 @@ struct tcp_cookie_transactions {
 
 #include <linux/skbuff.h>
 #include <linux/dmaengine.h>
+#include <linux/hrtimer.h>
 #include <net/sock.h>
 #include <net/inet_connection_sock.h>
 #include <net/inet_timewait_sock.h>
 
+#define TCP_FASTOPEN_COOKIE_MIN	4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX	16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+/* TCP Fast Open Cookie as stored in memory */
+struct tcp_fastopen_cookie {
+	s8	len;
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+};
+
 static inline struct tcphdr *tcp_hdr(const struct sk_buff *skb)
 {
 	return (struct tcphdr *)skb_transport_header(skb);
@@ -280,9 +293,14 @@ struct tcp_request_sock {
 	/* Only used by TCP MD5 Signature so far. */
 	const struct tcp_request_sock_ops *af_specific;
 #endif
+	struct sock			*listener; /* needed for TFO */
 	u32				rcv_isn;
 	u32				snt_isn;
 	u32				snt_synack; /* synack sent time */
+	u32				rcv_nxt; /* the ack # by SYNACK. For
+						  * FastOpen it's the seq#
+						  * after data-in-SYN.
+						  */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -317,6 +335,9 @@ struct tcp_sock {
 	u32	rcv_tstamp;	/* timestamp of last received ACK (for keepalives) */
 	u32	lsndtime;	/* timestamp of last sent data packet (for restart window) */
 
+	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
+	unsigned long	tsq_flags;
+
 	/* Data for direct copy to user */
 	struct {
 		struct sk_buff_head	prequeue;
@@ -365,6 +386,9 @@ struct tcp_sock {
 	u32	snd_up;		/* Urgent pointer		*/
 
 	u8	keepalive_probes; /* num of allowed keep alive probes	*/
+	u8	syn_fastopen:1,	/* SYN includes Fast Open option */
+		syn_data:1,	/* SYN includes data */
+		syn_data_acked:1;/* data in SYN is acked by SYN-ACK */
 /*
  *      Options received (usually on last packet, some only on SYN packets).
  */
@@ -384,6 +408,16 @@ struct tcp_sock {
 				 * receiver in Recovery. */
 	u32	prr_out;	/* Total number of pkts sent during Recovery. */
 
+/* Delivery rate sampling, see tcp_rate.c */
+	u32	delivered;	/* Total data packets delivered incl. rexmits */
+	u32	app_limited;	/* limited until "delivered" reaches this val */
+	u32	first_tx_mstamp;  /* start of window send phase, in usec */
+	u32	delivered_mstamp; /* time we reached "delivered", in usec */
+	u32	rate_delivered;    /* saved rate sample: packets delivered */
+	u32	rate_interval_us;  /* saved rate sample: time elapsed */
+	u8	rate_app_limited:1;  /* rate_{delivered,interval_us} limited? */
+	struct hrtimer	pacing_timer;	/* holds transmits to sk_pacing_rate */
+
  	u32	rcv_wnd;	/* Current receiver window		*/
 	u32	write_seq;	/* Tail(+1) of data held in tcp send buffer */
 	u32	pushed_seq;	/* Last pushed seq, required to talk to windows */
@@ -465,6 +499,20 @@ struct tcp_sock {
 	 * contains related tcp_cookie_transactions fields.
 	 */
 	struct tcp_cookie_values  *cookie_values;
+
+	/* fastopen_req holds the data of a client side Fast Open connect()
+	 * until the SYN is sent.  fastopen_rsk is the request of a passive
+	 * Fast Open socket, kept until the SYN-ACK gets acked, since the
+	 * SYN-ACK is retransmitted from the child socket itself.
+	 */
+	struct tcp_fastopen_request *fastopen_req;
+	struct request_sock *fastopen_rsk;
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,		/* tcp_write_xmit() hit the small queue limit */
+	TSQ_QUEUED,		/* socket is on the per cpu tsq_tasklet list */
+	TSQ_OWNED,		/* tsq_tasklet found the socket owned by user */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
@@ -472,6 +520,12 @@ static inline struct tcp_sock *tcp_sk(const struct sock *sk)
 	return (struct tcp_sock *)sk;
 }
 
+static inline bool tcp_passive_fastopen(const struct sock *sk)
+{
+	return (sk->sk_state == TCP_SYN_RECV &&
+		tcp_sk(sk)->fastopen_rsk != NULL);
+}
+
 struct tcp_timewait_sock {
 	struct inet_timewait_sock tw_sk;
 	u32			  tw_rcv_nxt;
@@ -0,0 +1,43 @@
+#ifndef _LINUX_TRACE_MMAP_H_
+#define _LINUX_TRACE_MMAP_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Memory mapped per-cpu ring buffer (tracing/per_cpu/cpuN/trace_pipe_raw).
+ *
+ * The mapping is read-only. Page 0 is the meta page described below,
+ * page 1 + id is the sub-buffer with that id. Each sub-buffer starts
+ * with the same header as the pages returned by splice().
+ *
+ * A consumer loops on:
+ *   ioctl(fd, TRACE_MMAP_IOCTL_GET_READER);
+ *   read the events of sub-buffer reader.id in [reader.read, reader.commit)
+ *
+ * The next TRACE_MMAP_IOCTL_GET_READER consumes what was handed out and,
+ * once the reader sub-buffer is done, swaps in the next one.
+ */
+struct trace_buffer_meta {
+	__u32	meta_page_size;		/* size of this page */
+	__u32	meta_struct_len;	/* sizeof(struct trace_buffer_meta) */
+
+	__u32	subbuf_size;		/* size of a sub-buffer, with header */
+	__u32	nr_subbufs;		/* number of sub-buffers, reader included */
+
+	struct {
+		__u64	lost_events;	/* events lost before this sub-buffer */
+		__u32	id;		/* id of the reader sub-buffer */
+		__u32	read;		/* first unread byte of the data */
+		__u32	commit;		/* end of the data handed out */
+		__u32	__reserved;
+	} reader;
+
+	__u64	entries;		/* events in the buffer */
+	__u64	overrun;		/* events lost by overwriting */
+	__u64	read;			/* events consumed */
+};
+
+#define TRACE_MMAP_IOCTL_GET_READER	_IO('T', 0x1)
+
+#endif /* _LINUX_TRACE_MMAP_H_ */
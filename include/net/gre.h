@@ -7,6 +7,13 @@
 #define GREPROTO_PPTP		1
 #define GREPROTO_MAX		2
 
+/* Fixed part of the GRE header, optional fields follow */
+struct gre_base_hdr {
+	__be16 flags;
+	__be16 protocol;
+};
+#define GRE_HEADER_SECTION	4
+
 struct gre_protocol {
 	int  (*handler)(struct sk_buff *skb);
 	void (*err_handler)(struct sk_buff *skb, u32 info);
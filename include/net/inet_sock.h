@@ -114,6 +114,7 @@ struct inet_cork {
 	struct page		*page;
 	u32			off;
 	u8			tx_flags;
+	u16			gso_size;
 };
 
 struct inet_cork_full {
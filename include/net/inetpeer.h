@@ -13,6 +13,7 @@
 #include <linux/spinlock.h>
 #include <linux/rtnetlink.h>
 #include <net/ipv6.h>
+#include <linux/tcp.h>
 #include <linux/atomic.h>
 
 struct inetpeer_addr_base {
@@ -41,6 +42,13 @@ struct inet_peer {
 	u32			pmtu_orig;
 	u32			pmtu_learned;
 	struct inetpeer_addr_base redirect_learned;
+	/* TCP Fast Open state learned from the peer as a server, only
+	 * accessed under tcp_fastopen_seqlock.
+	 */
+	struct tcp_fastopen_cookie tcp_fastopen_cookie;
+	u16			tcp_fastopen_mss;
+	u16			tcp_fastopen_syn_loss;
+	unsigned long		tcp_fastopen_syn_loss_ts;
 	/*
 	 * Once inet_peer is queued for deletion (refcnt == -1), following fields
 	 * are not available: rid, ip_id_count, tcp_ts, tcp_ts_stamp
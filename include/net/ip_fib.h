@@ -44,6 +44,7 @@ struct fib_config {
  };
 
 struct fib_info;
+struct rtable;
 
 struct fib_nh {
 	struct net_device	*nh_dev;
@@ -62,6 +63,8 @@ struct fib_nh {
 	__be32			nh_gw;
 	__be32			nh_saddr;
 	int			nh_saddr_genid;
+	struct rtable __rcu	*nh_rth_input;
+	struct rtable __rcu * __percpu *nh_pcpu_rth_output;
 };
 
 /*
@@ -230,7 +233,8 @@ extern const struct nla_policy rtm_ipv4_policy[];
 extern void		ip_fib_init(void);
 extern int fib_validate_source(struct sk_buff *skb, __be32 src, __be32 dst,
 			       u8 tos, int oif, struct net_device *dev,
-			       __be32 *spec_dst, u32 *itag);
+			       u32 *itag);
+extern __be32 fib_compute_spec_dst(struct sk_buff *skb);
 extern void fib_select_default(struct fib_result *res);
 
 /* Exported by fib_semantics.c */
@@ -0,0 +1,33 @@
+/*
+ * Socket level accounting for xt_qtaguid.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef __NET_QTAGUID_H
+#define __NET_QTAGUID_H
+
+struct sock;
+
+/*
+ * Account data copied to/from a socket by its protocol's sendmsg/recvmsg.
+ * ifindex is the interface used if known, 0 for the one of the socket's
+ * cached route.
+ * Only acts when the xt_qtaguid sock_accounting param is set, and for
+ * sockets that have a file.
+ */
+#ifdef CONFIG_NETFILTER_XT_MATCH_QTAGUID
+void qtaguid_sock_snd(struct sock *sk, int ifindex, int bytes);
+void qtaguid_sock_rcv(struct sock *sk, int ifindex, int bytes);
+#else
+static inline void qtaguid_sock_snd(struct sock *sk, int ifindex, int bytes)
+{
+}
+static inline void qtaguid_sock_rcv(struct sock *sk, int ifindex, int bytes)
+{
+}
+#endif
+
+#endif /* __NET_QTAGUID_H */
@@ -106,12 +106,25 @@ struct listen_sock {
 	struct request_sock	*syn_table[0];
 };
 
+/*
+ * For a TCP Fast Open listener -
+ *	qlen - number of children created from a Fast Open SYN that have
+ *	       not yet seen the ACK of their SYN-ACK
+ *	max_qlen - max qlen allowed, as set by the TCP_FASTOPEN option,
+ *	       0 disables Fast Open on the listener
+ */
+struct fastopen_queue {
+	atomic_t		qlen;
+	int			max_qlen;
+};
+
 /** struct request_sock_queue - queue of request_socks
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
  * @syn_wait_lock - serializer
+ * @fastopenq - TCP Fast Open state of a listener
  *
  * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
  * lock sock while browsing the listening hash (otherwise it's deadlock prone).
@@ -129,6 +142,7 @@ struct request_sock_queue {
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
 	struct listen_sock	*listen_opt;
+	struct fastopen_queue	fastopenq;
 };
 
 extern int reqsk_queue_alloc(struct request_sock_queue *queue,
@@ -51,6 +51,10 @@ struct Qdisc {
 #define TCQ_F_INGRESS		2
 #define TCQ_F_CAN_BYPASS	4
 #define TCQ_F_MQROOT		8
+#define TCQ_F_ONETXQUEUE	0x10 /* all skbs go to q->dev_queue (MQ/MQPRIO
+				      * child or single queue device), so
+				      * dequeue_skb() may dequeue in bulk
+				      */
 #define TCQ_F_WARN_NONWC	(1 << 16)
 	int			padded;
 	struct Qdisc_ops	*ops;
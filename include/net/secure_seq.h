@@ -10,6 +10,8 @@ extern u32 secure_ipv6_port_ephemeral(const __be32 *saddr, const __be32 *daddr,
 				      __be16 dport);
 extern __u32 secure_tcp_sequence_number(__be32 saddr, __be32 daddr,
 					__be16 sport, __be16 dport);
+extern void secure_tcp_fastopen_cookie(u32 *cookie, __be32 saddr,
+				       __be32 daddr);
 extern __u32 secure_tcpv6_sequence_number(__be32 *saddr, __be32 *daddr,
 					  __be16 sport, __be16 dport);
 extern u64 secure_dccp_sequence_number(__be32 saddr, __be32 daddr,
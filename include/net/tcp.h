@@ -171,6 +171,11 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOPT_TIMESTAMP	8	/* Better RTT estimations/PAWS */
 #define TCPOPT_MD5SIG		19	/* MD5 Signature (RFC2385) */
 #define TCPOPT_COOKIE		253	/* Cookie extension (experimental) */
+#define TCPOPT_EXP		254	/* Experimental */
+/* Magic number to be after the option value for sharing TCP
+ * experimental options. See draft-ietf-tcpm-experimental-options-00.txt
+ */
+#define TCPOPT_FASTOPEN_MAGIC	0xF989
 
 /*
  *     TCP option lengths
@@ -185,6 +190,7 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOLEN_COOKIE_PAIR    3	/* Cookie pair header extension */
 #define TCPOLEN_COOKIE_MIN     (TCPOLEN_COOKIE_BASE+TCP_COOKIE_MIN)
 #define TCPOLEN_COOKIE_MAX     (TCPOLEN_COOKIE_BASE+TCP_COOKIE_MAX)
+#define TCPOLEN_EXP_FASTOPEN_BASE  4
 
 /* But this is what stacks really send out. */
 #define TCPOLEN_TSTAMP_ALIGNED		12
@@ -255,6 +261,8 @@ extern int sysctl_tcp_cookie_size;
 extern int sysctl_tcp_thin_linear_timeouts;
 extern int sysctl_tcp_thin_dupack;
 extern int sysctl_tcp_default_init_rwnd;
+extern int sysctl_tcp_limit_output_bytes;
+extern int sysctl_tcp_fastopen;
 
 extern atomic_long_t tcp_memory_allocated;
 
@@ -414,7 +422,7 @@ extern int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		       size_t len, int nonblock, int flags, int *addr_len);
 extern void tcp_parse_options(struct sk_buff *skb,
 			      struct tcp_options_received *opt_rx, u8 **hvpp,
-			      int estab);
+			      int estab, struct tcp_fastopen_cookie *foc);
 extern u8 *tcp_parse_md5sig_option(struct tcphdr *th);
 
 /*
@@ -493,16 +501,23 @@ extern int tcp_syn_flood_action(struct sock *sk,
 				const struct sk_buff *skb,
 				const char *proto);
 extern void tcp_push_one(struct sock *, unsigned int mss_now);
+extern void tcp_wfree(struct sk_buff *skb);
+extern void tcp_release_cb(struct sock *sk);
+extern void __init tcp_tasklet_init(void);
+extern enum hrtimer_restart tcp_pace_kick(struct hrtimer *timer);
 extern void tcp_send_ack(struct sock *sk);
 extern void tcp_send_delayed_ack(struct sock *sk);
 
 /* tcp_input.c */
 extern void tcp_cwnd_application_limited(struct sock *sk);
+extern void tcp_init_metrics(struct sock *sk);
+extern void tcp_init_buffer_space(struct sock *sk);
 
 /* tcp_timer.c */
 extern void tcp_init_xmit_timers(struct sock *);
 static inline void tcp_clear_xmit_timers(struct sock *sk)
 {
+	hrtimer_cancel(&tcp_sk(sk)->pacing_timer);
 	inet_csk_clear_xmit_timers(sk);
 }
 
@@ -639,11 +654,23 @@ extern u32 __tcp_select_window(struct sock *sk);
  */
 struct tcp_skb_cb {
 	union {
-		struct inet_skb_parm	h4;
+		/* For outgoing frames in the write queue, see tcp_rate.c */
+		struct {
+			/* There is space for up to 20 bytes */
+			__u32 is_app_limited:1, /* cwnd not fully used? */
+			      unused:31;
+			__u32 delivered;	/* tp->delivered at last (re)xmit */
+			__u32 first_tx_mstamp;	/* tp->first_tx_mstamp then */
+			__u32 delivered_mstamp;	/* when tp->delivered was reached */
+			__u32 sent_us;		/* time of last (re)xmit, in usec */
+		} tx;
+		union {
+			struct inet_skb_parm	h4;
 #if defined(CONFIG_IPV6) || defined (CONFIG_IPV6_MODULE)
-		struct inet6_skb_parm	h6;
+			struct inet6_skb_parm	h6;
 #endif
-	} header;	/* For incoming frames		*/
+		} header;	/* For incoming frames		*/
+	};
 	__u32		seq;		/* Starting sequence number	*/
 	__u32		end_seq;	/* SEQ + FIN + SYN + datalen	*/
 	__u32		when;		/* used to compute rtt's	*/
@@ -676,6 +703,32 @@ static inline int tcp_skb_mss(const struct sk_buff *skb)
 	return skb_shinfo(skb)->gso_size;
 }
 
+/* Microsecond clock of the delivery rate samples, wraps after 71 minutes */
+static inline u32 tcp_clock_us(void)
+{
+	return (u32)ktime_to_us(ktime_get());
+}
+
+/* A rate sample measures the number of (original/retransmitted) data
+ * packets delivered "delivered" over an interval of time "interval_us".
+ * The tcp_rate.c code fills in the rate sample, and congestion
+ * control modules that define a cong_control function to run at the end
+ * of ACK processing can optionally chose to consult this sample when
+ * setting cwnd and pacing rate.
+ * A sample is invalid if "delivered" or "interval_us" is negative.
+ */
+struct rate_sample {
+	u32  prior_mstamp;	/* starting timestamp for interval */
+	u32  prior_delivered;	/* tp->delivered at "prior_mstamp" */
+	s32  delivered;		/* number of packets delivered over interval */
+	long interval_us;	/* time for tp->delivered to incr "delivered" */
+	long rtt_us;		/* RTT of last (S)ACKed packet (or -1) */
+	int  acked_sacked;	/* number of packets newly (S)ACKed upon ACK */
+	u32  prior_in_flight;	/* in flight before this ACK */
+	bool is_app_limited;	/* is sample from packet with bubble in pipe? */
+	bool is_retrans;	/* is sample from retransmission? */
+};
+
 /* Events passed to congestion control interface */
 enum tcp_ca_event {
 	CA_EVENT_TX_START,	/* first transmit when no packets in flight */
@@ -710,7 +763,7 @@ struct tcp_congestion_ops {
 	u32 (*ssthresh)(struct sock *sk);
 	/* lower bound for congestion window (optional) */
 	u32 (*min_cwnd)(const struct sock *sk);
-	/* do new cwnd calculation (required) */
+	/* do new cwnd calculation (required unless cong_control is set) */
 	void (*cong_avoid)(struct sock *sk, u32 ack, u32 in_flight);
 	/* call before changing ca_state (optional) */
 	void (*set_state)(struct sock *sk, u8 new_state);
@@ -722,6 +775,10 @@ struct tcp_congestion_ops {
 	void (*pkts_acked)(struct sock *sk, u32 num_acked, s32 rtt_us);
 	/* get info for inet_diag (optional) */
 	void (*get_info)(struct sock *sk, u32 ext, struct sk_buff *skb);
+	/* call when packets are delivered to update cwnd and pacing rate,
+	 * after all the ca_state processing (optional)
+	 */
+	void (*cong_control)(struct sock *sk, const struct rate_sample *rs);
 
 	char 		name[TCP_CA_NAME_MAX];
 	struct module 	*owner;
@@ -1019,6 +1076,7 @@ static inline void tcp_openreq_init(struct request_sock *req,
 	req->rcv_wnd = 0;		/* So that tcp_send_synack() knows! */
 	req->cookie_ts = 0;
 	tcp_rsk(req)->rcv_isn = TCP_SKB_CB(skb)->seq;
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->seq + 1;
 	req->mss = rx_opt->mss_clamp;
 	req->ts_recent = rx_opt->saw_tstamp ? rx_opt->rcv_tsval : 0;
 	ireq->tstamp_ok = rx_opt->tstamp_ok;
@@ -1555,6 +1613,8 @@ static inline int tcp_s_data_size(const struct tcp_sock *tp)
  *
  * @cookie_plus:	bytes in authenticator/cookie option, copied from
  *			struct tcp_options_received (above).
+ *
+ * @fastopen_cookie:	Fast Open cookie to hand out in the SYNACK, if any.
  */
 struct tcp_extend_values {
 	struct request_values		rv;
@@ -1562,6 +1622,7 @@ struct tcp_extend_values {
 	u8				cookie_plus:6,
 					cookie_out_never:1,
 					cookie_in_always:1;
+	struct tcp_fastopen_cookie	*fastopen_cookie;
 };
 
 static inline struct tcp_extend_values *tcp_xv(struct request_values *rvp)
@@ -1569,6 +1630,52 @@ static inline struct tcp_extend_values *tcp_xv(struct request_values *rvp)
 	return (struct tcp_extend_values *)rvp;
 }
 
+/* TCP Fast Open, see net/ipv4/tcp_fastopen.c */
+
+/* Bits in sysctl_tcp_fastopen */
+#define	TFO_CLIENT_ENABLE	1
+#define	TFO_SERVER_ENABLE	2
+
+/* Fast Open request of a client, from sendmsg(MSG_FASTOPEN) until the
+ * SYN is sent.
+ */
+struct tcp_fastopen_request {
+	/* Fast Open cookie. Size 0 means a cookie request */
+	struct tcp_fastopen_cookie	cookie;
+	struct msghdr			*data;  /* data in MSG_FASTOPEN */
+	u16				copied;	/* queued in tcp_connect() */
+};
+
+static inline bool tcp_fastopen_cookie_present(const struct tcp_fastopen_cookie *foc)
+{
+	return foc->len >= TCP_FASTOPEN_COOKIE_MIN;
+}
+
+extern void tcp_free_fastopen_req(struct tcp_sock *tp);
+extern void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+				    struct tcp_fastopen_cookie *foc);
+extern void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+				   struct tcp_fastopen_cookie *cookie,
+				   int *syn_loss, unsigned long *last_syn_loss);
+extern void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+				   struct tcp_fastopen_cookie *cookie,
+				   bool syn_lost);
+extern bool tcp_fastopen_check(struct sock *sk, __be32 saddr, __be32 daddr,
+			       struct tcp_fastopen_cookie *foc,
+			       struct tcp_fastopen_cookie *valid_foc);
+extern void tcp_fastopen_child_init(struct sock *sk, struct sock *child,
+				    struct sk_buff *skb,
+				    struct request_sock *req);
+extern void tcp_fastopen_remove(struct sock *sk);
+
+/* From tcp_rate.c */
+extern void tcp_rate_skb_sent(struct sock *sk, struct sk_buff *skb);
+extern void tcp_rate_skb_delivered(struct sock *sk, struct sk_buff *skb,
+				   struct rate_sample *rs);
+extern void tcp_rate_gen(struct sock *sk, u32 delivered,
+			 struct rate_sample *rs);
+extern void tcp_rate_check_app_limited(struct sock *sk);
+
 extern void tcp_v4_init(void);
 extern void tcp_init(void);
 
@@ -48,6 +48,8 @@
 #define STATE_PENDING	1
 #define STATE_READY	2
 
+#define MQ_MSG_CACHE	4	/* recycled message buffers per queue */
+
 struct ext_wait_queue {		/* queue of sleeping tasks */
 	struct task_struct *task;
 	struct list_head list;
@@ -73,6 +75,9 @@ struct mqueue_inode_info {
 	struct ext_wait_queue e_wait_q[2];
 
 	unsigned long qsize; /* size of queue in memory (sum of all msgs) */
+
+	/* free message buffers sized for attr.mq_msgsize, see mq_msg_alloc() */
+	struct msg_msg *msg_cache[MQ_MSG_CACHE];
 };
 
 static const struct inode_operations mqueue_dir_inode_operations;
@@ -140,6 +145,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 		INIT_LIST_HEAD(&info->e_wait_q[1].list);
 		info->notify_owner = NULL;
 		info->qsize = 0;
+		memset(info->msg_cache, 0, sizeof(info->msg_cache));
 		info->user = NULL;	/* set when all is ok */
 		memset(&info->attr, 0, sizeof(info->attr));
 		info->attr.mq_maxmsg = ipc_ns->mq_msg_max;
@@ -272,6 +278,10 @@ static void mqueue_evict_inode(struct inode *inode)
 	kfree(info->messages);
 	spin_unlock(&info->lock);
 
+	for (i = 0; i < MQ_MSG_CACHE; i++)
+		if (info->msg_cache[i])
+			free_msg(info->msg_cache[i]);
+
 	/* Total amount of bytes accounted for the mqueue */
 	mq_bytes = info->attr.mq_maxmsg * (sizeof(struct msg_msg *)
 	    + info->attr.mq_msgsize);
@@ -812,6 +822,90 @@ out_unlock:
  * The same algorithm is used for senders.
  */
 
+/*
+ * Message buffers are recycled through a small per-queue cache, so that a
+ * steady stream of mq_timedsend()/mq_timedreceive() calls does not go
+ * through kmalloc()/kfree() for every message. Only buffers of exactly
+ * attr.mq_msgsize are cached and handed out again, so that short messages
+ * neither allocate nor pin more than they need. They are only kept while
+ * the queue has free slots for them: cached and queued messages together
+ * stay within the mq_maxmsg charged to the queue owner. Buffers are put
+ * in the cache under info->lock, senders take them out with xchg()
+ * without it.
+ */
+static struct msg_msg *mq_msg_alloc(struct mqueue_inode_info *info, int len)
+{
+	struct msg_msg *msg;
+	int i;
+
+	if (len != info->attr.mq_msgsize)
+		return alloc_msg(len);
+
+	for (i = 0; i < MQ_MSG_CACHE; i++) {
+		if (!info->msg_cache[i])
+			continue;
+		msg = xchg(&info->msg_cache[i], NULL);
+		if (msg)
+			return msg;
+	}
+	return alloc_msg(len);
+}
+
+static void mq_msg_free(struct mqueue_inode_info *info, struct msg_msg *msg)
+{
+	int i, slot = -1, cached = 0;
+
+	if (msg->m_ts != info->attr.mq_msgsize) {
+		free_msg(msg);
+		return;
+	}
+
+	spin_lock(&info->lock);
+	for (i = 0; i < MQ_MSG_CACHE; i++) {
+		if (info->msg_cache[i])
+			cached++;
+		else if (slot < 0)
+			slot = i;
+	}
+	if (slot >= 0 &&
+	    cached + info->attr.mq_curmsgs < info->attr.mq_maxmsg) {
+		security_msg_msg_free(msg);
+		msg->security = NULL;
+		info->msg_cache[slot] = msg;
+		msg = NULL;
+	}
+	spin_unlock(&info->lock);
+
+	if (msg)
+		free_msg(msg);
+}
+
+static struct msg_msg *mq_load_msg(struct mqueue_inode_info *info,
+				   const void __user *src, int len)
+{
+	struct msg_msg *msg;
+	int err;
+
+	msg = mq_msg_alloc(info, len);
+	if (!msg)
+		return ERR_PTR(-ENOMEM);
+	msg->m_ts = len;
+
+	err = copy_msg_from_user(msg, src, len);
+	if (err)
+		goto out_err;
+
+	err = security_msg_msg_alloc(msg);
+	if (err)
+		goto out_err;
+
+	return msg;
+
+out_err:
+	mq_msg_free(info, msg);
+	return ERR_PTR(err);
+}
+
 /* pipelined_send() - send a message directly to the task waiting in
  * sys_mq_timedreceive() (without inserting message into a queue).
  */
@@ -898,12 +992,11 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 
 	/* First try to allocate memory, before doing anything with
 	 * existing queues. */
-	msg_ptr = load_msg(u_msg_ptr, msg_len);
+	msg_ptr = mq_load_msg(info, u_msg_ptr, msg_len);
 	if (IS_ERR(msg_ptr)) {
 		ret = PTR_ERR(msg_ptr);
 		goto out_fput;
 	}
-	msg_ptr->m_ts = msg_len;
 	msg_ptr->m_type = msg_prio;
 
 	spin_lock(&info->lock);
@@ -919,7 +1012,7 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 			ret = wq_sleep(info, SEND, timeout, &wait);
 		}
 		if (ret < 0)
-			free_msg(msg_ptr);
+			mq_msg_free(info, msg_ptr);
 	} else {
 		receiver = wq_get_first_waiter(info, RECV);
 		if (receiver) {
@@ -1016,7 +1109,7 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 			store_msg(u_msg_ptr, msg_ptr, msg_ptr->m_ts)) {
 			ret = -EFAULT;
 		}
-		free_msg(msg_ptr);
+		mq_msg_free(info, msg_ptr);
 	}
 out_fput:
 	fput(filp);
@@ -47,11 +47,16 @@ struct msg_msgseg {
 #define DATALEN_MSG	(PAGE_SIZE-sizeof(struct msg_msg))
 #define DATALEN_SEG	(PAGE_SIZE-sizeof(struct msg_msgseg))
 
-struct msg_msg *load_msg(const void __user *src, int len)
+/*
+ * alloc_msg - allocate a message large enough for @len bytes
+ *
+ * The message is built from a msg_msg header plus as many msg_msgseg
+ * segments as needed; nothing is copied and no security blob is set up.
+ */
+struct msg_msg *alloc_msg(int len)
 {
 	struct msg_msg *msg;
 	struct msg_msgseg **pseg;
-	int err;
 	int alen;
 
 	alen = len;
@@ -60,18 +65,12 @@ struct msg_msg *load_msg(const void __user *src, int len)
 
 	msg = kmalloc(sizeof(*msg) + alen, GFP_KERNEL);
 	if (msg == NULL)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	msg->next = NULL;
 	msg->security = NULL;
 
-	if (copy_from_user(msg + 1, src, alen)) {
-		err = -EFAULT;
-		goto out_err;
-	}
-
 	len -= alen;
-	src = ((char __user *)src) + alen;
 	pseg = &msg->next;
 	while (len > 0) {
 		struct msg_msgseg *seg;
@@ -80,20 +79,65 @@ struct msg_msg *load_msg(const void __user *src, int len)
 			alen = DATALEN_SEG;
 		seg = kmalloc(sizeof(*seg) + alen,
 						 GFP_KERNEL);
-		if (seg == NULL) {
-			err = -ENOMEM;
+		if (seg == NULL)
 			goto out_err;
-		}
 		*pseg = seg;
 		seg->next = NULL;
-		if (copy_from_user(seg + 1, src, alen)) {
-			err = -EFAULT;
-			goto out_err;
-		}
 		pseg = &seg->next;
 		len -= alen;
+	}
+
+	return msg;
+
+out_err:
+	free_msg(msg);
+	return NULL;
+}
+
+/*
+ * copy_msg_from_user - fill a message allocated by alloc_msg()
+ *
+ * The message must have been allocated for at least @len bytes.
+ */
+int copy_msg_from_user(struct msg_msg *msg, const void __user *src, int len)
+{
+	struct msg_msgseg *seg;
+	int alen;
+
+	alen = len;
+	if (alen > DATALEN_MSG)
+		alen = DATALEN_MSG;
+	if (copy_from_user(msg + 1, src, alen))
+		return -EFAULT;
+
+	len -= alen;
+	src = ((char __user *)src) + alen;
+	seg = msg->next;
+	while (len > 0) {
+		alen = len;
+		if (alen > DATALEN_SEG)
+			alen = DATALEN_SEG;
+		if (copy_from_user(seg + 1, src, alen))
+			return -EFAULT;
+		len -= alen;
 		src = ((char __user *)src) + alen;
+		seg = seg->next;
 	}
+	return 0;
+}
+
+struct msg_msg *load_msg(const void __user *src, int len)
+{
+	struct msg_msg *msg;
+	int err;
+
+	msg = alloc_msg(len);
+	if (msg == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	err = copy_msg_from_user(msg, src, len);
+	if (err)
+		goto out_err;
 
 	err = security_msg_msg_alloc(msg);
 	if (err)
@@ -45,8 +45,9 @@
  *   - most operations do write operations (actually: spin_lock calls) to
  *     the per-semaphore array structure.
  *   Thus: Perfect SMP scaling between independent semaphore arrays.
- *         If multiple semaphores in one array are used, then cache line
- *         trashing on the semaphore array spinlock will limit the scaling.
+ *   - simple semop() calls (one sop, no complex operations pending) only
+ *     take the spinlock of the semaphore they operate on, see sem_lock_ops().
+ *   Thus: Independent semaphores in one array scale, too.
  * - semncnt and semzcnt are calculated on demand in count_semncnt() and
  *   count_semzcnt()
  * - the task that performs a successful semop() scans the list of all
@@ -67,9 +68,11 @@
  *   semaphore array, lazily allocated). For backwards compatibility, multiple
  *   modes for the UNDO variables are supported (per process, per thread)
  *   (see copy_semundo, CLONE_SYSVSEM)
- * - There are two lists of the pending operations: a per-array list
- *   and per-semaphore list (stored in the array). This allows to achieve FIFO
- *   ordering without always scanning all pending operations.
+ * - There are two lists of the pending operations: a per-array list for
+ *   complex operations and a per-semaphore list (stored in the array) for
+ *   simple operations. This allows to achieve FIFO ordering without always
+ *   scanning all pending operations, and lets simple operations get by
+ *   without the array spinlock.
  *   The worst-case behavior is nevertheless O(N^2) for N wakeups.
  */
 
@@ -109,6 +112,7 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
  *	sem_undo.id_next,
  *	sem_array.sem_pending{,last},
  *	sem_array.sem_undo: sem_lock() for read/write
+ *	sem.sem_pending: sem.lock or sem_lock() for read/write
  *	sem_undo.proc_next: only "current" is allowed to read/write that field.
  *	
  */
@@ -144,6 +148,22 @@ void __init sem_init (void)
 				IPC_SEM_IDS, sysvipc_sem_proc_show);
 }
 
+/*
+ * Wait until all simple semops that hold a per-semaphore lock are done.
+ * Must be called right after acquiring the array spinlock: from then on,
+ * new simple semops see the array lock held and fall back to it, see
+ * sem_lock_ops().
+ */
+static void sem_wait_array(struct sem_array *sma)
+{
+	int i;
+
+	/* pairs with the smp_mb() in sem_lock_ops() */
+	smp_mb();
+	for (i = 0; i < sma->sem_nsems; i++)
+		spin_unlock_wait(&sma->sem_base[i].lock);
+}
+
 /*
  * sem_lock_(check_) routines are called in the paths where the rw_mutex
  * is not held.
@@ -151,17 +171,38 @@ void __init sem_init (void)
 static inline struct sem_array *sem_lock(struct ipc_namespace *ns, int id)
 {
 	struct kern_ipc_perm *ipcp = ipc_lock(&sem_ids(ns), id);
+	struct sem_array *sma;
 
 	if (IS_ERR(ipcp))
 		return (struct sem_array *)ipcp;
 
-	return container_of(ipcp, struct sem_array, sem_perm);
+	sma = container_of(ipcp, struct sem_array, sem_perm);
+	sem_wait_array(sma);
+	return sma;
 }
 
 static inline struct sem_array *sem_lock_check(struct ipc_namespace *ns,
 						int id)
 {
 	struct kern_ipc_perm *ipcp = ipc_lock_check(&sem_ids(ns), id);
+	struct sem_array *sma;
+
+	if (IS_ERR(ipcp))
+		return (struct sem_array *)ipcp;
+
+	sma = container_of(ipcp, struct sem_array, sem_perm);
+	sem_wait_array(sma);
+	return sma;
+}
+
+/*
+ * Look up a semaphore array without locking it. Called with
+ * rcu_read_lock() held, the caller then locks with sem_lock_ops().
+ */
+static inline struct sem_array *sem_obtain_object_check(struct ipc_namespace *ns,
+							 int id)
+{
+	struct kern_ipc_perm *ipcp = ipc_obtain_object_check(&sem_ids(ns), id);
 
 	if (IS_ERR(ipcp))
 		return (struct sem_array *)ipcp;
@@ -169,9 +210,59 @@ static inline struct sem_array *sem_lock_check(struct ipc_namespace *ns,
 	return container_of(ipcp, struct sem_array, sem_perm);
 }
 
+/*
+ * sem_lock_ops - lock a semaphore array for a semop() call
+ *
+ * A simple operation (a single sop) while no complex operations are
+ * pending only needs the spinlock of the semaphore it operates on.
+ * Everything else takes the array spinlock, which excludes all
+ * per-semaphore lock holders.
+ *
+ * Returns the number of the locked semaphore, or -1 if the whole array
+ * was locked. Called with rcu_read_lock() held.
+ */
+static inline int sem_lock_ops(struct sem_array *sma, struct sembuf *sops,
+			       int nsops)
+{
+	if (nsops == 1 && !sma->complex_count) {
+		struct sem *sem = sma->sem_base + sops->sem_num;
+
+		spin_lock(&sem->lock);
+
+		/* pairs with the smp_mb() in sem_wait_array() */
+		smp_mb();
+
+		/*
+		 * If the array lock is free, everyone who takes it from
+		 * now on waits for us in sem_wait_array(). complex_count
+		 * only changes under the array lock, thus it is stable.
+		 */
+		if (!spin_is_locked(&sma->sem_perm.lock)) {
+			smp_rmb();
+			if (!sma->complex_count)
+				return sops->sem_num;
+		}
+		spin_unlock(&sem->lock);
+	}
+
+	spin_lock(&sma->sem_perm.lock);
+	sem_wait_array(sma);
+	return -1;
+}
+
+static inline void sem_unlock_ops(struct sem_array *sma, int locknum)
+{
+	if (locknum == -1)
+		spin_unlock(&sma->sem_perm.lock);
+	else
+		spin_unlock(&sma->sem_base[locknum].lock);
+	rcu_read_unlock();
+}
+
 static inline void sem_lock_and_putref(struct sem_array *sma)
 {
 	ipc_lock_by_ptr(&sma->sem_perm);
+	sem_wait_array(sma);
 	ipc_rcu_putref(sma);
 }
 
@@ -198,7 +289,7 @@ static inline void sem_rmid(struct ipc_namespace *ns, struct sem_array *s)
  * Without the check/retry algorithm a lockless wakeup is possible:
  * - queue.status is initialized to -EINTR before blocking.
  * - wakeup is performed by
- *	* unlinking the queue entry from sma->sem_pending
+ *	* unlinking the queue entry from the pending list
  *	* setting queue.status to IN_WAKEUP
  *	  This is the notification for the blocked thread that a
  *	  result value is imminent.
@@ -268,24 +359,31 @@ static int newary(struct ipc_namespace *ns, struct ipc_params *params)
 		return retval;
 	}
 
-	id = ipc_addid(&sem_ids(ns), &sma->sem_perm, ns->sc_semmni);
-	if (id < 0) {
-		security_sem_free(sma);
-		ipc_rcu_putref(sma);
-		return id;
-	}
-	ns->used_sems += nsems;
-
+	/*
+	 * Initialize the semaphores before the array becomes visible:
+	 * semtimedop() may look at them without holding the array lock.
+	 */
 	sma->sem_base = (struct sem *) &sma[1];
 
-	for (i = 0; i < nsems; i++)
+	for (i = 0; i < nsems; i++) {
 		INIT_LIST_HEAD(&sma->sem_base[i].sem_pending);
+		spin_lock_init(&sma->sem_base[i].lock);
+	}
 
 	sma->complex_count = 0;
 	INIT_LIST_HEAD(&sma->sem_pending);
 	INIT_LIST_HEAD(&sma->list_id);
 	sma->sem_nsems = nsems;
 	sma->sem_ctime = get_seconds();
+
+	id = ipc_addid(&sem_ids(ns), &sma->sem_perm, ns->sc_semmni);
+	if (id < 0) {
+		security_sem_free(sma);
+		ipc_rcu_putref(sma);
+		return id;
+	}
+	ns->used_sems += nsems;
+
 	sem_unlock(sma);
 
 	return sma->sem_perm.id;
@@ -425,7 +523,7 @@ static void wake_up_sem_queue_prepare(struct list_head *pt,
 	q->status = IN_WAKEUP;
 	q->pid = error;
 
-	list_add_tail(&q->simple_list, pt);
+	list_add_tail(&q->list, pt);
 }
 
 /**
@@ -443,7 +541,7 @@ static void wake_up_sem_queue_do(struct list_head *pt)
 	int did_something;
 
 	did_something = !list_empty(pt);
-	list_for_each_entry_safe(q, t, pt, simple_list) {
+	list_for_each_entry_safe(q, t, pt, list) {
 		wake_up_process(q->sleeper);
 		/* q can disappear immediately after writing q->status. */
 		smp_wmb();
@@ -456,9 +554,7 @@ static void wake_up_sem_queue_do(struct list_head *pt)
 static void unlink_queue(struct sem_array *sma, struct sem_queue *q)
 {
 	list_del(&q->list);
-	if (q->nsops == 1)
-		list_del(&q->simple_list);
-	else
+	if (q->nsops > 1)
 		sma->complex_count--;
 }
 
@@ -513,7 +609,7 @@ static int check_restart(struct sem_array *sma, struct sem_queue *q)
 	 * semval is 0. Check if there are wait-for-zero semops.
 	 * They must be the first entries in the per-semaphore simple queue
 	 */
-	h = list_first_entry(&curr->sem_pending, struct sem_queue, simple_list);
+	h = list_first_entry(&curr->sem_pending, struct sem_queue, list);
 	BUG_ON(h->nsops != 1);
 	BUG_ON(h->sops[0].sem_num != q->sops[0].sem_num);
 
@@ -534,7 +630,9 @@ static int check_restart(struct sem_array *sma, struct sem_queue *q)
  *
  * update_queue must be called after a semaphore in a semaphore array
  * was modified. If multiple semaphore were modified, then @semnum
- * must be set to -1.
+ * must be set to -1: that scans the queue of complex operations, the
+ * per-semaphore queues must be scanned separately. The queues of the
+ * semaphores a completed complex operation changed are scanned here.
  * The tasks that must be woken up are added to @pt. The return code
  * is stored in q->pid.
  * The function return 1 if at least one semop was completed successfully.
@@ -544,30 +642,19 @@ static int update_queue(struct sem_array *sma, int semnum, struct list_head *pt)
 	struct sem_queue *q;
 	struct list_head *walk;
 	struct list_head *pending_list;
-	int offset;
 	int semop_completed = 0;
 
-	/* if there are complex operations around, then knowing the semaphore
-	 * that was modified doesn't help us. Assume that multiple semaphores
-	 * were modified.
-	 */
-	if (sma->complex_count)
-		semnum = -1;
-
-	if (semnum == -1) {
+	if (semnum == -1)
 		pending_list = &sma->sem_pending;
-		offset = offsetof(struct sem_queue, list);
-	} else {
+	else
 		pending_list = &sma->sem_base[semnum].sem_pending;
-		offset = offsetof(struct sem_queue, simple_list);
-	}
 
 again:
 	walk = pending_list->next;
 	while (walk != pending_list) {
 		int error, restart;
 
-		q = (struct sem_queue *)((char *)walk - offset);
+		q = container_of(walk, struct sem_queue, list);
 		walk = walk->next;
 
 		/* If we are scanning the single sop, per-semaphore list of
@@ -595,6 +682,20 @@ again:
 		} else {
 			semop_completed = 1;
 			restart = check_restart(sma, q);
+
+			/*
+			 * A complex operation may have changed semaphores
+			 * that simple operations wait on: those sit only on
+			 * the per-semaphore queues.
+			 */
+			if (semnum == -1 && q->alter) {
+				int i;
+
+				for (i = 0; i < q->nsops; i++)
+					if (q->sops[i].sem_op)
+						update_queue(sma,
+							q->sops[i].sem_num, pt);
+			}
 		}
 
 		wake_up_sem_queue_prepare(pt, q, error);
@@ -621,22 +722,39 @@ again:
 static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsops,
 			int otime, struct list_head *pt)
 {
-	int i;
+	int i, simple_completed = 0;
 
 	if (sma->complex_count || sops == NULL) {
 		if (update_queue(sma, -1, pt))
 			otime = 1;
-		goto done;
 	}
 
-	for (i = 0; i < nsops; i++) {
-		if (sops[i].sem_op > 0 ||
-			(sops[i].sem_op < 0 &&
-				sma->sem_base[sops[i].sem_num].semval == 0))
-			if (update_queue(sma, sops[i].sem_num, pt))
-				otime = 1;
+	if (sops == NULL) {
+		/* No semops: anything may have changed, scan all queues. */
+		for (i = 0; i < sma->sem_nsems; i++) {
+			if (update_queue(sma, i, pt))
+				simple_completed = 1;
+		}
+	} else {
+		for (i = 0; i < nsops; i++) {
+			if (sops[i].sem_op > 0 ||
+				(sops[i].sem_op < 0 &&
+				 sma->sem_base[sops[i].sem_num].semval == 0))
+				if (update_queue(sma, sops[i].sem_num, pt))
+					simple_completed = 1;
+		}
+	}
+
+	/*
+	 * The simple operations that completed changed semaphores that
+	 * complex operations may wait on.
+	 */
+	if (simple_completed) {
+		otime = 1;
+		if (sma->complex_count)
+			update_queue(sma, -1, pt);
 	}
-done:
+
 	if (otime)
 		sma->sem_otime = get_seconds();
 }
@@ -657,6 +775,12 @@ static int count_semncnt (struct sem_array * sma, ushort semnum)
 	struct sem_queue * q;
 
 	semncnt = 0;
+	list_for_each_entry(q, &sma->sem_base[semnum].sem_pending, list) {
+		struct sembuf * sops = q->sops;
+		if ((sops->sem_op < 0)
+		    && !(sops->sem_flg & IPC_NOWAIT))
+			semncnt++;
+	}
 	list_for_each_entry(q, &sma->sem_pending, list) {
 		struct sembuf * sops = q->sops;
 		int nsops = q->nsops;
@@ -676,6 +800,12 @@ static int count_semzcnt (struct sem_array * sma, ushort semnum)
 	struct sem_queue * q;
 
 	semzcnt = 0;
+	list_for_each_entry(q, &sma->sem_base[semnum].sem_pending, list) {
+		struct sembuf * sops = q->sops;
+		if ((sops->sem_op == 0)
+		    && !(sops->sem_flg & IPC_NOWAIT))
+			semzcnt++;
+	}
 	list_for_each_entry(q, &sma->sem_pending, list) {
 		struct sembuf * sops = q->sops;
 		int nsops = q->nsops;
@@ -699,6 +829,7 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	struct sem_queue *q, *tq;
 	struct sem_array *sma = container_of(ipcp, struct sem_array, sem_perm);
 	struct list_head tasks;
+	int i;
 
 	/* Free the existing undo structures for this semaphore set.  */
 	assert_spin_locked(&sma->sem_perm.lock);
@@ -717,6 +848,13 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 		unlink_queue(sma, q);
 		wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
 	}
+	for (i = 0; i < sma->sem_nsems; i++) {
+		struct sem *sem = sma->sem_base + i;
+		list_for_each_entry_safe(q, tq, &sem->sem_pending, list) {
+			unlink_queue(sma, q);
+			wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
+		}
+	}
 
 	/* Remove the semaphore set from the IDR */
 	sem_rmid(ns, sma);
@@ -1048,6 +1186,7 @@ static int semctl_down(struct ipc_namespace *ns, int semid,
 		return PTR_ERR(ipcp);
 
 	sma = container_of(ipcp, struct sem_array, sem_perm);
+	sem_wait_array(sma);
 
 	err = security_sem_semctl(sma, cmd);
 	if (err)
@@ -1289,7 +1428,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	struct sembuf fast_sops[SEMOPM_FAST];
 	struct sembuf* sops = fast_sops, *sop;
 	struct sem_undo *un;
-	int undos = 0, alter = 0, max;
+	int undos = 0, alter = 0, max, locknum;
 	struct sem_queue queue;
 	unsigned long jiffies_left = 0;
 	struct ipc_namespace *ns;
@@ -1344,14 +1483,27 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 
 	INIT_LIST_HEAD(&tasks);
 
-	sma = sem_lock_check(ns, semid);
+	rcu_read_lock();
+	sma = sem_obtain_object_check(ns, semid);
 	if (IS_ERR(sma)) {
+		rcu_read_unlock();
 		if (un)
 			rcu_read_unlock();
 		error = PTR_ERR(sma);
 		goto out_free;
 	}
 
+	/* sem_nsems never changes, check it before picking a lock */
+	error = -EFBIG;
+	if (max >= sma->sem_nsems) {
+		rcu_read_unlock();
+		if (un)
+			rcu_read_unlock();
+		goto out_free;
+	}
+
+	locknum = sem_lock_ops(sma, sops, nsops);
+
 	/*
 	 * semid identifiers are not unique - find_alloc_undo may have
 	 * allocated an undo structure, it was invalidated by an RMID
@@ -1377,8 +1529,8 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 		}
 	}
 
-	error = -EFBIG;
-	if (max >= sma->sem_nsems)
+	/* the array was removed while we did not hold any lock */
+	if (sma->sem_perm.deleted)
 		goto out_unlock_free;
 
 	error = -EACCES;
@@ -1406,28 +1558,27 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	queue.undo = un;
 	queue.pid = task_tgid_vnr(current);
 	queue.alter = alter;
-	if (alter)
-		list_add_tail(&queue.list, &sma->sem_pending);
-	else
-		list_add(&queue.list, &sma->sem_pending);
 
 	if (nsops == 1) {
 		struct sem *curr;
 		curr = &sma->sem_base[sops->sem_num];
 
 		if (alter)
-			list_add_tail(&queue.simple_list, &curr->sem_pending);
+			list_add_tail(&queue.list, &curr->sem_pending);
 		else
-			list_add(&queue.simple_list, &curr->sem_pending);
+			list_add(&queue.list, &curr->sem_pending);
 	} else {
-		INIT_LIST_HEAD(&queue.simple_list);
+		if (alter)
+			list_add_tail(&queue.list, &sma->sem_pending);
+		else
+			list_add(&queue.list, &sma->sem_pending);
 		sma->complex_count++;
 	}
 
 	queue.status = -EINTR;
 	queue.sleeper = current;
 	current->state = TASK_INTERRUPTIBLE;
-	sem_unlock(sma);
+	sem_unlock_ops(sma, locknum);
 
 	if (timeout)
 		jiffies_left = schedule_timeout(jiffies_left);
@@ -1450,6 +1601,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	}
 
 	sma = sem_lock(ns, semid);
+	locknum = -1;
 
 	/*
 	 * Wait until it's guaranteed that no wakeup_sem_queue_do() is ongoing.
@@ -1482,7 +1634,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	unlink_queue(sma, &queue);
 
 out_unlock_free:
-	sem_unlock(sma);
+	sem_unlock_ops(sma, locknum);
 
 	wake_up_sem_queue_do(&tasks);
 out_free:
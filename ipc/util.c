@@ -707,6 +707,31 @@ struct kern_ipc_perm *ipc_lock(struct ipc_ids *ids, int id)
 	return out;
 }
 
+/**
+ * ipc_obtain_object_check - look up an ipc object without locking it
+ * @ids: IPC identifier set
+ * @id: ipc id to look for
+ *
+ * Look for an id in the ipc ids idr and return the associated ipc
+ * object, after checking its sequence number. The object is returned
+ * unlocked: the caller must hold rcu_read_lock() and must check
+ * ->deleted once it has taken whatever lock protects the object.
+ */
+struct kern_ipc_perm *ipc_obtain_object_check(struct ipc_ids *ids, int id)
+{
+	struct kern_ipc_perm *out;
+	int lid = ipcid_to_idx(id);
+
+	out = idr_find(&ids->ipcs_idr, lid);
+	if (out == NULL)
+		return ERR_PTR(-EINVAL);
+
+	if (ipc_checkid(out, id))
+		return ERR_PTR(-EIDRM);
+
+	return out;
+}
+
 struct kern_ipc_perm *ipc_lock_check(struct ipc_ids *ids, int id)
 {
 	struct kern_ipc_perm *out;
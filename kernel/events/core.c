@@ -18,6 +18,7 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/hash.h>
+#include <linux/jhash.h>
 #include <linux/sysfs.h>
 #include <linux/dcache.h>
 #include <linux/percpu.h>
@@ -1014,6 +1015,9 @@ static void perf_event__header_size(struct perf_event *event)
 	if (sample_type & PERF_SAMPLE_READ)
 		size += event->read_size;
 
+	if (sample_type & PERF_SAMPLE_CALLCHAIN_ID)
+		size += sizeof(data->stack_id);
+
 	event->header_size = size;
 }
 
@@ -2907,6 +2911,67 @@ exit_put:
 	return entry;
 }
 
+/*
+ * Callchain deduplication: every ring buffer that wants it keeps a small
+ * direct mapped table of the stack ids whose ips were written into it,
+ * samples of a callchain found there only carry the stack id.
+ */
+#define PERF_STACK_IDS		256
+
+static u64 perf_callchain_id(struct perf_callchain_entry *entry)
+{
+	u32 hi, lo;
+
+	if (!entry || !entry->nr)
+		return 0;
+
+	hi = jhash2((u32 *)entry->ip, entry->nr * 2, 0);
+	lo = jhash2((u32 *)entry->ip, entry->nr * 2, hi);
+
+	/* 0 means no callchain */
+	return ((u64)hi << 32 | lo) ?: 1;
+}
+
+static inline u64 *perf_stack_id_slot(struct ring_buffer *rb, u64 id)
+{
+	return &rb->stack_ids[(u32)id & (PERF_STACK_IDS - 1)];
+}
+
+static void perf_prepare_stack_id(struct perf_event *event,
+				  struct perf_sample_data *data)
+{
+	struct ring_buffer *rb;
+
+	data->stack_id = perf_callchain_id(data->callchain);
+	if (!data->stack_id)
+		return;
+
+	if (event->parent)
+		event = event->parent;
+
+	rcu_read_lock();
+	rb = rcu_dereference(event->rb);
+	if (rb && rb->stack_ids) {
+		u64 *slot = perf_stack_id_slot(rb, data->stack_id);
+
+		data->stack_id_seen = ACCESS_ONCE(*slot) == data->stack_id;
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Only remember a callchain once its ips are in the buffer, so lost
+ * samples never leave the reader with an unknown stack id.
+ */
+static void perf_output_stack_id_seen(struct perf_output_handle *handle,
+				      u64 id)
+{
+	struct ring_buffer *rb = handle->rb;
+
+	if (id && rb->stack_ids)
+		ACCESS_ONCE(*perf_stack_id_slot(rb, id)) = id;
+}
+
 /*
  * Initialize the perf_event context in a task_struct:
  */
@@ -3683,6 +3748,7 @@ static void rb_free_rcu(struct rcu_head *rcu_head)
 	struct ring_buffer *rb;
 
 	rb = container_of(rcu_head, struct ring_buffer, rcu_head);
+	kfree(rb->stack_ids);
 	rb_free(rb);
 }
 
@@ -3828,6 +3894,16 @@ static int perf_mmap(struct file *file, struct vm_area_struct *vma)
 		ret = -ENOMEM;
 		goto unlock;
 	}
+
+	/*
+	 * Callchains can only be left out of a sample if the reader never
+	 * misses the one that carried them, not so with overwriting.
+	 */
+	if ((event->attr.sample_type & PERF_SAMPLE_CALLCHAIN_ID) &&
+	    rb->writable)
+		rb->stack_ids = kcalloc(PERF_STACK_IDS, sizeof(u64),
+					GFP_KERNEL);
+
 	rcu_assign_pointer(event->rb, rb);
 
 	atomic_long_add(user_extra, &user->locked_vm);
@@ -4087,6 +4163,151 @@ static void perf_output_read(struct perf_output_handle *handle,
 		perf_output_read_one(handle, event, enabled, running);
 }
 
+static void
+perf_output_sample_regs(struct perf_output_handle *handle,
+			struct pt_regs *regs, u64 mask)
+{
+	int bit;
+
+	for_each_set_bit(bit, (const unsigned long *) &mask,
+			 sizeof(mask) * BITS_PER_BYTE) {
+		u64 val;
+
+		val = perf_reg_value(regs, bit);
+		perf_output_put(handle, val);
+	}
+}
+
+static void perf_sample_regs_user(struct perf_regs_user *regs_user,
+				  struct pt_regs *regs)
+{
+	if (!user_mode(regs)) {
+		if (current->mm)
+			regs = task_pt_regs(current);
+		else
+			regs = NULL;
+	}
+
+	if (regs) {
+		regs_user->regs = regs;
+		regs_user->abi  = perf_reg_abi(current);
+	}
+}
+
+#ifdef CONFIG_HAVE_PERF_USER_STACK_DUMP
+/*
+ * Get remaining task size from user stack pointer.
+ *
+ * It'd be better to take stack vma map and limit this more
+ * precisely, but there's no way to get it safely under interrupt,
+ * so using TASK_SIZE as limit.
+ */
+static u64 perf_ustack_task_size(struct pt_regs *regs)
+{
+	unsigned long addr = user_stack_pointer(regs);
+
+	if (!addr || addr >= TASK_SIZE)
+		return 0;
+
+	return TASK_SIZE - addr;
+}
+
+static void
+perf_output_sample_ustack(struct perf_output_handle *handle, u64 dump_size,
+			  struct pt_regs *regs)
+{
+	/*
+	 * Case of a kernel thread, or no room left in the sample,
+	 * nothing to dump. Only the size field was reserved.
+	 */
+	if (!regs || !dump_size) {
+		u64 size = 0;
+		perf_output_put(handle, size);
+	} else {
+		unsigned long sp;
+		unsigned int rem;
+		u64 dyn_size;
+
+		/*
+		 * We dump:
+		 * static size
+		 *   - the size requested by user or the best one we can fit
+		 *     in to the sample max size
+		 * data
+		 *   - user stack dump data
+		 * dynamic size
+		 *   - the actual dumped size
+		 */
+
+		/* Static size. */
+		perf_output_put(handle, dump_size);
+
+		/* Data. */
+		sp = user_stack_pointer(regs);
+		rem = __output_copy_user(handle, (void __user *) sp, dump_size);
+		dyn_size = dump_size - rem;
+
+		__output_skip(handle, rem);
+
+		/* Dynamic size. */
+		perf_output_put(handle, dyn_size);
+	}
+}
+#else
+static inline u64 perf_ustack_task_size(struct pt_regs *regs)
+{
+	return 0;
+}
+
+static inline void
+perf_output_sample_ustack(struct perf_output_handle *handle, u64 dump_size,
+			  struct pt_regs *regs)
+{
+	u64 size = 0;
+
+	perf_output_put(handle, size);
+}
+#endif /* CONFIG_HAVE_PERF_USER_STACK_DUMP */
+
+static u16
+perf_sample_ustack_size(u16 stack_size, u16 header_size,
+			struct pt_regs *regs)
+{
+	u64 task_size;
+
+	/* No regs, no stack pointer, no dump. */
+	if (!regs)
+		return 0;
+
+	/*
+	 * Check if we fit in with the requested stack size into the:
+	 * - TASK_SIZE
+	 *   If we don't, we limit the size to the TASK_SIZE.
+	 *
+	 * - remaining sample size
+	 *   If we don't, we customize the stack size to
+	 *   fit in to the remaining sample size.
+	 */
+
+	task_size  = min((u64) USHRT_MAX, perf_ustack_task_size(regs));
+	stack_size = min(stack_size, (u16) task_size);
+
+	/* Current header size plus static size and dynamic size. */
+	header_size += 2 * sizeof(u64);
+
+	/* Do we fit in with the current stack dump size? */
+	if ((u16) (header_size + stack_size) < header_size) {
+		/*
+		 * If we overflow the maximum size for the sample,
+		 * we customize the stack dump size to fit in.
+		 */
+		stack_size = USHRT_MAX - header_size - sizeof(u64);
+		stack_size = round_down(stack_size, sizeof(u64));
+	}
+
+	return stack_size;
+}
+
 void perf_output_sample(struct perf_output_handle *handle,
 			struct perf_event_header *header,
 			struct perf_sample_data *data,
@@ -4123,8 +4344,11 @@ void perf_output_sample(struct perf_output_handle *handle,
 	if (sample_type & PERF_SAMPLE_READ)
 		perf_output_read(handle, event);
 
+	if (sample_type & PERF_SAMPLE_CALLCHAIN_ID)
+		perf_output_put(handle, data->stack_id);
+
 	if (sample_type & PERF_SAMPLE_CALLCHAIN) {
-		if (data->callchain) {
+		if (data->callchain && !data->stack_id_seen) {
 			int size = 1;
 
 			if (data->callchain)
@@ -4133,6 +4357,10 @@ void perf_output_sample(struct perf_output_handle *handle,
 			size *= sizeof(u64);
 
 			__output_copy(handle, data->callchain, size);
+
+			if (sample_type & PERF_SAMPLE_CALLCHAIN_ID)
+				perf_output_stack_id_seen(handle,
+							  data->stack_id);
 		} else {
 			u64 nr = 0;
 			perf_output_put(handle, nr);
@@ -4156,6 +4384,28 @@ void perf_output_sample(struct perf_output_handle *handle,
 		}
 	}
 
+	if (sample_type & PERF_SAMPLE_REGS_USER) {
+		u64 abi = data->regs_user.abi;
+
+		/*
+		 * If there are no regs to dump, notice it through
+		 * first u64 being zero (PERF_SAMPLE_REGS_ABI_NONE).
+		 */
+		perf_output_put(handle, abi);
+
+		if (abi) {
+			u64 mask = event->attr.sample_regs_user;
+			perf_output_sample_regs(handle,
+						data->regs_user.regs,
+						mask);
+		}
+	}
+
+	if (sample_type & PERF_SAMPLE_STACK_USER)
+		perf_output_sample_ustack(handle,
+					  data->stack_user_size,
+					  data->regs_user.regs);
+
 	if (!event->attr.watermark) {
 		int wakeup_events = event->attr.wakeup_events;
 
@@ -4194,7 +4444,12 @@ void perf_prepare_sample(struct perf_event_header *header,
 
 		data->callchain = perf_callchain(regs);
 
-		if (data->callchain)
+		data->stack_id = 0;
+		data->stack_id_seen = 0;
+		if (sample_type & PERF_SAMPLE_CALLCHAIN_ID)
+			perf_prepare_stack_id(event, data);
+
+		if (data->callchain && !data->stack_id_seen)
 			size += data->callchain->nr;
 
 		header->size += size * sizeof(u64);
@@ -4211,6 +4466,48 @@ void perf_prepare_sample(struct perf_event_header *header,
 		WARN_ON_ONCE(size & (sizeof(u64)-1));
 		header->size += size;
 	}
+
+	if (sample_type & PERF_SAMPLE_REGS_USER) {
+		/* regs dump ABI info */
+		int size = sizeof(u64);
+
+		perf_sample_regs_user(&data->regs_user, regs);
+
+		if (data->regs_user.regs) {
+			u64 mask = event->attr.sample_regs_user;
+			size += hweight64(mask) * sizeof(u64);
+		}
+
+		header->size += size;
+	}
+
+	if (sample_type & PERF_SAMPLE_STACK_USER) {
+		/*
+		 * PERF_SAMPLE_STACK_USER has to stay the last one processed,
+		 * the dump size is trimmed to what is left of the maximal
+		 * sample size.
+		 */
+		struct perf_regs_user *uregs = &data->regs_user;
+		u16 stack_size = event->attr.sample_stack_user;
+		u16 size = sizeof(u64);
+
+		if (!uregs->abi)
+			perf_sample_regs_user(uregs, regs);
+
+		stack_size = perf_sample_ustack_size(stack_size, header->size,
+						     uregs->regs);
+
+		/*
+		 * If there is something to dump, add space for the dump
+		 * itself and for the field that tells the dynamic size,
+		 * which is how many have been actually dumped.
+		 */
+		if (stack_size)
+			size += sizeof(u64) + stack_size;
+
+		data->stack_user_size = stack_size;
+		header->size += size;
+	}
 }
 
 static void perf_event_output(struct perf_event *event,
@@ -6150,15 +6447,49 @@ static int perf_copy_attr(struct perf_event_attr __user *uattr,
 	if (ret)
 		return -EFAULT;
 
-	if (attr->__reserved_1)
+	if (attr->__reserved_1 || attr->__reserved_2)
 		return -EINVAL;
 
-	if (attr->sample_type & ~(PERF_SAMPLE_MAX-1))
+	if (attr->sample_type &
+	    ~((PERF_SAMPLE_MAX-1) | PERF_SAMPLE_CALLCHAIN_ID))
 		return -EINVAL;
 
+	/* no branch stack sampling hardware support */
+	if ((attr->sample_type & PERF_SAMPLE_BRANCH_STACK) ||
+	    attr->branch_sample_type)
+		return -EOPNOTSUPP;
+
 	if (attr->read_format & ~(PERF_FORMAT_MAX-1))
 		return -EINVAL;
 
+	if ((attr->sample_type & PERF_SAMPLE_CALLCHAIN_ID) &&
+	    !(attr->sample_type & PERF_SAMPLE_CALLCHAIN))
+		return -EINVAL;
+
+	if (attr->sample_type & PERF_SAMPLE_REGS_USER) {
+		ret = perf_reg_validate(attr->sample_regs_user);
+		if (ret)
+			return ret;
+	}
+
+	if (attr->sample_type & PERF_SAMPLE_STACK_USER) {
+#ifdef CONFIG_HAVE_PERF_USER_STACK_DUMP
+		/*
+		 * We have __u32 type for the size, but so far
+		 * we can only use __u16 as maximum due to the
+		 * __u16 sample size limit. A zero size asks for
+		 * nothing, it is rejected.
+		 */
+		if (!attr->sample_stack_user ||
+		    attr->sample_stack_user >= USHRT_MAX)
+			ret = -EINVAL;
+		else if (!IS_ALIGNED(attr->sample_stack_user, sizeof(u64)))
+			ret = -EINVAL;
+#else
+		ret = -ENOSYS;
+#endif
+	}
+
 out:
 	return ret;
 
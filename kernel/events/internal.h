@@ -1,6 +1,8 @@
 #ifndef _KERNEL_EVENTS_INTERNAL_H
 #define _KERNEL_EVENTS_INTERNAL_H
 
+#include <linux/uaccess.h>
+
 #define RING_BUFFER_WRITABLE		0x01
 
 struct ring_buffer {
@@ -23,6 +25,8 @@ struct ring_buffer {
 
 	long				watermark;	/* wakeup watermark  */
 
+	u64				*stack_ids;	/* callchains seen   */
+
 	struct perf_event_mmap_page	*user_page;
 	void				*data_pages[0];
 };
@@ -69,6 +73,21 @@ static unsigned long perf_data_size(struct ring_buffer *rb)
 	return rb->nr_pages << (PAGE_SHIFT + page_order(rb));
 }
 
+static inline void
+__output_advance(struct perf_output_handle *handle, unsigned long size)
+{
+	handle->addr += size;
+	handle->size -= size;
+	if (!handle->size) {
+		struct ring_buffer *rb = handle->rb;
+
+		handle->page++;
+		handle->page &= rb->nr_pages - 1;
+		handle->addr = rb->data_pages[handle->page];
+		handle->size = PAGE_SIZE << page_order(rb);
+	}
+}
+
 static inline void
 __output_copy(struct perf_output_handle *handle,
 		   const void *buf, unsigned int len)
@@ -79,17 +98,46 @@ __output_copy(struct perf_output_handle *handle,
 		memcpy(handle->addr, buf, size);
 
 		len -= size;
-		handle->addr += size;
 		buf += size;
-		handle->size -= size;
-		if (!handle->size) {
-			struct ring_buffer *rb = handle->rb;
-
-			handle->page++;
-			handle->page &= rb->nr_pages - 1;
-			handle->addr = rb->data_pages[handle->page];
-			handle->size = PAGE_SIZE << page_order(rb);
-		}
+		__output_advance(handle, size);
+	} while (len);
+}
+
+/*
+ * Copy from user space without faulting, returns the number of bytes
+ * that could not be copied.
+ */
+static inline unsigned int
+__output_copy_user(struct perf_output_handle *handle,
+		   const void __user *buf, unsigned int len)
+{
+	unsigned long size, ret;
+
+	do {
+		size = min_t(unsigned long, handle->size, len);
+
+		pagefault_disable();
+		ret = __copy_from_user_inatomic(handle->addr, buf, size);
+		pagefault_enable();
+
+		size -= ret;
+		len -= size;
+		buf += size;
+		__output_advance(handle, size);
+	} while (len && !ret);
+
+	return len;
+}
+
+/* Skip @len bytes, leaving whatever is in the buffer there. */
+static inline void
+__output_skip(struct perf_output_handle *handle, unsigned int len)
+{
+	do {
+		unsigned long size = min_t(unsigned long, handle->size, len);
+
+		len -= size;
+		__output_advance(handle, size);
 	} while (len);
 }
 
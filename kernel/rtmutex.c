@@ -1059,6 +1059,66 @@ void rt_mutex_adjust_pi(struct task_struct *task)
 				   next_lock, NULL, task);
 }
 
+#ifdef CONFIG_RT_MUTEX_SPIN_ON_OWNER
+/*
+ * Adaptive spinning:
+ *
+ * When the lock owner is running on another cpu it is likely to
+ * release the lock soon, so spinning is cheaper than going through
+ * the enqueue / PI-boost / sleep / wakeup cycle. See mutex.c for the
+ * same idea applied to regular mutexes.
+ */
+static bool rt_mutex_spin(struct rt_mutex *lock, struct task_struct *owner)
+{
+	bool released;
+
+	if (!owner || owner == current)
+		return false;
+
+	preempt_disable();
+	released = rt_mutex_spin_on_owner(lock, owner);
+	preempt_enable();
+
+	return released;
+}
+
+/*
+ * Lock stealing fast path: spin while the owner runs and grab the lock
+ * with the fast path cmpxchg the moment it becomes free. This only
+ * succeeds when there are no waiters (RT_MUTEX_HAS_WAITERS is clear),
+ * so the priority order of already enqueued waiters is respected.
+ */
+static bool rt_mutex_optimistic_spin(struct rt_mutex *lock)
+{
+	struct task_struct *owner;
+
+	for (;;) {
+		if (rt_mutex_cmpxchg(lock, NULL, current)) {
+			rt_mutex_deadlock_account_lock(lock, current);
+			return true;
+		}
+
+		owner = ACCESS_ONCE(lock->owner);
+		if ((unsigned long)owner & RT_MUTEX_HAS_WAITERS)
+			return false;
+
+		if (!rt_mutex_spin(lock, owner))
+			return false;
+	}
+}
+#else
+static inline bool rt_mutex_spin(struct rt_mutex *lock,
+				 struct task_struct *owner)
+{
+	return false;
+}
+
+static inline bool rt_mutex_optimistic_spin(struct rt_mutex *lock)
+{
+	return false;
+}
+#endif
+
 /**
  * __rt_mutex_slowlock() - Perform the wait-wake-try-to-take loop
  * @lock:		 the rt_mutex to take
@@ -1074,6 +1134,7 @@ __rt_mutex_slowlock(struct rt_mutex *lock, int state,
 		    struct hrtimer_sleeper *timeout,
 		    struct rt_mutex_waiter *waiter)
 {
+	struct task_struct *owner;
 	int ret = 0;
 
 	for (;;) {
@@ -1095,11 +1156,20 @@ __rt_mutex_slowlock(struct rt_mutex *lock, int state,
 				break;
 		}
 
+		/*
+		 * Only the top waiter spins, everybody else would just
+		 * burn cycles waiting for it to take the lock.
+		 */
+		owner = NULL;
+		if (rt_mutex_top_waiter(lock) == waiter)
+			owner = rt_mutex_owner(lock);
+
 		raw_spin_unlock(&lock->wait_lock);
 
 		debug_rt_mutex_print_deadlock(waiter);
 
-		schedule_rt_mutex(lock);
+		if (!rt_mutex_spin(lock, owner))
+			schedule_rt_mutex(lock);
 
 		raw_spin_lock(&lock->wait_lock);
 		set_current_state(state);
@@ -1144,6 +1214,9 @@ rt_mutex_slowlock(struct rt_mutex *lock, int state,
 	RB_CLEAR_NODE(&waiter.pi_tree_entry);
 	RB_CLEAR_NODE(&waiter.tree_entry);
 
+	if (rt_mutex_optimistic_spin(lock))
+		return 0;
+
 	raw_spin_lock(&lock->wait_lock);
 
 	/* Try to acquire the lock again: */
@@ -84,6 +84,7 @@
 #include "workqueue_sched.h"
 #include "smpboot.h"
 #include "sched_autogroup.h"
+#include "rtmutex_common.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/sched.h>
@@ -4701,6 +4702,49 @@ int mutex_spin_on_owner(struct mutex *lock, struct task_struct *owner)
 }
 #endif
 
+#ifdef CONFIG_RT_MUTEX_SPIN_ON_OWNER
+
+static inline bool rt_owner_running(struct rt_mutex *lock,
+				    struct task_struct *owner)
+{
+	if (rt_mutex_owner(lock) != owner)
+		return false;
+
+	/* See owner_running() above. */
+	barrier();
+
+	return owner->on_cpu;
+}
+
+/*
+ * Spin on a PI rt_mutex while its owner is running on another cpu.
+ *
+ * Unlike mutex_spin_on_owner() we do not back off on load: a PI
+ * waiter is typically a high priority task and the owner has been
+ * boosted to its priority, so the owner is very likely to release
+ * the lock before anyone else gets to run here.
+ *
+ * Returns 1 when the lock was released while we were spinning, 0
+ * when we should stop spinning and block.
+ */
+int rt_mutex_spin_on_owner(struct rt_mutex *lock, struct task_struct *owner)
+{
+	if (!sched_feat(RT_OWNER_SPIN))
+		return 0;
+
+	rcu_read_lock();
+	while (rt_owner_running(lock, owner)) {
+		if (need_resched())
+			break;
+
+		arch_mutex_cpu_relax();
+	}
+	rcu_read_unlock();
+
+	return rt_mutex_owner(lock) == NULL;
+}
+#endif
+
 #ifdef CONFIG_PREEMPT
 /*
  * this is the entry point to schedule() from in-kernel preemption
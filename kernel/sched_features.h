@@ -60,6 +60,13 @@ SCHED_FEAT(LB_BIAS, 1)
  */
 SCHED_FEAT(OWNER_SPIN, 1)
 
+/*
+ * Same for PI rt_mutexes (and thus PI futexes): a waiter spins while
+ * the lock owner is running on another cpu instead of blocking, which
+ * cuts the unlock-to-wakeup latency of the top waiter.
+ */
+SCHED_FEAT(RT_OWNER_SPIN, 1)
+
 /*
  * Decrement CPU power based on time not spent running tasks
  */
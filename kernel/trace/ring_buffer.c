@@ -5,6 +5,7 @@
  */
 #include <linux/ring_buffer.h>
 #include <linux/trace_clock.h>
+#include <linux/trace_mmap.h>
 #include <linux/spinlock.h>
 #include <linux/debugfs.h>
 #include <linux/uaccess.h>
@@ -380,6 +381,7 @@ struct buffer_page {
 	unsigned	 read;		/* index for next read */
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
+	unsigned	 id;		/* sub-buffer id when mapped */
 	struct buffer_data_page *page;	/* Actual data page */
 };
 
@@ -496,6 +498,13 @@ struct ring_buffer_per_cpu {
 	unsigned long			read;
 	u64				write_stamp;
 	u64				read_stamp;
+
+	/* user space mapping, see ring_buffer_map() */
+	int				mapped;
+	unsigned			nr_subbufs;
+	unsigned			mapped_commit;
+	unsigned long			*subbuf_ids;
+	struct trace_buffer_meta	*meta_page;
 };
 
 struct ring_buffer {
@@ -503,6 +512,7 @@ struct ring_buffer {
 	unsigned			flags;
 	int				cpus;
 	atomic_t			record_disabled;
+	atomic_t			mapped;		/* cpu buffers mapped */
 	cpumask_var_t			cpumask;
 
 	struct lock_class_key		*reader_lock_key;
@@ -1350,6 +1360,16 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size)
 	mutex_lock(&buffer->mutex);
 	get_online_cpus();
 
+	/* mapped sub-buffers can not go away under user space */
+	for_each_buffer_cpu(buffer, cpu) {
+		if (buffer->buffers[cpu]->mapped) {
+			put_online_cpus();
+			mutex_unlock(&buffer->mutex);
+			atomic_dec(&buffer->record_disabled);
+			return -EBUSY;
+		}
+	}
+
 	if (size < buffer_size) {
 
 		/* easy case, just free pages */
@@ -3537,6 +3557,7 @@ rb_reset_cpu(struct ring_buffer_per_cpu *cpu_buffer)
 
 	cpu_buffer->lost_events = 0;
 	cpu_buffer->last_overrun = 0;
+	cpu_buffer->mapped_commit = 0;
 
 	rb_head_page_activate(cpu_buffer);
 }
@@ -3696,6 +3717,10 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (atomic_read(&cpu_buffer_b->record_disabled))
 		goto out;
 
+	ret = -EBUSY;
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	/*
 	 * We can't do a synchronize_sched here because this
 	 * function can be called in atomic context.
@@ -3857,12 +3882,14 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 	/*
 	 * If this page has been partially read or
 	 * if len is not big enough to read the rest of the page or
-	 * a writer is still on the page, then
+	 * a writer is still on the page or
+	 * the pages are mapped to user space, then
 	 * we must copy the data from the page to the buffer.
 	 * Otherwise, we can simply swap the page with the one passed in.
 	 */
 	if (read || (len < (commit - read)) ||
-	    cpu_buffer->reader_page == cpu_buffer->commit_page) {
+	    cpu_buffer->reader_page == cpu_buffer->commit_page ||
+	    cpu_buffer->mapped) {
 		struct buffer_data_page *rpage = cpu_buffer->reader_page->page;
 		unsigned int rpos = read;
 		unsigned int pos = 0;
@@ -3970,6 +3997,257 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+	struct buffer_page *reader = cpu_buffer->reader_page;
+
+	meta->reader.id = reader->id;
+	meta->reader.read = reader->read;
+	meta->reader.commit = cpu_buffer->mapped_commit;
+	meta->reader.lost_events = cpu_buffer->lost_events;
+
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+}
+
+/**
+ * ring_buffer_map - prepare a per cpu buffer to be mapped to user space
+ * @buffer: the buffer to map
+ * @cpu: the cpu buffer to map
+ *
+ * Allocates the meta page and assigns ids to the sub-buffers, which
+ * then stay fixed for as long as the buffer is mapped: resizing and
+ * swapping of pages are refused meanwhile. Calls nest, every call must
+ * be paired with ring_buffer_unmap().
+ *
+ * Returns 0 on success, or a negative error code.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	struct buffer_page *bpage;
+	unsigned long *subbuf_ids;
+	unsigned long flags;
+	unsigned nr_subbufs, i;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (cpu_buffer->mapped) {
+		cpu_buffer->mapped++;
+		goto out;
+	}
+
+	/* the reader page plus the pages in the ring */
+	nr_subbufs = buffer->pages + 1;
+
+	subbuf_ids = kcalloc(nr_subbufs, sizeof(*subbuf_ids), GFP_KERNEL);
+	if (!subbuf_ids) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	meta = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!meta) {
+		kfree(subbuf_ids);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	cpu_buffer->reader_page->id = 0;
+	subbuf_ids[0] = (unsigned long)cpu_buffer->reader_page->page;
+
+	bpage = list_entry(cpu_buffer->pages, struct buffer_page, list);
+	for (i = 1; i < nr_subbufs; i++) {
+		bpage->id = i;
+		subbuf_ids[i] = (unsigned long)bpage->page;
+		rb_inc_page(cpu_buffer, &bpage);
+	}
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = nr_subbufs;
+
+	cpu_buffer->subbuf_ids = subbuf_ids;
+	cpu_buffer->nr_subbufs = nr_subbufs;
+	cpu_buffer->meta_page = meta;
+	cpu_buffer->mapped_commit = cpu_buffer->reader_page->read;
+	cpu_buffer->mapped = 1;
+	atomic_inc(&buffer->mapped);
+
+	rb_update_meta_page(cpu_buffer);
+
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+ out:
+	mutex_unlock(&buffer->mutex);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - drop a mapping taken with ring_buffer_map()
+ * @buffer: the mapped buffer
+ * @cpu: the mapped cpu buffer
+ */
+int ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta = NULL;
+	unsigned long *subbuf_ids = NULL;
+	unsigned long flags;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (!cpu_buffer->mapped) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	if (--cpu_buffer->mapped)
+		goto out;
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	meta = cpu_buffer->meta_page;
+	subbuf_ids = cpu_buffer->subbuf_ids;
+	cpu_buffer->meta_page = NULL;
+	cpu_buffer->subbuf_ids = NULL;
+	cpu_buffer->nr_subbufs = 0;
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+	atomic_dec(&buffer->mapped);
+ out:
+	mutex_unlock(&buffer->mutex);
+
+	free_page((unsigned long)meta);
+	kfree(subbuf_ids);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_mapped - check whether any cpu buffer is mapped
+ * @buffer: the buffer to check
+ *
+ * A mapped buffer must not be swapped for another one, user space
+ * keeps reading the pages it mapped.
+ */
+bool ring_buffer_mapped(struct ring_buffer *buffer)
+{
+	return atomic_read(&buffer->mapped) != 0;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_mapped);
+
+/**
+ * ring_buffer_map_to_page - page backing an offset of the mapping
+ * @buffer: the mapped buffer
+ * @cpu: the mapped cpu buffer
+ * @pgoff: page offset into the mapping
+ *
+ * Offset 0 is the meta page, offset 1 + id the sub-buffer @id.
+ * Returns NULL if @pgoff is out of range or the buffer is not mapped.
+ */
+struct page *ring_buffer_map_to_page(struct ring_buffer *buffer, int cpu,
+				     unsigned long pgoff)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return NULL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	if (!cpu_buffer->mapped)
+		return NULL;
+
+	if (!pgoff)
+		return virt_to_page(cpu_buffer->meta_page);
+
+	if (pgoff > cpu_buffer->nr_subbufs)
+		return NULL;
+
+	return virt_to_page((void *)cpu_buffer->subbuf_ids[pgoff - 1]);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_to_page);
+
+/**
+ * ring_buffer_map_get_reader - hand out the next data to a mapped reader
+ * @buffer: the mapped buffer
+ * @cpu: the mapped cpu buffer
+ *
+ * Consumes the events that were handed out by the previous call, swaps
+ * in the next sub-buffer if the reader sub-buffer is done, and updates
+ * the meta page with the data that can be read now.
+ *
+ * Returns 0 on success, or a negative error code.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct ring_buffer_event *event;
+	struct buffer_page *reader;
+	unsigned long flags;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+		return -ENODEV;
+	}
+
+	/*
+	 * Consume what the last call made visible, unless another reader
+	 * (e.g. trace_pipe) moved on to a different page meanwhile.
+	 */
+	reader = cpu_buffer->reader_page;
+	if (reader->id != cpu_buffer->meta_page->reader.id)
+		cpu_buffer->mapped_commit = 0;
+
+	while (reader->read < cpu_buffer->mapped_commit) {
+		event = rb_reader_event(cpu_buffer);
+		if (event->type_len <= RINGBUF_TYPE_DATA_TYPE_LEN_MAX)
+			cpu_buffer->read++;
+		rb_update_read_stamp(cpu_buffer, event);
+		reader->read += rb_event_length(event);
+	}
+
+	/* swaps in the next sub-buffer, if there is anything to read */
+	rb_get_reader_page(cpu_buffer);
+
+	cpu_buffer->mapped_commit = rb_page_commit(cpu_buffer->reader_page);
+	rb_update_meta_page(cpu_buffer);
+
+	/* reported along with this data, do not report them twice */
+	cpu_buffer->lost_events = 0;
+
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 #ifdef CONFIG_TRACING
 static ssize_t
 rb_simple_read(struct file *filp, char __user *ubuf,
@@ -4,6 +4,7 @@
  * Copyright (C) 2009 Steven Rostedt <srostedt@redhat.com>
  */
 #include <linux/ring_buffer.h>
+#include <linux/trace_mmap.h>
 #include <linux/completion.h>
 #include <linux/kthread.h>
 #include <linux/module.h>
@@ -31,6 +32,7 @@ static struct ring_buffer *buffer;
 static struct task_struct *producer;
 static struct task_struct *consumer;
 static unsigned long read;
+static s64 read_time;	/* nsecs the consumer spent reading */
 
 static int disable_reader;
 module_param(disable_reader, uint, 0644);
@@ -58,7 +60,21 @@ MODULE_PARM_DESC(producer_fifo, "fifo prio for producer");
 module_param(consumer_fifo, uint, 0644);
 MODULE_PARM_DESC(consumer_fifo, "fifo prio for consumer");
 
-static int read_events;
+/* the consumer cycles through these, one per run */
+enum read_mode {
+	READ_EVENTS,
+	READ_PAGES,
+	READ_MAPPED,
+	NR_READ_MODES,
+};
+
+static const char *read_mode_names[] = {
+	[READ_EVENTS]	= "events",
+	[READ_PAGES]	= "pages",
+	[READ_MAPPED]	= "mapped pages",
+};
+
+static int read_mode = NR_READ_MODES - 1;
 
 static int kill_test;
 
@@ -95,76 +111,82 @@ static enum event_status read_event(int cpu)
 	return EVENT_FOUND;
 }
 
-static enum event_status read_page(int cpu)
+static void read_page_data(int cpu, struct rb_page *rpage,
+			   unsigned long start, unsigned long commit)
 {
 	struct ring_buffer_event *event;
-	struct rb_page *rpage;
-	unsigned long commit;
-	void *bpage;
 	int *entry;
-	int ret;
 	int inc;
 	int i;
 
-	bpage = ring_buffer_alloc_read_page(buffer, cpu);
-	if (!bpage)
-		return EVENT_DROPPED;
-
-	ret = ring_buffer_read_page(buffer, &bpage, PAGE_SIZE, cpu, 1);
-	if (ret >= 0) {
-		rpage = bpage;
-		/* The commit may have missed event flags set, clear them */
-		commit = local_read(&rpage->commit) & 0xfffff;
-		for (i = 0; i < commit && !kill_test; i += inc) {
+	for (i = start; i < commit && !kill_test; i += inc) {
+		if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+			KILL_TEST();
+			break;
+		}
 
-			if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+		inc = -1;
+		event = (void *)&rpage->data[i];
+		switch (event->type_len) {
+		case RINGBUF_TYPE_PADDING:
+			/* failed writes may be discarded events */
+			if (!event->time_delta)
+				KILL_TEST();
+			inc = event->array[0] + 4;
+			break;
+		case RINGBUF_TYPE_TIME_EXTEND:
+			inc = 8;
+			break;
+		case 0:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
 				KILL_TEST();
 				break;
 			}
-
-			inc = -1;
-			event = (void *)&rpage->data[i];
-			switch (event->type_len) {
-			case RINGBUF_TYPE_PADDING:
-				/* failed writes may be discarded events */
-				if (!event->time_delta)
-					KILL_TEST();
-				inc = event->array[0] + 4;
-				break;
-			case RINGBUF_TYPE_TIME_EXTEND:
-				inc = 8;
-				break;
-			case 0:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					KILL_TEST();
-					break;
-				}
-				read++;
-				if (!event->array[0]) {
-					KILL_TEST();
-					break;
-				}
-				inc = event->array[0] + 4;
+			read++;
+			if (!event->array[0]) {
+				KILL_TEST();
 				break;
-			default:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					KILL_TEST();
-					break;
-				}
-				read++;
-				inc = ((event->type_len + 1) * 4);
 			}
-			if (kill_test)
-				break;
-
-			if (inc <= 0) {
+			inc = event->array[0] + 4;
+			break;
+		default:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
 				KILL_TEST();
 				break;
 			}
+			read++;
+			inc = ((event->type_len + 1) * 4);
+		}
+		if (kill_test)
+			break;
+
+		if (inc <= 0) {
+			KILL_TEST();
+			break;
 		}
 	}
+}
+
+static enum event_status read_page(int cpu)
+{
+	struct rb_page *rpage;
+	unsigned long commit;
+	void *bpage;
+	int ret;
+
+	bpage = ring_buffer_alloc_read_page(buffer, cpu);
+	if (!bpage)
+		return EVENT_DROPPED;
+
+	ret = ring_buffer_read_page(buffer, &bpage, PAGE_SIZE, cpu, 1);
+	if (ret >= 0) {
+		rpage = bpage;
+		/* The commit may have missed event flags set, clear them */
+		commit = local_read(&rpage->commit) & 0xfffff;
+		read_page_data(cpu, rpage, 0, commit);
+	}
 	ring_buffer_free_read_page(buffer, bpage);
 
 	if (ret < 0)
@@ -172,15 +194,73 @@ static enum event_status read_page(int cpu)
 	return EVENT_FOUND;
 }
 
+/* Read the sub-buffers in place, the way a mmap() user would */
+static enum event_status read_mapped(int cpu)
+{
+	struct trace_buffer_meta *meta;
+	struct rb_page *rpage;
+
+	if (ring_buffer_map_get_reader(buffer, cpu))
+		return EVENT_DROPPED;
+
+	meta = page_address(ring_buffer_map_to_page(buffer, cpu, 0));
+	if (meta->reader.read >= meta->reader.commit)
+		return EVENT_DROPPED;
+
+	rpage = page_address(ring_buffer_map_to_page(buffer, cpu,
+						     meta->reader.id + 1));
+	read_page_data(cpu, rpage, meta->reader.read,
+		       meta->reader.commit & 0xfffff);
+
+	return EVENT_FOUND;
+}
+
+static int map_buffers(void)
+{
+	int cpu, i;
+
+	for_each_online_cpu(cpu) {
+		if (ring_buffer_map(buffer, cpu))
+			goto out_unmap;
+	}
+	return 0;
+
+ out_unmap:
+	for_each_online_cpu(i) {
+		if (i == cpu)
+			break;
+		ring_buffer_unmap(buffer, i);
+	}
+	return -1;
+}
+
+static void unmap_buffers(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		ring_buffer_unmap(buffer, cpu);
+}
+
 static void ring_buffer_consumer(void)
 {
-	/* toggle between reading pages and events */
-	read_events ^= 1;
+	ktime_t start;
+
+	/* cycle between reading events, pages and mapped pages */
+	if (++read_mode == NR_READ_MODES)
+		read_mode = READ_EVENTS;
+
+	/* fall back to copying pages if the buffers can not be mapped */
+	if (read_mode == READ_MAPPED && map_buffers())
+		read_mode = READ_PAGES;
 
 	read = 0;
+	read_time = 0;
 	while (!reader_finish && !kill_test) {
 		int found;
 
+		start = ktime_get();
+
 		do {
 			int cpu;
 
@@ -188,10 +268,16 @@ static void ring_buffer_consumer(void)
 			for_each_online_cpu(cpu) {
 				enum event_status stat;
 
-				if (read_events)
+				switch (read_mode) {
+				case READ_EVENTS:
 					stat = read_event(cpu);
-				else
+					break;
+				case READ_PAGES:
 					stat = read_page(cpu);
+					break;
+				default:
+					stat = read_mapped(cpu);
+				}
 
 				if (kill_test)
 					break;
@@ -200,6 +286,8 @@ static void ring_buffer_consumer(void)
 			}
 		} while (found && !kill_test);
 
+		read_time += ktime_to_ns(ktime_sub(ktime_get(), start));
+
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (reader_finish)
 			break;
@@ -207,6 +295,8 @@ static void ring_buffer_consumer(void)
 		schedule();
 		__set_current_state(TASK_RUNNING);
 	}
+	if (read_mode == READ_MAPPED)
+		unmap_buffers();
 	reader_finish = 0;
 	complete(&read_done);
 }
@@ -313,11 +403,14 @@ static void ring_buffer_producer(void)
 
 	trace_printk("Time:     %lld (usecs)\n", time);
 	trace_printk("Overruns: %lld\n", overruns);
-	if (disable_reader)
+	if (disable_reader) {
 		trace_printk("Read:     (reader disabled)\n");
-	else
+	} else {
 		trace_printk("Read:     %ld  (by %s)\n", read,
-			read_events ? "events" : "pages");
+			read_mode_names[read_mode]);
+		trace_printk("Consumer: %lld (usecs)\n",
+			     (long long)div_s64(read_time, NSEC_PER_USEC));
+	}
 	trace_printk("Entries:  %lld\n", entries);
 	trace_printk("Total:    %lld\n", entries + overruns + read);
 	trace_printk("Missed:   %ld\n", missed);
@@ -12,6 +12,7 @@
  *  Copyright (C) 2004 William Lee Irwin III
  */
 #include <linux/ring_buffer.h>
+#include <linux/trace_mmap.h>
 #include <generated/utsrelease.h>
 #include <linux/stacktrace.h>
 #include <linux/writeback.h>
@@ -663,6 +664,16 @@ update_max_tr(struct trace_array *tr, struct task_struct *tsk, int cpu)
 	}
 	arch_spin_lock(&ftrace_max_lock);
 
+	/* user space reads the mapped buffer, it has to stay in place */
+	if (ring_buffer_mapped(buf)) {
+		trace_array_printk(&max_tr, _THIS_IP_,
+			"Failed to swap buffers, the buffer is mapped\n");
+		arch_spin_unlock(&ftrace_max_lock);
+		return;
+	}
+	/* pairs with the barrier in tracing_buffers_mmap() */
+	smp_mb();
+
 	tr->buffer = max_tr.buffer;
 	max_tr.buffer = buf;
 
@@ -4010,11 +4021,101 @@ out:
 	return ret;
 }
 
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	return ring_buffer_map_get_reader(info->tr->buffer, info->cpu);
+}
+
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	/* the buffer is mapped already, this only takes a reference */
+	WARN_ON(ring_buffer_map(vma->vm_private_data, info->cpu));
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+
+	WARN_ON(ring_buffer_unmap(vma->vm_private_data, info->cpu));
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+/*
+ * Map the meta page and the sub-buffers of a cpu buffer read-only, see
+ * include/linux/trace_mmap.h for the layout.
+ */
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct ring_buffer *buffer = info->tr->buffer;
+	unsigned long i;
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND | VM_RESERVED;
+
+	ret = ring_buffer_map(buffer, info->cpu);
+	if (ret)
+		return ret;
+
+	/*
+	 * update_max_tr() does not swap a mapped buffer, but may have
+	 * swapped this one before it was marked mapped.
+	 */
+	smp_mb();
+	if (info->tr->buffer != buffer) {
+		ring_buffer_unmap(buffer, info->cpu);
+		return -EBUSY;
+	}
+
+	for (i = 0; i < vma_pages(vma); i++) {
+		struct page *page;
+
+		page = ring_buffer_map_to_page(buffer, info->cpu,
+					       vma->vm_pgoff + i);
+		if (!page) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE, page);
+		if (ret)
+			break;
+	}
+
+	if (ret) {
+		ring_buffer_unmap(buffer, info->cpu);
+		return ret;
+	}
+
+	vma->vm_ops = &tracing_buffers_vmops;
+	vma->vm_private_data = buffer;
+
+	return 0;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
@@ -351,16 +351,22 @@ static int br_nf_pre_routing_finish_bridge(struct sk_buff *skb)
 	struct nf_bridge_info *nf_bridge = skb->nf_bridge;
 	struct neighbour *neigh;
 	struct dst_entry *dst;
+	__be32 nexthop;
+	int ret;
 
 	skb->dev = bridge_parent(skb->dev);
 	if (!skb->dev)
 		goto free_skb;
 	dst = skb_dst(skb);
-	neigh = dst_get_neighbour(dst);
+	/* Routes shared by a directly connected nexthop have no neighbour */
+	nexthop = rt_nexthop(skb_rtable(skb), ip_hdr(skb)->daddr);
+	neigh = dst_neigh_lookup(dst, &nexthop);
+	if (IS_ERR(neigh))
+		goto free_skb;
 	if (neigh->hh.hh_len) {
 		neigh_hh_bridge(&neigh->hh, skb);
 		skb->dev = nf_bridge->physindev;
-		return br_handle_frame_finish(skb);
+		ret = br_handle_frame_finish(skb);
 	} else {
 		/* the neighbour function below overwrites the complete
 		 * MAC header, so we save the Ethernet source address and
@@ -368,8 +374,10 @@ static int br_nf_pre_routing_finish_bridge(struct sk_buff *skb)
 		skb_copy_from_linear_data_offset(skb, -(ETH_HLEN-ETH_ALEN), skb->nf_bridge->data, ETH_HLEN-ETH_ALEN);
 		/* tell br_dev_xmit to continue with forwarding */
 		nf_bridge->mask |= BRNF_BRIDGED_DNAT;
-		return neigh->output(neigh, skb);
+		ret = neigh->output(neigh, skb);
 	}
+	neigh_release(neigh);
+	return ret;
 free_skb:
 	kfree_skb(skb);
 	return 0;
@@ -133,6 +133,7 @@
 #include <linux/pci.h>
 #include <linux/inetdevice.h>
 #include <linux/cpu_rmap.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -2031,20 +2032,6 @@ static int dev_gso_segment(struct sk_buff *skb, int features)
  * We cannot orphan skb if tx timestamp is requested or the sk-reference
  * is needed on driver level for other reasons, e.g. see net/can/raw.c
  */
-static inline void skb_orphan_try(struct sk_buff *skb)
-{
-	struct sock *sk = skb->sk;
-
-	if (sk && !skb_shinfo(skb)->tx_flags) {
-		/* skb_tx_hash() wont be able to get sk.
-		 * We copy sk_hash into skb->rxhash
-		 */
-		if (!skb->rxhash)
-			skb->rxhash = sk->sk_hash;
-		skb_orphan(skb);
-	}
-}
-
 static bool can_checksum_protocol(unsigned long features, __be16 protocol)
 {
 	return ((features & NETIF_F_GEN_CSUM) ||
@@ -2109,8 +2096,12 @@ static inline int skb_needs_linearize(struct sk_buff *skb,
 				!(features & NETIF_F_SG)));
 }
 
+/*
+ * @more tells the driver that the caller has more skbs for it right away,
+ * see skb->xmit_more.  The segments of a GSO skb get it set by themselves.
+ */
 int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
-			struct netdev_queue *txq)
+			struct netdev_queue *txq, bool more)
 {
 	const struct net_device_ops *ops = dev->netdev_ops;
 	int rc = NETDEV_TX_OK;
@@ -2129,8 +2120,6 @@ int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
 		if (!list_empty(&ptype_all))
 			dev_queue_xmit_nit(skb, dev);
 
-		skb_orphan_try(skb);
-
 		features = netif_skb_features(skb);
 
 		if (vlan_tx_tag_present(skb) &&
@@ -2165,6 +2154,7 @@ int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
 			}
 		}
 
+		skb->xmit_more = more;
 		skb_len = skb->len;
 		rc = ops->ndo_start_xmit(skb, dev);
 		trace_net_dev_xmit(skb, rc, dev, skb_len);
@@ -2179,6 +2169,7 @@ gso:
 
 		skb->next = nskb->next;
 		nskb->next = NULL;
+		nskb->xmit_more = skb->next != NULL;
 
 		/*
 		 * If device doesn't need nskb->dst, release it right now while
@@ -2472,9 +2463,9 @@ int dev_queue_xmit(struct sk_buff *skb)
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				__this_cpu_inc(xmit_recursion);
-				rc = dev_hard_start_xmit(skb, dev, txq);
+				rc = dev_hard_start_xmit(skb, dev, txq, false);
 				__this_cpu_dec(xmit_recursion);
 				if (dev_xmit_complete(rc)) {
 					HARD_TX_UNLOCK(dev, txq);
@@ -2601,6 +2592,8 @@ EXPORT_SYMBOL(__skb_get_rxhash);
 /* One global table that all flow-based protocols share. */
 struct rps_sock_flow_table __rcu *rps_sock_flow_table __read_mostly;
 EXPORT_SYMBOL(rps_sock_flow_table);
+u32 rps_cpu_mask __read_mostly;
+EXPORT_SYMBOL(rps_cpu_mask);
 
 static struct rps_dev_flow *
 set_rps_cpu(struct net_device *dev, struct sk_buff *skb,
@@ -2699,13 +2692,25 @@ static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb,
 	sock_flow_table = rcu_dereference(rps_sock_flow_table);
 	if (flow_table && sock_flow_table) {
 		u16 next_cpu;
+		u32 ident;
 		struct rps_dev_flow *rflow;
 
 		rflow = &flow_table->flows[skb->rxhash & flow_table->mask];
 		tcpu = rflow->cpu;
 
-		next_cpu = sock_flow_table->ents[skb->rxhash &
+		/*
+		 * The entry may be another flow's, sharing the index: it is
+		 * only ours if the remaining bits of the hash match.
+		 */
+		ident = sock_flow_table->ents[skb->rxhash &
 		    sock_flow_table->mask];
+		next_cpu = ident & rps_cpu_mask;
+		if (((ident ^ skb->rxhash) & ~rps_cpu_mask) ||
+		    next_cpu >= nr_cpu_ids) {
+			__this_cpu_inc(softnet_data.rps_flow_miss);
+			next_cpu = RPS_NO_CPU;
+		} else
+			__this_cpu_inc(softnet_data.rps_flow_hit);
 
 		/*
 		 * If the desired CPU (where last recvmsg was done) is
@@ -2899,6 +2904,8 @@ int netif_rx(struct sk_buff *skb)
 		cpu = get_rps_cpu(skb->dev, skb, &rflow);
 		if (cpu < 0)
 			cpu = smp_processor_id();
+		else if (cpu != smp_processor_id())
+			__this_cpu_inc(softnet_data.rps_steered);
 
 		ret = enqueue_to_backlog(skb, cpu, &rflow->last_qtail);
 
@@ -3266,6 +3273,8 @@ int netif_receive_skb(struct sk_buff *skb)
 		cpu = get_rps_cpu(skb->dev, skb, &rflow);
 
 		if (cpu >= 0) {
+			if (cpu != smp_processor_id())
+				__this_cpu_inc(softnet_data.rps_steered);
 			ret = enqueue_to_backlog(skb, cpu, &rflow->last_qtail);
 			rcu_read_unlock();
 		} else {
@@ -3316,6 +3325,8 @@ static int napi_gro_complete(struct sk_buff *skb)
 	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
 	int err = -ENOENT;
 
+	__this_cpu_inc(softnet_data.gro_flushed);
+
 	if (NAPI_GRO_CB(skb)->count == 1) {
 		skb_shinfo(skb)->gso_size = 0;
 		goto out;
@@ -3356,6 +3367,38 @@ inline void napi_gro_flush(struct napi_struct *napi)
 }
 EXPORT_SYMBOL(napi_gro_flush);
 
+/*
+ * Packet type to hand the payload of a tunnel to, for GRO.
+ * Caller must hold rcu_read_lock().
+ */
+struct packet_type *gro_find_receive_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_receive_by_type);
+
+struct packet_type *gro_find_complete_by_type(__be16 type)
+{
+	struct list_head *head = &ptype_base[ntohs(type) & PTYPE_HASH_MASK];
+	struct packet_type *ptype;
+
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
+			continue;
+		return ptype;
+	}
+	return NULL;
+}
+EXPORT_SYMBOL(gro_find_complete_by_type);
+
 enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
 	struct sk_buff **pp = NULL;
@@ -3372,6 +3415,8 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 	if (skb_is_gso(skb) || skb_has_frag_list(skb))
 		goto normal;
 
+	napi->gro_rx++;
+
 	rcu_read_lock();
 	list_for_each_entry_rcu(ptype, head, list) {
 		if (ptype->type != type || ptype->dev || !ptype->gro_receive)
@@ -3380,6 +3425,7 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		skb_set_network_header(skb, skb_gro_offset(skb));
 		mac_len = skb->network_header - skb->mac_header;
 		skb->mac_len = mac_len;
+		NAPI_GRO_CB(skb)->network_offset = skb_gro_offset(skb);
 		NAPI_GRO_CB(skb)->same_flow = 0;
 		NAPI_GRO_CB(skb)->flush = 0;
 		NAPI_GRO_CB(skb)->free = 0;
@@ -3404,8 +3450,10 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		napi->gro_count--;
 	}
 
-	if (same_flow)
+	if (same_flow) {
+		__this_cpu_inc(softnet_data.gro_merged);
 		goto ok;
+	}
 
 	if (NAPI_GRO_CB(skb)->flush || napi->gro_count >= MAX_GRO_SKBS)
 		goto normal;
@@ -3507,6 +3555,7 @@ EXPORT_SYMBOL(skb_gro_reset_offset);
 
 gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
+	skb_mark_napi_id(skb, napi);
 	skb_gro_reset_offset(skb);
 
 	return napi_skb_finish(__napi_gro_receive(napi, skb), skb);
@@ -3608,6 +3657,8 @@ gro_result_t napi_gro_frags(struct napi_struct *napi)
 	if (!skb)
 		return GRO_DROP;
 
+	skb_mark_napi_id(skb, napi);
+
 	return napi_frags_finish(napi, skb, __napi_gro_receive(napi, skb));
 }
 EXPORT_SYMBOL(napi_gro_frags);
@@ -3716,9 +3767,16 @@ EXPORT_SYMBOL(__napi_schedule);
 void __napi_complete(struct napi_struct *n)
 {
 	BUG_ON(!test_bit(NAPI_STATE_SCHED, &n->state));
-	BUG_ON(n->gro_list);
 
-	list_del(&n->poll_list);
+	/*
+	 * The busy poller still owns it, and completes it when done.
+	 * Drivers call this directly too, so it is checked here.
+	 */
+	if (unlikely(test_bit(NAPI_STATE_IN_BUSY_POLL, &n->state)))
+		return;
+
+	/* A busy polled napi is not on any poll_list */
+	list_del_init(&n->poll_list);
 	smp_mb__before_clear_bit();
 	clear_bit(NAPI_STATE_SCHED, &n->state);
 }
@@ -3735,18 +3793,194 @@ void napi_complete(struct napi_struct *n)
 	if (unlikely(test_bit(NAPI_STATE_NPSVC, &n->state)))
 		return;
 
-	napi_gro_flush(n);
+	if (n->gro_list) {
+		unsigned long timeout = 0;
+
+		/* While packets keep coming, hold the ones GRO has for a
+		 * while: the next ones of their flows may join them.  A
+		 * busy poller wants them at once.
+		 */
+		if (n->gro_rx && !test_bit(NAPI_STATE_IN_BUSY_POLL, &n->state))
+			timeout = n->dev->gro_flush_timeout;
+		if (timeout)
+			hrtimer_start(&n->timer, ns_to_ktime(timeout),
+				      HRTIMER_MODE_REL_PINNED);
+		else
+			napi_gro_flush(n);
+	}
+	n->gro_rx = 0;
+
 	local_irq_save(flags);
 	__napi_complete(n);
 	local_irq_restore(flags);
 }
 EXPORT_SYMBOL(napi_complete);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+unsigned int sysctl_net_busy_read __read_mostly;
+
+#define NAPI_HASH_BITS	8
+#define BUSY_POLL_BUDGET 8
+
+/* napi_hash is written under napi_hash_lock, looked up under RCU */
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+static struct hlist_head napi_hash[1 << NAPI_HASH_BITS];
+
+/* Caller must hold rcu_read_lock() */
+static struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu(napi, pos,
+				 &napi_hash[napi_id & ((1 << NAPI_HASH_BITS) - 1)],
+				 napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+	return NULL;
+}
+
+static void napi_hash_add(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+	/* 0 means "not busy pollable", skip it and any id still in use */
+	do {
+		if (unlikely(++napi_gen_id == 0))
+			napi_gen_id = 1;
+	} while (napi_by_id(napi_gen_id));
+	napi->napi_id = napi_gen_id;
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   &napi_hash[napi->napi_id & ((1 << NAPI_HASH_BITS) - 1)]);
+	spin_unlock(&napi_hash_lock);
+}
+
+static void napi_hash_del(struct napi_struct *napi)
+{
+	bool hashed;
+
+	spin_lock(&napi_hash_lock);
+	hashed = !hlist_unhashed(&napi->napi_hash_node);
+	if (hashed)
+		hlist_del_init_rcu(&napi->napi_hash_node);
+	spin_unlock(&napi_hash_lock);
+	/* sk_busy_loop() uses the napi under rcu_read_lock() */
+	if (hashed)
+		synchronize_net();
+}
+
+static inline unsigned long busy_loop_us_clock(void)
+{
+	return local_clock() >> 10;
+}
+
+/*
+ * Last poll with the napi released, so that the driver completes it and
+ * reenables its interrupts, or hands it back to the softirq if there is
+ * more work.
+ * Called with BHs disabled.
+ */
+static void busy_poll_stop(struct napi_struct *napi, void *have)
+{
+	int rc;
+
+	clear_bit(NAPI_STATE_IN_BUSY_POLL, &napi->state);
+	rc = napi->poll(napi, BUSY_POLL_BUDGET);
+	trace_napi_poll(napi);
+	netpoll_poll_unlock(have);
+	if (rc == BUSY_POLL_BUDGET)
+		__napi_schedule(napi);
+}
+
+/**
+ *	sk_busy_loop - poll the napi context a socket receives from
+ *	@sk: socket, with sk_can_busy_loop() true
+ *	@nonblock: only poll once
+ *
+ *	Polls the napi context of the last packet received by @sk, until
+ *	data shows up in its receive queue or sk->sk_ll_usec elapsed.
+ *	The napi is only taken over if it is idle: when it is scheduled, the
+ *	softirq is about to deliver the data anyway.
+ *	Returns true if there is data to read.
+ */
+bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	unsigned long end_time = busy_loop_us_clock() + sk->sk_ll_usec;
+	struct napi_struct *napi;
+	void *have = NULL;
+
+	rcu_read_lock();
+	napi = napi_by_id(sk->sk_napi_id);
+	if (!napi)
+		goto out;
+
+	for (;;) {
+		local_bh_disable();
+		if (!have) {
+			unsigned long val = ACCESS_ONCE(napi->state);
+
+			if (val & ((1UL << NAPI_STATE_SCHED) |
+				   (1UL << NAPI_STATE_DISABLE) |
+				   (1UL << NAPI_STATE_NPSVC) |
+				   (1UL << NAPI_STATE_IN_BUSY_POLL)))
+				goto count;
+			if (cmpxchg(&napi->state, val,
+				    val | (1UL << NAPI_STATE_SCHED) |
+				    (1UL << NAPI_STATE_IN_BUSY_POLL)) != val)
+				goto count;
+			have = netpoll_poll_lock(napi);
+		}
+		napi->poll(napi, BUSY_POLL_BUDGET);
+		trace_napi_poll(napi);
+count:
+		local_bh_enable();
+
+		if (nonblock || !skb_queue_empty(&sk->sk_receive_queue) ||
+		    time_after(busy_loop_us_clock(), end_time) ||
+		    need_resched() || signal_pending(current))
+			break;
+		cpu_relax();
+	}
+	if (have) {
+		local_bh_disable();
+		busy_poll_stop(napi, have);
+		local_bh_enable();
+	}
+out:
+	rcu_read_unlock();
+	return !skb_queue_empty(&sk->sk_receive_queue);
+}
+EXPORT_SYMBOL(sk_busy_loop);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline void napi_hash_del(struct napi_struct *napi)
+{
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
+/* A poll after gro_flush_timeout flushes the packets GRO held */
+static enum hrtimer_restart napi_watchdog(struct hrtimer *timer)
+{
+	struct napi_struct *napi;
+
+	napi = container_of(timer, struct napi_struct, timer);
+	if (napi->gro_list)
+		napi_schedule(napi);
+
+	return HRTIMER_NORESTART;
+}
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
 	INIT_LIST_HEAD(&napi->poll_list);
+	hrtimer_init(&napi->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+	napi->timer.function = napi_watchdog;
 	napi->gro_count = 0;
+	napi->gro_rx = 0;
 	napi->gro_list = NULL;
 	napi->skb = NULL;
 	napi->poll = poll;
@@ -3758,6 +3992,7 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	napi->poll_owner = -1;
 #endif
 	set_bit(NAPI_STATE_SCHED, &napi->state);
+	napi_hash_add(napi);
 }
 EXPORT_SYMBOL(netif_napi_add);
 
@@ -3765,7 +4000,9 @@ void netif_napi_del(struct napi_struct *napi)
 {
 	struct sk_buff *skb, *next;
 
+	napi_hash_del(napi);
 	list_del_init(&napi->dev_list);
+	hrtimer_cancel(&napi->timer);
 	napi_free_frags(napi);
 
 	for (skb = napi->gro_list; skb; skb = next) {
@@ -4097,10 +4334,14 @@ static int softnet_seq_show(struct seq_file *seq, void *v)
 {
 	struct softnet_data *sd = v;
 
-	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x "
+		   "%08x %08x %08x %08x %08x %08x\n",
 		   sd->processed, sd->dropped, sd->time_squeeze, 0,
 		   0, 0, 0, 0, /* was fastroute */
-		   sd->cpu_collision, sd->received_rps);
+		   sd->cpu_collision, sd->received_rps,
+		   sd->gro_merged, sd->gro_flushed,
+		   sd->rps_flow_hit, sd->rps_flow_miss, sd->rps_steered,
+		   sd->skb_recycled);
 	return 0;
 }
 
@@ -5403,6 +5644,9 @@ static void netdev_init_one_queue(struct net_device *dev,
 	queue->xmit_lock_owner = -1;
 	netdev_queue_numa_node_write(queue, NUMA_NO_NODE);
 	queue->dev = dev;
+#ifdef CONFIG_BQL
+	dql_init(&queue->dql, HZ);
+#endif
 }
 
 static int netif_alloc_netdev_queues(struct net_device *dev)
@@ -116,6 +116,27 @@ __u32 secure_tcp_sequence_number(__be32 saddr, __be32 daddr,
 	return seq_scale(hash[0]);
 }
 
+/* TCP Fast Open cookie handed to the client at saddr by the server at
+ * daddr, TCP_FASTOPEN_COOKIE_SIZE bytes long.  The secret words used
+ * differ from the ones of the sequence number and port hashes, so that
+ * what those leak on the wire tells nothing about the cookie.
+ */
+void secure_tcp_fastopen_cookie(u32 *cookie, __be32 saddr, __be32 daddr)
+{
+	u32 hash[MD5_DIGEST_WORDS];
+
+	hash[0] = (__force u32)saddr;
+	hash[1] = (__force u32)daddr;
+	hash[2] = net_secret[13];
+	hash[3] = net_secret[12];
+
+	md5_transform(hash, net_secret);
+
+	cookie[0] = hash[0];
+	cookie[1] = hash[1];
+}
+EXPORT_SYMBOL_GPL(secure_tcp_fastopen_cookie);
+
 u32 secure_ipv4_port_ephemeral(__be32 saddr, __be32 daddr, __be16 dport)
 {
 	u32 hash[MD5_DIGEST_WORDS];
@@ -58,6 +58,7 @@
 #include <linux/scatterlist.h>
 #include <linux/errqueue.h>
 #include <linux/prefetch.h>
+#include <linux/cpu.h>
 
 #include <net/protocol.h>
 #include <net/dst.h>
@@ -74,6 +75,25 @@
 static struct kmem_cache *skbuff_head_cache __read_mostly;
 static struct kmem_cache *skbuff_fclone_cache __read_mostly;
 
+/*
+ * Every CPU keeps some freed sk_buffs for the next allocations, still
+ * warm in its cache, instead of going through the slab each time.
+ */
+#define SKB_HEAD_CACHE_MAX	64
+
+struct skb_head_cache {
+	struct sk_buff	*list;
+	unsigned int	len;
+};
+static DEFINE_PER_CPU(struct skb_head_cache, skb_head_cache);
+
+/* The page netdev_alloc_frag() carves receive buffers from */
+struct netdev_alloc_cache {
+	struct page	*page;
+	unsigned int	offset;
+};
+static DEFINE_PER_CPU(struct netdev_alloc_cache, netdev_alloc_cache);
+
 static void sock_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
@@ -147,6 +167,57 @@ static void skb_under_panic(struct sk_buff *skb, int sz, void *here)
 	BUG();
 }
 
+static struct sk_buff *skb_head_alloc(gfp_t gfp_mask, int node)
+{
+	struct skb_head_cache *hc;
+	struct sk_buff *skb = NULL;
+	unsigned long flags;
+
+	if (node == NUMA_NO_NODE) {
+		local_irq_save(flags);
+		hc = &__get_cpu_var(skb_head_cache);
+		if (hc->list) {
+			skb = hc->list;
+			hc->list = skb->next;
+			hc->len--;
+			__this_cpu_inc(softnet_data.skb_recycled);
+		}
+		local_irq_restore(flags);
+		if (skb)
+			return skb;
+	}
+
+	return kmem_cache_alloc_node(skbuff_head_cache, gfp_mask & ~__GFP_DMA,
+				     node);
+}
+
+static void skb_head_free(struct sk_buff *skb)
+{
+	struct skb_head_cache *hc;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	hc = &__get_cpu_var(skb_head_cache);
+	if (hc->len < SKB_HEAD_CACHE_MAX) {
+		skb->next = hc->list;
+		hc->list = skb;
+		hc->len++;
+		skb = NULL;
+	}
+	local_irq_restore(flags);
+
+	if (skb)
+		kmem_cache_free(skbuff_head_cache, skb);
+}
+
+static void skb_free_head(struct sk_buff *skb)
+{
+	if (skb->head_frag)
+		put_page(virt_to_head_page(skb->head));
+	else
+		kfree(skb->head);
+}
+
 /* 	Allocate a new skbuff. We do this ourselves so we can fill in a few
  *	'private' fields and also do memory statistics to find all the
  *	[BEEP] leaks.
@@ -179,7 +250,10 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 	cache = fclone ? skbuff_fclone_cache : skbuff_head_cache;
 
 	/* Get the HEAD */
-	skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
+	if (fclone)
+		skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
+	else
+		skb = skb_head_alloc(gfp_mask, node);
 	if (!skb)
 		goto out;
 	prefetchw(skb);
@@ -227,12 +301,99 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 out:
 	return skb;
 nodata:
-	kmem_cache_free(cache, skb);
+	if (fclone)
+		kmem_cache_free(cache, skb);
+	else
+		skb_head_free(skb);
 	skb = NULL;
 	goto out;
 }
 EXPORT_SYMBOL(__alloc_skb);
 
+/**
+ *	build_skb - build a network buffer around a data buffer
+ *	@data: data buffer provided by caller
+ *	@frag_size: size of the page fragment @data is, 0 if kmalloc()ed
+ *
+ *	Allocate a new &sk_buff with @data as its head, like __alloc_skb()
+ *	would have allocated.  Drivers can so have the device write into
+ *	buffers from netdev_alloc_frag(), and only touch an sk_buff once a
+ *	packet is there.  The end of @data holds the skb_shared_info,
+ *	SKB_DATA_ALIGN(sizeof(struct skb_shared_info)) bytes of it.
+ *
+ *	The return is the buffer, or %NULL on failure: @data is then still
+ *	the caller's to free.
+ */
+struct sk_buff *build_skb(void *data, unsigned int frag_size)
+{
+	struct skb_shared_info *shinfo;
+	struct sk_buff *skb;
+	unsigned int size = frag_size ? : ksize(data);
+
+	skb = skb_head_alloc(GFP_ATOMIC, NUMA_NO_NODE);
+	if (!skb)
+		return NULL;
+
+	size -= SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->truesize = size + sizeof(struct sk_buff);
+	skb->head_frag = frag_size != 0;
+	atomic_set(&skb->users, 1);
+	skb->head = data;
+	skb->data = data;
+	skb_reset_tail_pointer(skb);
+	skb->end = skb->tail + size;
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+	skb->mac_header = ~0U;
+#endif
+
+	/* make sure we initialize shinfo sequentially */
+	shinfo = skb_shinfo(skb);
+	memset(shinfo, 0, offsetof(struct skb_shared_info, dataref));
+	atomic_set(&shinfo->dataref, 1);
+	kmemcheck_annotate_variable(shinfo->destructor_arg);
+
+	return skb;
+}
+EXPORT_SYMBOL(build_skb);
+
+/**
+ *	netdev_alloc_frag - allocate a page fragment for a receive buffer
+ *	@fragsz: fragment size
+ *
+ *	Carve @fragsz bytes out of a page of the local CPU, for a receive
+ *	buffer that build_skb() turns into an sk_buff.  Buffers received
+ *	together share a page instead of each needing a kmalloc(), and are
+ *	freed with put_page().
+ */
+void *netdev_alloc_frag(unsigned int fragsz)
+{
+	struct netdev_alloc_cache *nc;
+	void *data = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	nc = &__get_cpu_var(netdev_alloc_cache);
+	if (unlikely(!nc->page)) {
+refill:
+		nc->page = alloc_page(GFP_ATOMIC | __GFP_COLD);
+		nc->offset = 0;
+	}
+	if (likely(nc->page)) {
+		if (nc->offset + fragsz > PAGE_SIZE) {
+			put_page(nc->page);
+			goto refill;
+		}
+		data = page_address(nc->page) + nc->offset;
+		nc->offset += fragsz;
+		get_page(nc->page);
+	}
+	local_irq_restore(flags);
+	return data;
+}
+EXPORT_SYMBOL(netdev_alloc_frag);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -249,9 +410,23 @@ EXPORT_SYMBOL(__alloc_skb);
 struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask)
 {
-	struct sk_buff *skb;
+	struct sk_buff *skb = NULL;
+	unsigned int fragsz = SKB_DATA_ALIGN(length + NET_SKB_PAD) +
+			      SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	if (dev && (dev->priv_flags & IFF_RX_HEAD_FRAG) &&
+	    fragsz <= PAGE_SIZE && !(gfp_mask & (__GFP_WAIT | GFP_DMA))) {
+		void *data = netdev_alloc_frag(fragsz);
 
-	skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, NUMA_NO_NODE);
+		if (likely(data)) {
+			skb = build_skb(data, fragsz);
+			if (unlikely(!skb))
+				put_page(virt_to_head_page(data));
+		}
+	} else {
+		skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0,
+				  NUMA_NO_NODE);
+	}
 	if (likely(skb)) {
 		skb_reserve(skb, NET_SKB_PAD);
 		skb->dev = dev;
@@ -344,7 +519,7 @@ static void skb_release_data(struct sk_buff *skb)
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
 
-		kfree(skb->head);
+		skb_free_head(skb);
 	}
 }
 
@@ -358,7 +533,7 @@ static void kfree_skbmem(struct sk_buff *skb)
 
 	switch (skb->fclone) {
 	case SKB_FCLONE_UNAVAILABLE:
-		kmem_cache_free(skbuff_head_cache, skb);
+		skb_head_free(skb);
 		break;
 
 	case SKB_FCLONE_ORIG:
@@ -496,7 +671,8 @@ bool skb_recycle_check(struct sk_buff *skb, int skb_size)
 	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY)
 		return false;
 
-	if (skb_is_nonlinear(skb) || skb->fclone != SKB_FCLONE_UNAVAILABLE)
+	if (skb_is_nonlinear(skb) || skb->fclone != SKB_FCLONE_UNAVAILABLE ||
+	    skb->head_frag)
 		return false;
 
 	skb_size = SKB_DATA_ALIGN(skb_size + NET_SKB_PAD);
@@ -529,6 +705,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->mac_header		= old->mac_header;
 	skb_dst_copy(new, old);
 	new->rxhash		= old->rxhash;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 #ifdef CONFIG_XFRM
 	new->sp			= secpath_get(old->sp);
 #endif
@@ -579,10 +758,12 @@ static struct sk_buff *__skb_clone(struct sk_buff *n, struct sk_buff *skb)
 	n->hdr_len = skb->nohdr ? skb_headroom(skb) : skb->hdr_len;
 	n->cloned = 1;
 	n->nohdr = 0;
+	n->xmit_more = 0;
 	n->destructor = NULL;
 	C(tail);
 	C(end);
 	C(head);
+	C(head_frag);
 	C(data);
 	C(truesize);
 	atomic_set(&n->users, 1);
@@ -701,7 +882,7 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 		n->fclone = SKB_FCLONE_CLONE;
 		atomic_inc(fclone_ref);
 	} else {
-		n = kmem_cache_alloc(skbuff_head_cache, gfp_mask);
+		n = skb_head_alloc(gfp_mask, NUMA_NO_NODE);
 		if (!n)
 			return NULL;
 
@@ -878,7 +1059,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		fastpath = atomic_read(&skb_shinfo(skb)->dataref) == delta;
 	}
 
-	if (fastpath &&
+	if (fastpath && !skb->head_frag &&
 	    size + sizeof(struct skb_shared_info) <= ksize(skb->head)) {
 		memmove(skb->head + size, skb_shinfo(skb),
 			offsetof(struct skb_shared_info,
@@ -903,7 +1084,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	       offsetof(struct skb_shared_info, frags[skb_shinfo(skb)->nr_frags]));
 
 	if (fastpath) {
-		kfree(skb->head);
+		skb_free_head(skb);
 	} else {
 		/* copy this zero copy skb frags */
 		if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
@@ -921,6 +1102,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	off = (data + nhead) - skb->head;
 
 	skb->head     = data;
+	skb->head_frag = 0;
 adjust_others:
 	skb->data    += off;
 #ifdef NET_SKBUFF_DATA_USES_OFFSET
@@ -1627,15 +1809,44 @@ static int __skb_splice_bits(struct sk_buff *skb, struct pipe_inode_info *pipe,
 	return 0;
 }
 
+/*
+ * Splice callback for sockets read under the socket lock.
+ */
+ssize_t skb_socket_splice(struct sock *sk, struct pipe_inode_info *pipe,
+			  struct splice_pipe_desc *spd)
+{
+	ssize_t ret;
+
+	/*
+	 * Drop the socket lock, otherwise we have reverse
+	 * locking dependencies between sk_lock and i_mutex
+	 * here as compared to sendfile(). We enter here
+	 * with the socket lock held, and splice_to_pipe() will
+	 * grab the pipe inode lock. For sendfile() emulation,
+	 * we call into ->sendpage() with the i_mutex lock held
+	 * and networking will grab the socket lock.
+	 */
+	release_sock(sk);
+	ret = splice_to_pipe(pipe, spd);
+	lock_sock(sk);
+
+	return ret;
+}
+EXPORT_SYMBOL(skb_socket_splice);
+
 /*
  * Map data from the skb to a pipe. Should handle both the linear part,
  * the fragments, and the frag list. It does NOT handle frag lists within
  * the frag list, if such a thing exists. We'd probably need to recurse to
- * handle that cleanly.
+ * handle that cleanly.  @sk is the socket read from, @splice_cb hands the
+ * pages to the pipe with whatever locking @sk needs.
  */
-int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
+int skb_splice_bits(struct sk_buff *skb, struct sock *sk, unsigned int offset,
 		    struct pipe_inode_info *pipe, unsigned int tlen,
-		    unsigned int flags)
+		    unsigned int flags,
+		    ssize_t (*splice_cb)(struct sock *,
+					 struct pipe_inode_info *,
+					 struct splice_pipe_desc *))
 {
 	struct partial_page partial[PIPE_DEF_BUFFERS];
 	struct page *pages[PIPE_DEF_BUFFERS];
@@ -1647,7 +1858,6 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 		.spd_release = sock_spd_release,
 	};
 	struct sk_buff *frag_iter;
-	struct sock *sk = skb->sk;
 	int ret = 0;
 
 	if (splice_grow_spd(pipe, &spd))
@@ -1673,20 +1883,8 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 	}
 
 done:
-	if (spd.nr_pages) {
-		/*
-		 * Drop the socket lock, otherwise we have reverse
-		 * locking dependencies between sk_lock and i_mutex
-		 * here as compared to sendfile(). We enter here
-		 * with the socket lock held, and splice_to_pipe() will
-		 * grab the pipe inode lock. For sendfile() emulation,
-		 * we call into ->sendpage() with the i_mutex lock held
-		 * and networking will grab the socket lock.
-		 */
-		release_sock(sk);
-		ret = splice_to_pipe(pipe, &spd);
-		lock_sock(sk);
-	}
+	if (spd.nr_pages)
+		ret = splice_cb(sk, pipe, &spd);
 
 	splice_shrink_spd(pipe, &spd);
 	return ret;
@@ -2875,6 +3073,34 @@ done:
 }
 EXPORT_SYMBOL_GPL(skb_gro_receive);
 
+static int skb_cpu_callback(struct notifier_block *nfb,
+			    unsigned long action, void *ocpu)
+{
+	unsigned int oldcpu = (unsigned long)ocpu;
+	struct skb_head_cache *hc;
+	struct netdev_alloc_cache *nc;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	hc = &per_cpu(skb_head_cache, oldcpu);
+	while (hc->list) {
+		struct sk_buff *skb = hc->list;
+
+		hc->list = skb->next;
+		kmem_cache_free(skbuff_head_cache, skb);
+	}
+	hc->len = 0;
+
+	nc = &per_cpu(netdev_alloc_cache, oldcpu);
+	if (nc->page) {
+		put_page(nc->page);
+		nc->page = NULL;
+	}
+
+	return NOTIFY_OK;
+}
+
 void __init skb_init(void)
 {
 	skbuff_head_cache = kmem_cache_create("skbuff_head_cache",
@@ -2888,6 +3114,7 @@ void __init skb_init(void)
 						0,
 						SLAB_HWCACHE_ALIGN|SLAB_PANIC,
 						NULL);
+	hotcpu_notifier(skb_cpu_callback, 0);
 }
 
 /**
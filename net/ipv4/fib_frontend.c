@@ -67,7 +67,7 @@ static int __net_init fib4_rules_init(struct net *net)
 	return 0;
 
 fail:
-	kfree(local_table);
+	fib_free_table(local_table);
 	return -ENOMEM;
 }
 #else
@@ -181,17 +181,61 @@ unsigned int inet_dev_addr_type(struct net *net, const struct net_device *dev,
 }
 EXPORT_SYMBOL(inet_dev_addr_type);
 
+/* Compute the "specific destination" of a received packet, the local
+ * address to reply from (RFC 1122), from its route and its source.
+ * Routes are shared by all the flows of a nexthop, so it can't be
+ * cached in them.
+ */
+__be32 fib_compute_spec_dst(struct sk_buff *skb)
+{
+	struct rtable *rt = skb_rtable(skb);
+	const struct iphdr *iph = ip_hdr(skb);
+	struct net *net = dev_net(rt->dst.dev);
+	struct in_device *in_dev;
+	struct net_device *dev;
+	struct fib_result res;
+	struct flowi4 fl4;
+	__be32 spec_dst = 0;
+
+	if ((rt->rt_flags & (RTCF_BROADCAST | RTCF_MULTICAST | RTCF_LOCAL)) ==
+	    RTCF_LOCAL)
+		return iph->daddr;
+
+	rcu_read_lock();
+	dev = dev_get_by_index_rcu(net, rt->rt_iif);
+	in_dev = dev ? __in_dev_get_rcu(dev) : NULL;
+	if (!in_dev)
+		goto out;
+
+	if (ipv4_is_zeronet(iph->saddr)) {
+		spec_dst = inet_select_addr(dev, 0, RT_SCOPE_LINK);
+		goto out;
+	}
+
+	memset(&fl4, 0, sizeof(fl4));
+	fl4.flowi4_iif = net->loopback_dev->ifindex;
+	fl4.daddr = iph->saddr;
+	fl4.flowi4_tos = RT_TOS(iph->tos);
+	fl4.flowi4_scope = RT_SCOPE_UNIVERSE;
+	fl4.flowi4_mark = IN_DEV_SRC_VMARK(in_dev) ? skb->mark : 0;
+	if (fib_lookup(net, &fl4, &res) == 0 && res.type == RTN_UNICAST)
+		spec_dst = FIB_RES_PREFSRC(net, res);
+	else
+		spec_dst = inet_select_addr(dev, 0, RT_SCOPE_UNIVERSE);
+out:
+	rcu_read_unlock();
+	return spec_dst;
+}
+
 /* Given (packet source, input interface) and optional (dst, oif, tos):
  * - (main) check, that source is valid i.e. not broadcast or our local
  *   address.
- * - figure out what "logical" interface this packet arrived
- *   and calculate "specific destination" address.
+ * - figure out what "logical" interface this packet arrived.
  * - check, that packet arrived from expected physical interface.
  * called with rcu_read_lock()
  */
 int fib_validate_source(struct sk_buff *skb, __be32 src, __be32 dst, u8 tos,
-			int oif, struct net_device *dev, __be32 *spec_dst,
-			u32 *itag)
+			int oif, struct net_device *dev, u32 *itag)
 {
 	struct in_device *in_dev;
 	struct flowi4 fl4;
@@ -230,7 +274,6 @@ int fib_validate_source(struct sk_buff *skb, __be32 src, __be32 dst, u8 tos,
 		if (res.type != RTN_LOCAL || !accept_local)
 			goto e_inval;
 	}
-	*spec_dst = FIB_RES_PREFSRC(net, res);
 	fib_combine_itag(itag, &res);
 	dev_match = false;
 
@@ -259,17 +302,14 @@ int fib_validate_source(struct sk_buff *skb, __be32 src, __be32 dst, u8 tos,
 
 	ret = 0;
 	if (fib_lookup(net, &fl4, &res) == 0) {
-		if (res.type == RTN_UNICAST) {
-			*spec_dst = FIB_RES_PREFSRC(net, res);
+		if (res.type == RTN_UNICAST)
 			ret = FIB_RES_NH(res).nh_scope >= RT_SCOPE_HOST;
-		}
 	}
 	return ret;
 
 last_resort:
 	if (rpf)
 		goto e_rpf;
-	*spec_dst = inet_select_addr(dev, 0, RT_SCOPE_UNIVERSE);
 	*itag = 0;
 	return 0;
 
@@ -1026,13 +1066,6 @@ static int fib_netdev_event(struct notifier_block *this, unsigned long event, vo
 	case NETDEV_CHANGE:
 		rt_cache_flush(dev_net(dev), 0);
 		break;
-	case NETDEV_UNREGISTER_BATCH:
-		/* The batch unregister is only called on the first
-		 * device in the list of devices being unregistered.
-		 * Therefore we should not pass dev_net(dev) in here.
-		 */
-		rt_cache_flush_batch(NULL);
-		break;
 	}
 	return NOTIFY_DONE;
 }
@@ -141,11 +141,40 @@ const struct fib_prop fib_props[RTN_MAX + 1] = {
 	},
 };
 
+/* Drop the routes cached in a nexthop.  Their users keep them alive
+ * until they release them.
+ */
+static void fib_nh_release_cache(struct fib_nh *nh)
+{
+	struct rtable *rt;
+	int cpu;
+
+	rt = xchg((__force struct rtable **)&nh->nh_rth_input, NULL);
+	if (rt)
+		call_rcu(&rt->dst.rcu_head, dst_rcu_free);
+
+	if (!nh->nh_pcpu_rth_output)
+		return;
+	for_each_possible_cpu(cpu) {
+		struct rtable __rcu **p;
+
+		p = per_cpu_ptr(nh->nh_pcpu_rth_output, cpu);
+		rt = xchg((__force struct rtable **)p, NULL);
+		if (rt)
+			call_rcu(&rt->dst.rcu_head, dst_rcu_free);
+	}
+}
+
 /* Release a nexthop info record */
 static void free_fib_info_rcu(struct rcu_head *head)
 {
 	struct fib_info *fi = container_of(head, struct fib_info, rcu);
 
+	change_nexthops(fi) {
+		fib_nh_release_cache(nexthop_nh);
+		free_percpu(nexthop_nh->nh_pcpu_rth_output);
+	} endfor_nexthops(fi);
+
 	if (fi->fib_metrics != (u32 *) dst_default_metrics)
 		kfree(fi->fib_metrics);
 	kfree(fi);
@@ -180,6 +209,10 @@ void fib_release_info(struct fib_info *fi)
 			hlist_del(&nexthop_nh->nh_hash);
 		} endfor_nexthops(fi)
 		fi->fib_dead = 1;
+		/* The cached routes may hold a reference to the fib_info */
+		change_nexthops(fi) {
+			fib_nh_release_cache(nexthop_nh);
+		} endfor_nexthops(fi)
 		fib_info_put(fi);
 	}
 	spin_unlock_bh(&fib_info_lock);
@@ -770,6 +803,9 @@ struct fib_info *fib_create_info(struct fib_config *cfg)
 	fi->fib_nhs = nhs;
 	change_nexthops(fi) {
 		nexthop_nh->nh_parent = fi;
+		nexthop_nh->nh_pcpu_rth_output = alloc_percpu(struct rtable __rcu *);
+		if (!nexthop_nh->nh_pcpu_rth_output)
+			goto failure;
 	} endfor_nexthops(fi)
 
 	if (cfg->fc_mx) {
@@ -1055,6 +1091,7 @@ int fib_sync_down_dev(struct net_device *dev, int force)
 			else if (nexthop_nh->nh_dev == dev &&
 				 nexthop_nh->nh_scope != scope) {
 				nexthop_nh->nh_flags |= RTNH_F_DEAD;
+				fib_nh_release_cache(nexthop_nh);
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
 				spin_lock_bh(&fib_multipath_lock);
 				fi->fib_power -= nexthop_nh->nh_power;
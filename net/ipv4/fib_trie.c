@@ -96,14 +96,30 @@ typedef unsigned int t_key;
 #define IS_TNODE(n) (!(n->parent & T_LEAF))
 #define IS_LEAF(n) (n->parent & T_LEAF)
 
+/*
+ * Leaves and tnodes share their first fields, so that a lookup can test
+ * the key of a node without knowing its type.  A leaf has all its key
+ * bits significant: pos is KEYLENGTH and bits is 0.
+ *
+ * slen is the longest suffix (KEYLENGTH - prefix length) of the prefixes
+ * below a node, and never less than KEYLENGTH - pos - bits.  A node whose
+ * slen is not larger than that holds no prefix shorter than its index
+ * bits, and is skipped when backtracking.
+ */
 struct rt_trie_node {
 	unsigned long parent;
 	t_key key;
+	unsigned char pos;
+	unsigned char bits;
+	unsigned char slen;
 };
 
 struct leaf {
 	unsigned long parent;
 	t_key key;
+	unsigned char pos;
+	unsigned char bits;
+	unsigned char slen;
 	struct hlist_head list;
 	struct rcu_head rcu;
 };
@@ -118,14 +134,14 @@ struct leaf_info {
 
 struct tnode {
 	unsigned long parent;
-	t_key key;
+	t_key key;			/* bits from pos on are zero */
 	unsigned char pos;		/* 2log(KEYLENGTH) bits needed */
 	unsigned char bits;		/* 2log(KEYLENGTH) bits needed */
+	unsigned char slen;		/* 2log(KEYLENGTH) bits needed */
 	unsigned int full_children;	/* KEYLENGTH bits needed */
 	unsigned int empty_children;	/* KEYLENGTH bits needed */
 	union {
 		struct rcu_head rcu;
-		struct work_struct work;
 		struct tnode *tnode_free;
 	};
 	struct rt_trie_node __rcu *child[0];
@@ -155,7 +171,7 @@ struct trie_stat {
 struct trie {
 	struct rt_trie_node __rcu *trie;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-	struct trie_use_stats stats;
+	struct trie_use_stats __percpu *stats;
 #endif
 };
 
@@ -238,6 +254,33 @@ static inline int tnode_child_length(const struct tnode *tn)
 	return 1 << tn->bits;
 }
 
+/*
+ * Index of key in the child array of n, or a value which is not below the
+ * length of the array if key does not match the bits of n before pos.
+ * For a leaf, 0 tells an exact match.
+ */
+static inline unsigned long get_cindex(t_key key, const struct rt_trie_node *n)
+{
+	return (unsigned long)(key ^ n->key) >> (KEYLENGTH - n->pos - n->bits);
+}
+
+/*
+ * Whether key differs from the key of n at or above its least significant
+ * set bit: then no prefix below n can match key.
+ */
+static inline t_key prefix_mismatch(t_key key, const struct rt_trie_node *n)
+{
+	t_key prefix = n->key;
+
+	return (key ^ prefix) & (prefix | -prefix);
+}
+
+/* Suffix length of the prefixes covering all the index bits of n */
+static inline unsigned char node_min_slen(const struct rt_trie_node *n)
+{
+	return KEYLENGTH - n->pos - n->bits;
+}
+
 static inline t_key mask_pfx(t_key k, unsigned int l)
 {
 	return (l == 0) ? 0 : k >> (KEYLENGTH-l) << (KEYLENGTH-l);
@@ -386,7 +429,7 @@ static struct tnode *tnode_alloc(size_t size)
 
 static void __tnode_vfree(struct work_struct *arg)
 {
-	struct tnode *tn = container_of(arg, struct tnode, work);
+	struct tnode *tn = container_of((void *)arg, struct tnode, child);
 	vfree(tn);
 }
 
@@ -399,8 +442,13 @@ static void __tnode_free_rcu(struct rcu_head *head)
 	if (size <= PAGE_SIZE)
 		kfree(tn);
 	else {
-		INIT_WORK(&tn->work, __tnode_vfree);
-		schedule_work(&tn->work);
+		/* The children are gone with the readers: the work lives in
+		 * their array rather than in the header of every tnode.
+		 */
+		struct work_struct *work = (struct work_struct *)tn->child;
+
+		INIT_WORK(work, __tnode_vfree);
+		schedule_work(work);
 	}
 }
 
@@ -442,6 +490,9 @@ static struct leaf *leaf_new(void)
 	struct leaf *l = kmem_cache_alloc(trie_leaf_kmem, GFP_KERNEL);
 	if (l) {
 		l->parent = T_LEAF;
+		l->pos = KEYLENGTH;
+		l->bits = 0;
+		l->slen = 0;
 		INIT_HLIST_HEAD(&l->list);
 	}
 	return l;
@@ -467,7 +518,8 @@ static struct tnode *tnode_new(t_key key, int pos, int bits)
 		tn->parent = T_TNODE;
 		tn->pos = pos;
 		tn->bits = bits;
-		tn->key = key;
+		tn->slen = KEYLENGTH - pos - bits;
+		tn->key = mask_pfx(key, pos);
 		tn->full_children = 0;
 		tn->empty_children = 1<<bits;
 	}
@@ -525,12 +577,56 @@ static void tnode_put_child_reorg(struct tnode *tn, int i, struct rt_trie_node *
 	else if (!wasfull && isfull)
 		tn->full_children++;
 
-	if (n)
+	if (n) {
 		node_set_parent(n, tn);
+		if (n->slen > tn->slen)
+			tn->slen = n->slen;
+	}
 
 	rcu_assign_pointer(tn->child[i], n);
 }
 
+/*
+ * Recompute the suffix length of tn after it lost a child, or a child lost
+ * its longest suffix: it can only shrink.
+ */
+static unsigned char update_suffix(struct tnode *tn)
+{
+	unsigned char slen = node_min_slen((struct rt_trie_node *)tn);
+	int i;
+
+	for (i = 0; i < tnode_child_length(tn); i++) {
+		struct rt_trie_node *n = rtnl_dereference(tn->child[i]);
+
+		if (!n || n->slen <= slen)
+			continue;
+		slen = n->slen;
+		if (slen == tn->slen)
+			break;
+	}
+	tn->slen = slen;
+	return slen;
+}
+
+static void node_pull_suffix(struct tnode *tn)
+{
+	while (tn) {
+		unsigned char slen = tn->slen;
+
+		if (update_suffix(tn) == slen)
+			break;
+		tn = node_parent((struct rt_trie_node *)tn);
+	}
+}
+
+static void node_push_suffix(struct tnode *tn, unsigned char slen)
+{
+	while (tn && tn->slen < slen) {
+		tn->slen = slen;
+		tn = node_parent((struct rt_trie_node *)tn);
+	}
+}
+
 #define MAX_WORK 10
 static struct rt_trie_node *resize(struct trie *t, struct tnode *tn)
 {
@@ -642,7 +738,7 @@ static struct rt_trie_node *resize(struct trie *t, struct tnode *tn)
 		if (IS_ERR(tn)) {
 			tn = old_tn;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.resize_node_skipped++;
+			this_cpu_inc(t->stats->resize_node_skipped);
 #endif
 			break;
 		}
@@ -669,7 +765,7 @@ static struct rt_trie_node *resize(struct trie *t, struct tnode *tn)
 		if (IS_ERR(tn)) {
 			tn = old_tn;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.resize_node_skipped++;
+			this_cpu_inc(t->stats->resize_node_skipped);
 #endif
 			break;
 		}
@@ -941,6 +1037,28 @@ static inline struct list_head *get_fa_head(struct leaf *l, int plen)
 	return &li->falh;
 }
 
+/* The longest suffix of a leaf is the one of its shortest prefix */
+static void leaf_update_suffix(struct leaf *l)
+{
+	struct hlist_node *node;
+	struct leaf_info *li;
+	unsigned char slen = 0;
+
+	hlist_for_each_entry(li, node, &l->list, hlist)
+		slen = max_t(unsigned char, slen, KEYLENGTH - li->plen);
+	l->slen = slen;
+}
+
+/* Propagate a shrunk suffix of l, after it lost a prefix, up the trie */
+static void leaf_pull_suffix(struct leaf *l)
+{
+	unsigned char slen = l->slen;
+
+	leaf_update_suffix(l);
+	if (l->slen < slen)
+		node_pull_suffix(node_parent((struct rt_trie_node *)l));
+}
+
 static void insert_leaf_info(struct hlist_head *head, struct leaf_info *new)
 {
 	struct leaf_info *li = NULL, *last = NULL;
@@ -1101,6 +1219,8 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 
 		fa_head = &li->falh;
 		insert_leaf_info(&l->list, li);
+		leaf_update_suffix(l);
+		node_push_suffix(node_parent(n), l->slen);
 		goto done;
 	}
 	l = leaf_new();
@@ -1118,6 +1238,7 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 
 	fa_head = &li->falh;
 	insert_leaf_info(&l->list, li);
+	leaf_update_suffix(l);
 
 	if (t->trie && n == NULL) {
 		/* Case 2: n is NULL, and will just insert a new leaf */
@@ -1168,6 +1289,8 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 		}
 	}
 
+	node_push_suffix(tp, l->slen);
+
 	if (tp && tp->pos + tp->bits > 32)
 		pr_warning("fib_trie"
 			   " tp=%p pos=%d, bits=%d, key=%0x plen=%d\n",
@@ -1377,7 +1500,7 @@ static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
 			err = fib_props[fa->fa_type].error;
 			if (err) {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
+				this_cpu_inc(t->stats->semantic_match_passed);
 #endif
 				return err;
 			}
@@ -1392,7 +1515,7 @@ static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
 					continue;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
+				this_cpu_inc(t->stats->semantic_match_passed);
 #endif
 				res->prefixlen = li->plen;
 				res->nh_sel = nhsel;
@@ -1408,7 +1531,7 @@ static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
 		}
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-		t->stats.semantic_match_miss++;
+		this_cpu_inc(t->stats->semantic_match_miss);
 #endif
 	}
 
@@ -1419,16 +1542,11 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 		     struct fib_result *res, int fib_flags)
 {
 	struct trie *t = (struct trie *) tb->tb_data;
-	int ret;
+	const t_key key = ntohl(flp->daddr);
 	struct rt_trie_node *n;
-	struct tnode *pn;
-	unsigned int pos, bits;
-	t_key key = ntohl(flp->daddr);
-	unsigned int chopped_off;
-	t_key cindex = 0;
-	unsigned int current_prefix_length = KEYLENGTH;
-	struct tnode *cn;
-	t_key pref_mismatch;
+	struct tnode *pn = NULL;
+	unsigned long index, cindex = 0;
+	int ret;
 
 	rcu_read_lock();
 
@@ -1437,174 +1555,96 @@ int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 		goto failed;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-	t->stats.gets++;
+	this_cpu_inc(t->stats->gets);
 #endif
 
-	/* Just a leaf? */
-	if (IS_LEAF(n)) {
-		ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
-		goto found;
-	}
-
-	pn = (struct tnode *) n;
-	chopped_off = 0;
-
-	while (pn) {
-		pos = pn->pos;
-		bits = pn->bits;
-
-		if (!chopped_off)
-			cindex = tkey_extract_bits(mask_pfx(key, current_prefix_length),
-						   pos, bits);
-
-		n = tnode_get_child_rcu(pn, cindex);
-
-		if (n == NULL) {
-#ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.null_node_hit++;
-#endif
-			goto backtrace;
-		}
+	/* Step 1: Travel to the longest prefix match in the trie */
+	for (;;) {
+		/* The index is the difference between the key and the
+		 * prefix of n, which is zero from pos on: it is larger
+		 * than the child array when the key does not match the
+		 * bits before pos, and it is 0 on an exact leaf match.
+		 */
+		index = get_cindex(key, n);
+		if (index >= (1ul << n->bits))
+			break;
 
-		if (IS_LEAF(n)) {
-			ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
-			if (ret > 0)
-				goto backtrace;
+		if (IS_LEAF(n))
 			goto found;
-		}
-
-		cn = (struct tnode *)n;
-
-		/*
-		 * It's a tnode, and we can do some extra checks here if we
-		 * like, to avoid descending into a dead-end branch.
-		 * This tnode is in the parent's child array at index
-		 * key[p_pos..p_pos+p_bits] but potentially with some bits
-		 * chopped off, so in reality the index may be just a
-		 * subprefix, padded with zero at the end.
-		 * We can also take a look at any skipped bits in this
-		 * tnode - everything up to p_pos is supposed to be ok,
-		 * and the non-chopped bits of the index (se previous
-		 * paragraph) are also guaranteed ok, but the rest is
-		 * considered unknown.
-		 *
-		 * The skipped bits are key[pos+bits..cn->pos].
-		 */
 
-		/* If current_prefix_length < pos+bits, we are already doing
-		 * actual prefix  matching, which means everything from
-		 * pos+(bits-chopped_off) onward must be zero along some
-		 * branch of this subtree - otherwise there is *no* valid
-		 * prefix present. Here we can only check the skipped
-		 * bits. Remember, since we have already indexed into the
-		 * parent's child array, we know that the bits we chopped of
-		 * *are* zero.
+		/* Only remember the nodes we may have to come back to:
+		 * those holding a prefix shorter than their index bits.
 		 */
-
-		/* NOTA BENE: Checking only skipped bits
-		   for the new node here */
-
-		if (current_prefix_length < pos+bits) {
-			if (tkey_extract_bits(cn->key, current_prefix_length,
-						cn->pos - current_prefix_length)
-			    || !(cn->child[0]))
-				goto backtrace;
+		if (n->slen > node_min_slen(n)) {
+			pn = (struct tnode *)n;
+			cindex = index;
 		}
 
-		/*
-		 * If chopped_off=0, the index is fully validated and we
-		 * only need to look at the skipped bits for this, the new,
-		 * tnode. What we actually want to do is to find out if
-		 * these skipped bits match our key perfectly, or if we will
-		 * have to count on finding a matching prefix further down,
-		 * because if we do, we would like to have some way of
-		 * verifying the existence of such a prefix at this point.
-		 */
-
-		/* The only thing we can do at this point is to verify that
-		 * any such matching prefix can indeed be a prefix to our
-		 * key, and if the bits in the node we are inspecting that
-		 * do not match our key are not ZERO, this cannot be true.
-		 * Thus, find out where there is a mismatch (before cn->pos)
-		 * and verify that all the mismatching bits are zero in the
-		 * new tnode's key.
-		 */
+		n = rcu_dereference(((struct tnode *)n)->child[index]);
+		if (unlikely(!n))
+			goto null_node;
+	}
 
-		/*
-		 * Note: We aren't very concerned about the piece of
-		 * the key that precede pn->pos+pn->bits, since these
-		 * have already been checked. The bits after cn->pos
-		 * aren't checked since these are by definition
-		 * "unknown" at this point. Thus, what we want to see
-		 * is if we are about to enter the "prefix matching"
-		 * state, and in that case verify that the skipped
-		 * bits that will prevail throughout this subtree are
-		 * zero, as they have to be if we are to find a
-		 * matching prefix.
+	/* Step 2: Sort out leaves and backtrack for the longest prefix */
+	for (;;) {
+		/* No prefix below n can match if key differs from it at or
+		 * above its least significant set bit, nor if all of them
+		 * are longer than its index bits.
 		 */
+		if (unlikely(prefix_mismatch(key, n)) ||
+		    n->slen == node_min_slen(n))
+			goto backtrace;
 
-		pref_mismatch = mask_pfx(cn->key ^ key, cn->pos);
+		if (unlikely(IS_LEAF(n)))
+			break;
 
-		/*
-		 * In short: If skipped bits in this node do not match
-		 * the search key, enter the "prefix matching"
-		 * state.directly.
+		/* A shorter prefix has zeroes in the remaining index bits:
+		 * no need to remember the parent, backtracking has to go
+		 * back to where this descent started anyway.
 		 */
-		if (pref_mismatch) {
-			int mp = KEYLENGTH - fls(pref_mismatch);
-
-			if (tkey_extract_bits(cn->key, mp, cn->pos - mp) != 0)
-				goto backtrace;
-
-			if (current_prefix_length >= cn->pos)
-				current_prefix_length = mp;
-		}
-
-		pn = (struct tnode *)n; /* Descend */
-		chopped_off = 0;
-		continue;
+		n = rcu_dereference(((struct tnode *)n)->child[0]);
 
+		while (!n) {
+null_node:
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+			this_cpu_inc(t->stats->null_node_hit);
+#endif
 backtrace:
-		chopped_off++;
-
-		/* As zero don't change the child key (cindex) */
-		while ((chopped_off <= pn->bits)
-		       && !(cindex & (1<<(chopped_off-1))))
-			chopped_off++;
-
-		/* Decrease current_... with bits chopped off */
-		if (current_prefix_length > pn->pos + pn->bits - chopped_off)
-			current_prefix_length = pn->pos + pn->bits
-				- chopped_off;
-
-		/*
-		 * Either we do the actual chop off according or if we have
-		 * chopped off all bits in this tnode walk up to our parent.
-		 */
-
-		if (chopped_off <= pn->bits) {
-			cindex &= ~(1 << (chopped_off-1));
-		} else {
-			struct tnode *parent = node_parent_rcu((struct rt_trie_node *) pn);
-			if (!parent)
-				goto failed;
-
-			/* Get Child's index */
-			cindex = tkey_extract_bits(pn->key, parent->pos, parent->bits);
-			pn = parent;
-			chopped_off = 0;
-
+			/* Once cindex is 0 there are no more bits to strip
+			 * at this level, ascend to strip those of the parent.
+			 */
+			while (!cindex) {
+				struct tnode *parent;
+
+				if (!pn)
+					goto failed;
+				parent = node_parent_rcu((struct rt_trie_node *)pn);
+				if (!parent)
+					goto failed;
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.backtrack++;
+				this_cpu_inc(t->stats->backtrack);
 #endif
-			goto backtrace;
+				cindex = get_cindex(pn->key,
+						    (struct rt_trie_node *)parent);
+				pn = parent;
+			}
+
+			/* Strip the least significant set bit of the index */
+			cindex &= cindex - 1;
+			n = rcu_dereference(pn->child[cindex]);
 		}
 	}
-failed:
-	ret = 1;
+
 found:
+	ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
+	if (ret > 0)
+		goto backtrace;
 	rcu_read_unlock();
 	return ret;
+
+failed:
+	rcu_read_unlock();
+	return 1;
 }
 
 /*
@@ -1619,6 +1659,7 @@ static void trie_leaf_remove(struct trie *t, struct leaf *l)
 	if (tp) {
 		t_key cindex = tkey_extract_bits(l->key, tp->pos, tp->bits);
 		put_child(t, (struct tnode *)tp, cindex, NULL);
+		node_pull_suffix(tp);
 		trie_rebalance(t, tp);
 	} else
 		rcu_assign_pointer(t->trie, NULL);
@@ -1706,6 +1747,8 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 
 	if (hlist_empty(&l->list))
 		trie_leaf_remove(t, l);
+	else
+		leaf_pull_suffix(l);
 
 	if (fa->fa_state & FA_S_ACCESSED)
 		rt_cache_flush(cfg->fc_nlinfo.nl_net, -1);
@@ -1833,6 +1876,8 @@ int fib_table_flush(struct fib_table *tb)
 
 	for (l = trie_firstleaf(t); l; l = trie_nextleaf(l)) {
 		found += trie_flush_leaf(l);
+		if (!hlist_empty(&l->list))
+			leaf_pull_suffix(l);
 
 		if (ll && hlist_empty(&ll->list))
 			trie_leaf_remove(t, ll);
@@ -1848,6 +1893,11 @@ int fib_table_flush(struct fib_table *tb)
 
 void fib_free_table(struct fib_table *tb)
 {
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+	struct trie *t = (struct trie *)tb->tb_data;
+
+	free_percpu(t->stats);
+#endif
 	kfree(tb);
 }
 
@@ -1994,6 +2044,14 @@ struct fib_table *fib_trie_table(u32 id)
 	t = (struct trie *) tb->tb_data;
 	memset(t, 0, sizeof(*t));
 
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+	t->stats = alloc_percpu(struct trie_use_stats);
+	if (!t->stats) {
+		kfree(tb);
+		return NULL;
+	}
+#endif
+
 	return tb;
 }
 
@@ -2159,18 +2217,32 @@ static void trie_show_stats(struct seq_file *seq, struct trie_stat *stat)
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 static void trie_show_usage(struct seq_file *seq,
-			    const struct trie_use_stats *stats)
+			    const struct trie_use_stats __percpu *stats)
 {
+	struct trie_use_stats s = { 0 };
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		const struct trie_use_stats *pcpu = per_cpu_ptr(stats, cpu);
+
+		s.gets += pcpu->gets;
+		s.backtrack += pcpu->backtrack;
+		s.semantic_match_passed += pcpu->semantic_match_passed;
+		s.semantic_match_miss += pcpu->semantic_match_miss;
+		s.null_node_hit += pcpu->null_node_hit;
+		s.resize_node_skipped += pcpu->resize_node_skipped;
+	}
+
 	seq_printf(seq, "\nCounters:\n---------\n");
-	seq_printf(seq, "gets = %u\n", stats->gets);
-	seq_printf(seq, "backtracks = %u\n", stats->backtrack);
+	seq_printf(seq, "gets = %u\n", s.gets);
+	seq_printf(seq, "backtracks = %u\n", s.backtrack);
 	seq_printf(seq, "semantic match passed = %u\n",
-		   stats->semantic_match_passed);
+		   s.semantic_match_passed);
 	seq_printf(seq, "semantic match miss = %u\n",
-		   stats->semantic_match_miss);
-	seq_printf(seq, "null node hit= %u\n", stats->null_node_hit);
+		   s.semantic_match_miss);
+	seq_printf(seq, "null node hit= %u\n", s.null_node_hit);
 	seq_printf(seq, "skipped node resize = %u\n\n",
-		   stats->resize_node_skipped);
+		   s.resize_node_skipped);
 }
 #endif /*  CONFIG_IP_FIB_TRIE_STATS */
 
@@ -2212,7 +2284,7 @@ static int fib_triestat_seq_show(struct seq_file *seq, void *v)
 			trie_collect_stats(t, &stat);
 			trie_show_stats(seq, &stat);
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			trie_show_usage(seq, &t->stats);
+			trie_show_usage(seq, t->stats);
 #endif
 		}
 	}
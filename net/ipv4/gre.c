@@ -17,8 +17,10 @@
 #include <linux/in.h>
 #include <linux/ip.h>
 #include <linux/netdevice.h>
+#include <linux/if_tunnel.h>
 #include <linux/spinlock.h>
 #include <net/protocol.h>
+#include <net/ip.h>
 #include <net/gre.h>
 
 
@@ -110,9 +112,198 @@ static void gre_err(struct sk_buff *skb, u32 info)
 	rcu_read_unlock();
 }
 
+static int gre_gso_send_check(struct sk_buff *skb)
+{
+	return 0;
+}
+
+/*
+ * Segment a packet GRO built from GRE encapsulated segments: the inner
+ * packet is segmented by its own protocol, then every segment gets a copy
+ * of the outer headers.  The segments are checksummed in software, as
+ * devices can't find the inner transport header; that needs them linear,
+ * as skb_segment() only sums what it copies.
+ */
+static struct sk_buff *gre_gso_segment(struct sk_buff *skb, u32 features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	const struct gre_base_hdr *greh;
+	struct sk_buff *seg;
+	__be16 protocol = skb->protocol;
+	int mac_len = skb->mac_len;
+	int doffset, grehlen;
+
+	if (unlikely(skb_shinfo(skb)->gso_type &
+		     ~(SKB_GSO_TCPV4 |
+		       SKB_GSO_TCPV6 |
+		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_UDP_L4 |
+		       SKB_GSO_DODGY |
+		       SKB_GSO_GRE |
+		       0)))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, sizeof(*greh))))
+		goto out;
+
+	greh = (struct gre_base_hdr *)skb_transport_header(skb);
+	if (unlikely(greh->flags & ~GRE_KEY))
+		goto out;
+
+	grehlen = GRE_HEADER_SECTION;
+	if (greh->flags & GRE_KEY)
+		grehlen += GRE_HEADER_SECTION;
+
+	if (unlikely(!pskb_may_pull(skb, grehlen)))
+		goto out;
+
+	greh = (struct gre_base_hdr *)skb_transport_header(skb);
+	doffset = skb->data - skb_mac_header(skb);
+
+	skb->protocol = greh->protocol;
+	__skb_pull(skb, grehlen);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+
+	segs = skb_gso_segment(skb, features & ~(NETIF_F_ALL_CSUM |
+						 NETIF_F_SG |
+						 NETIF_F_GSO_MASK));
+
+	/* Back to the outer headers, skb->data is at the inner ones */
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+	skb->protocol = protocol;
+	skb->mac_len = mac_len;
+	skb_set_mac_header(skb, -(doffset + grehlen));
+	skb_set_network_header(skb, mac_len - (doffset + grehlen));
+	__skb_push(skb, grehlen);
+	skb_reset_transport_header(skb);
+
+	if (!segs || IS_ERR(segs))
+		goto out;
+
+	for (seg = segs; seg; seg = seg->next) {
+		__skb_push(seg, doffset + grehlen);
+		skb_copy_to_linear_data(seg, skb_mac_header(skb),
+					doffset + grehlen);
+		skb_reset_mac_header(seg);
+		skb_set_network_header(seg, mac_len);
+		seg->mac_len = mac_len;
+		seg->protocol = protocol;
+	}
+
+out:
+	return segs;
+}
+
+/*
+ * Packets of one flow through one tunnel are merged by the inner protocol,
+ * once their GRE headers match.  Only version 0 with an optional key is
+ * handled: checksums and sequence numbers differ from packet to packet.
+ */
+static struct sk_buff **gre_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct packet_type *ptype;
+	const struct gre_base_hdr *greh;
+	unsigned int hlen, off;
+	unsigned int grehlen;
+	struct sk_buff *p;
+	int flush = 1;
+	__wsum csum;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*greh);
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	if (greh->flags & ~GRE_KEY)
+		goto out;
+
+	grehlen = GRE_HEADER_SECTION;
+	if (greh->flags & GRE_KEY)
+		grehlen += GRE_HEADER_SECTION;
+
+	hlen = off + grehlen;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	rcu_read_lock();
+	ptype = gro_find_receive_by_type(greh->protocol);
+	if (!ptype)
+		goto out_unlock;
+
+	flush = 0;
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		if (memcmp(greh, skb_gro_held_header(p, skb, off), grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	skb_gro_pull(skb, grehlen);
+
+	/* The checksum of the inner packet is what the inner protocols check */
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, greh, grehlen);
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb->csum = csum;
+
+out_unlock:
+	rcu_read_unlock();
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+static int gre_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb) + ip_hdrlen(skb);
+	const struct gre_base_hdr *greh;
+	struct packet_type *ptype;
+	int grehlen;
+	int err = -ENOENT;
+
+	greh = (struct gre_base_hdr *)(skb->data + nhoff);
+	grehlen = GRE_HEADER_SECTION;
+	if (greh->flags & GRE_KEY)
+		grehlen += GRE_HEADER_SECTION;
+
+	rcu_read_lock();
+	ptype = gro_find_complete_by_type(greh->protocol);
+	if (ptype) {
+		/* The inner protocols complete from the inner header on */
+		skb_set_network_header(skb, nhoff + grehlen);
+		err = ptype->gro_complete(skb);
+	}
+	rcu_read_unlock();
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	return err;
+}
+
 static const struct net_protocol net_gre_protocol = {
 	.handler     = gre_rcv,
 	.err_handler = gre_err,
+	.gso_send_check = gre_gso_send_check,
+	.gso_segment = gre_gso_segment,
+	.gro_receive = gre_gro_receive,
+	.gro_complete = gre_gro_complete,
 	.netns_ok    = 1,
 };
 
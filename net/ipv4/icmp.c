@@ -78,6 +78,7 @@
 #include <net/snmp.h>
 #include <net/ip.h>
 #include <net/route.h>
+#include <net/ip_fib.h>
 #include <net/protocol.h>
 #include <net/icmp.h>
 #include <net/tcp.h>
@@ -252,6 +253,17 @@ static inline bool icmpv4_xrlim_allow(struct net *net, struct rtable *rt,
 
 	/* Limit if icmp type is enabled in ratemask. */
 	if ((1 << type) & net->ipv4.sysctl_icmp_ratemask) {
+		struct inet_peer *peer;
+
+		/* Routes shared by a nexthop have no peer of their own */
+		if (rt->dst.flags & DST_NOPEER) {
+			peer = inet_getpeer_v4(fl4->daddr, 1);
+			rc = inet_peer_xrlim_allow(peer,
+						   net->ipv4.sysctl_icmp_ratelimit);
+			if (peer)
+				inet_putpeer(peer);
+			goto out;
+		}
 		if (!rt->peer)
 			rt_bind_peer(rt, fl4->daddr, 1);
 		rc = inet_peer_xrlim_allow(rt->peer,
@@ -351,6 +363,7 @@ static void icmp_reply(struct icmp_bxm *icmp_param, struct sk_buff *skb)
 	daddr = ipc.addr = ip_hdr(skb)->saddr;
 	ipc.opt = NULL;
 	ipc.tx_flags = 0;
+	ipc.gso_size = 0;
 	if (icmp_param->replyopts.opt.opt.optlen) {
 		ipc.opt = &icmp_param->replyopts.opt;
 		if (ipc.opt->opt.srr)
@@ -358,7 +371,7 @@ static void icmp_reply(struct icmp_bxm *icmp_param, struct sk_buff *skb)
 	}
 	memset(&fl4, 0, sizeof(fl4));
 	fl4.daddr = daddr;
-	fl4.saddr = rt->rt_spec_dst;
+	fl4.saddr = fib_compute_spec_dst(skb);
 	fl4.flowi4_mark = mark;
 	fl4.flowi4_tos = RT_TOS(ip_hdr(skb)->tos);
 	fl4.flowi4_proto = IPPROTO_ICMP;
@@ -606,6 +619,7 @@ void icmp_send(struct sk_buff *skb_in, int type, int code, __be32 info)
 	ipc.addr = iph->saddr;
 	ipc.opt = &icmp_param.replyopts.opt;
 	ipc.tx_flags = 0;
+	ipc.gso_size = 0;
 
 	rt = icmp_route_lookup(net, &fl4, skb_in, iph, saddr, tos, mark,
 			       type, code, &icmp_param);
@@ -448,7 +448,9 @@ relookup:
 		p->pmtu_expires = 0;
 		p->pmtu_orig = 0;
 		memset(&p->redirect_learned, 0, sizeof(p->redirect_learned));
-
+		p->tcp_fastopen_cookie.len = 0;
+		p->tcp_fastopen_mss = 0;
+		p->tcp_fastopen_syn_loss = 0;
 
 		/* Link the node. */
 		link_to_pool(p, base);
@@ -670,6 +670,8 @@ static int ipgre_rcv(struct sk_buff *skb)
 		tstats->rx_bytes += skb->len;
 
 		__skb_tunnel_rx(skb, tunnel->dev);
+		/* GRO merged packets are plain ones from here on */
+		skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
 
 		skb_reset_network_header(skb);
 		ipgre_ecn_decapsulate(iph, skb);
@@ -726,7 +728,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 
 		if (skb->protocol == htons(ETH_P_IP)) {
 			rt = skb_rtable(skb);
-			if ((dst = rt->rt_gateway) == 0)
+			dst = rt_nexthop(rt, ip_hdr(skb)->daddr);
+			if (dst == 0)
 				goto tx_error_icmp;
 		}
 #if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
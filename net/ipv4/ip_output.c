@@ -67,6 +67,7 @@
 #include <net/ip.h>
 #include <net/protocol.h>
 #include <net/route.h>
+#include <net/ip_fib.h>
 #include <net/xfrm.h>
 #include <linux/skbuff.h>
 #include <net/sock.h>
@@ -215,6 +216,19 @@ static inline int ip_finish_output2(struct sk_buff *skb)
 	}
 	rcu_read_unlock();
 
+	/* A route shared by a directly connected nexthop has no neighbour */
+	if (!rt->rt_gateway) {
+		__be32 nexthop = ip_hdr(skb)->daddr;
+
+		neigh = dst_neigh_lookup(dst, &nexthop);
+		if (!IS_ERR(neigh)) {
+			int res = neigh_output(neigh, skb);
+
+			neigh_release(neigh);
+			return res;
+		}
+	}
+
 	if (net_ratelimit())
 		printk(KERN_DEBUG "ip_finish_output2: No header cache and no neighbour!\n");
 	kfree_skb(skb);
@@ -367,7 +381,8 @@ int ip_queue_xmit(struct sk_buff *skb, struct flowi *fl)
 	skb_dst_set_noref(skb, &rt->dst);
 
 packet_routed:
-	if (inet_opt && inet_opt->opt.is_strictroute && fl4->daddr != rt->rt_gateway)
+	if (inet_opt && inet_opt->opt.is_strictroute &&
+	    fl4->daddr != rt_nexthop(rt, fl4->daddr))
 		goto no_route;
 
 	/* OK, we know where to send it, allocate and build IP header. */
@@ -810,11 +825,17 @@ static int __ip_append_data(struct sock *sk,
 	unsigned int maxfraglen, fragheaderlen;
 	int csummode = CHECKSUM_NONE;
 	struct rtable *rt = (struct rtable *)cork->dst;
+	bool paged;
 
 	skb = skb_peek_tail(queue);
 
 	exthdrlen = !skb ? rt->dst.header_len : 0;
-	mtu = cork->fragsize;
+	/* A UDP_SEGMENT send is built as one datagram, and split into
+	 * gso_size chunks by the device or GSO.  Keep the payload in pages
+	 * when the device can take them.
+	 */
+	mtu = cork->gso_size ? 0xFFFF : cork->fragsize;
+	paged = cork->gso_size && (rt->dst.dev->features & NETIF_F_SG);
 
 	hh_len = LL_RESERVED_SPACE(rt->dst.dev);
 
@@ -833,7 +854,7 @@ static int __ip_append_data(struct sock *sk,
 	 */
 	if (transhdrlen &&
 	    length + fragheaderlen <= mtu &&
-	    rt->dst.dev->features & NETIF_F_V4_CSUM &&
+	    (rt->dst.dev->features & NETIF_F_V4_CSUM || cork->gso_size) &&
 	    !exthdrlen)
 		csummode = CHECKSUM_PARTIAL;
 
@@ -870,6 +891,7 @@ static int __ip_append_data(struct sock *sk,
 			unsigned int fraglen;
 			unsigned int fraggap;
 			unsigned int alloclen;
+			unsigned int pagedlen = 0;
 			struct sk_buff *skb_prev;
 alloc_new_skb:
 			skb_prev = skb;
@@ -890,8 +912,12 @@ alloc_new_skb:
 			if ((flags & MSG_MORE) &&
 			    !(rt->dst.dev->features&NETIF_F_SG))
 				alloclen = mtu;
-			else
+			else if (!paged)
 				alloclen = fraglen;
+			else {
+				alloclen = fragheaderlen + transhdrlen;
+				pagedlen = fraglen - alloclen;
+			}
 
 			alloclen += exthdrlen;
 
@@ -935,7 +961,7 @@ alloc_new_skb:
 			/*
 			 *	Find where to start putting bytes.
 			 */
-			data = skb_put(skb, fraglen + exthdrlen);
+			data = skb_put(skb, fraglen + exthdrlen - pagedlen);
 			skb_set_network_header(skb, exthdrlen);
 			skb->transport_header = (skb->network_header +
 						 fragheaderlen);
@@ -951,7 +977,7 @@ alloc_new_skb:
 				pskb_trim_unique(skb_prev, maxfraglen);
 			}
 
-			copy = datalen - transhdrlen - fraggap;
+			copy = datalen - transhdrlen - fraggap - pagedlen;
 			if (copy > 0 && getfrag(from, data + transhdrlen, offset, copy, fraggap, skb) < 0) {
 				err = -EFAULT;
 				kfree_skb(skb);
@@ -959,7 +985,7 @@ alloc_new_skb:
 			}
 
 			offset += copy;
-			length -= datalen - fraggap;
+			length -= datalen - fraggap - pagedlen;
 			transhdrlen = 0;
 			exthdrlen = 0;
 			csummode = CHECKSUM_NONE;
@@ -1077,6 +1103,7 @@ static int ip_setup_cork(struct sock *sk, struct inet_cork *cork,
 	cork->dst = &rt->dst;
 	cork->length = 0;
 	cork->tx_flags = ipc->tx_flags;
+	cork->gso_size = ipc->gso_size;
 	cork->page = NULL;
 	cork->off = 0;
 
@@ -1319,9 +1346,10 @@ struct sk_buff *__ip_make_skb(struct sock *sk,
 
 	/* DF bit is set when we want to see DF on outgoing frames.
 	 * If local_df is set too, we still allow to fragment this frame
-	 * locally. */
+	 * locally.  UDP_SEGMENT datagrams are checked against the mtu one
+	 * by one. */
 	if (inet->pmtudisc >= IP_PMTUDISC_DO ||
-	    (skb->len <= dst_mtu(&rt->dst) &&
+	    ((skb->len <= dst_mtu(&rt->dst) || cork->gso_size) &&
 	     ip_dont_fragment(sk, &rt->dst)))
 		df = htons(IP_DF);
 
@@ -1476,7 +1504,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, __be32 daddr,
 	struct ip_options_data replyopts;
 	struct ipcm_cookie ipc;
 	struct flowi4 fl4;
-	struct rtable *rt = skb_rtable(skb);
+	struct rtable *rt;
 	int err;
 
 	if (ip_options_echo(&replyopts.opt.opt, skb))
@@ -1485,6 +1513,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, __be32 daddr,
 	ipc.addr = daddr;
 	ipc.opt = NULL;
 	ipc.tx_flags = 0;
+	ipc.gso_size = 0;
 
 	if (replyopts.opt.opt.optlen) {
 		ipc.opt = &replyopts.opt;
@@ -1498,7 +1527,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, __be32 daddr,
 			   RT_TOS(ip_hdr(skb)->tos),
 			   RT_SCOPE_UNIVERSE, sk->sk_protocol,
 			   ip_reply_arg_flowi_flags(arg),
-			   daddr, rt->rt_spec_dst,
+			   daddr, fib_compute_spec_dst(skb),
 			   tcp_hdr(skb)->source, tcp_hdr(skb)->dest,
 			   arg->uid);
 	security_skb_classify_flow(skb, flowi4_to_flowi(&fl4));
@@ -34,6 +34,7 @@
 #include <linux/route.h>
 #include <linux/mroute.h>
 #include <net/route.h>
+#include <net/ip_fib.h>
 #include <net/xfrm.h>
 #include <net/compat.h>
 #if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
@@ -63,7 +64,7 @@ static void ip_cmsg_recv_pktinfo(struct msghdr *msg, struct sk_buff *skb)
 	info.ipi_addr.s_addr = ip_hdr(skb)->daddr;
 	if (rt) {
 		info.ipi_ifindex = rt->rt_iif;
-		info.ipi_spec_dst.s_addr = rt->rt_spec_dst;
+		info.ipi_spec_dst.s_addr = fib_compute_spec_dst(skb);
 	} else {
 		info.ipi_ifindex = 0;
 		info.ipi_spec_dst.s_addr = 0;
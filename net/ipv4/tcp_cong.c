@@ -39,8 +39,10 @@ int tcp_register_congestion_control(struct tcp_congestion_ops *ca)
 {
 	int ret = 0;
 
-	/* all algorithms must implement ssthresh and cong_avoid ops */
-	if (!ca->ssthresh || !ca->cong_avoid) {
+	/* all algorithms must implement ssthresh, and cong_avoid unless
+	 * they control cwnd from cong_control
+	 */
+	if (!ca->ssthresh || !(ca->cong_avoid || ca->cong_control)) {
 		printk(KERN_ERR "TCP %s does not implement required ops\n",
 		       ca->name);
 		return -EINVAL;
@@ -0,0 +1,214 @@
+/*
+ * TCP Fast Open: carry data in the SYN of connections to servers the
+ * client talked to before, saving the round trip of the handshake.
+ *
+ * The server hands out a cookie, a MAC of the client address, in the
+ * SYN-ACK of a regular connection.  The client caches it with the peer
+ * and sends it along with data in later SYNs.  When the cookie checks
+ * out, the server creates the child socket right away and queues it for
+ * accept() with the data of the SYN, before the handshake completes.
+ *
+ * Only IPv4 is supported for now.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/seqlock.h>
+#include <net/inetpeer.h>
+#include <net/secure_seq.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly = TFO_CLIENT_ENABLE;
+
+/* Serializes updates of the Fast Open fields of struct inet_peer */
+static DEFINE_SEQLOCK(tcp_fastopen_seqlock);
+
+void tcp_free_fastopen_req(struct tcp_sock *tp)
+{
+	if (tp->fastopen_req != NULL) {
+		kfree(tp->fastopen_req);
+		tp->fastopen_req = NULL;
+	}
+}
+
+void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+			     struct tcp_fastopen_cookie *foc)
+{
+	u32 cookie[TCP_FASTOPEN_COOKIE_SIZE / 4];
+
+	secure_tcp_fastopen_cookie(cookie, saddr, daddr);
+	memcpy(foc->val, cookie, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+/* Client side: fetch what was learned about the server of @sk.  The
+ * outputs are left alone when nothing is cached.
+ */
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct inet_peer *peer;
+	unsigned int seq;
+
+	if (sk->sk_family != AF_INET)
+		return;
+
+	peer = inet_getpeer_v4(inet_sk(sk)->inet_daddr, 0);
+	if (!peer)
+		return;
+
+	do {
+		seq = read_seqbegin(&tcp_fastopen_seqlock);
+		if (peer->tcp_fastopen_mss)
+			*mss = peer->tcp_fastopen_mss;
+		*cookie = peer->tcp_fastopen_cookie;
+		*syn_loss = peer->tcp_fastopen_syn_loss;
+		*last_syn_loss = *syn_loss ? peer->tcp_fastopen_syn_loss_ts : 0;
+	} while (read_seqretry(&tcp_fastopen_seqlock, seq));
+
+	inet_putpeer(peer);
+}
+
+/* Client side: remember the MSS and cookie from a SYN-ACK, and whether
+ * the SYN carrying data looks to have been dropped on the way.
+ */
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, bool syn_lost)
+{
+	struct inet_peer *peer;
+
+	if (sk->sk_family != AF_INET)
+		return;
+
+	peer = inet_getpeer_v4(inet_sk(sk)->inet_daddr, 1);
+	if (!peer)
+		return;
+
+	write_seqlock_bh(&tcp_fastopen_seqlock);
+	if (mss)
+		peer->tcp_fastopen_mss = mss;
+	if (cookie->len > 0)
+		peer->tcp_fastopen_cookie = *cookie;
+	if (syn_lost) {
+		++peer->tcp_fastopen_syn_loss;
+		peer->tcp_fastopen_syn_loss_ts = jiffies;
+	} else {
+		peer->tcp_fastopen_syn_loss = 0;
+	}
+	write_sequnlock_bh(&tcp_fastopen_seqlock);
+
+	inet_putpeer(peer);
+}
+
+/* Server side: decide whether the SYN received by the listener @sk from
+ * @saddr to @daddr, with Fast Open option @foc, may have its data accepted
+ * right away.  @valid_foc is set to the cookie to hand out in the SYN-ACK,
+ * or left at -1 when the client already has the right one.
+ */
+bool tcp_fastopen_check(struct sock *sk, __be32 saddr, __be32 daddr,
+			struct tcp_fastopen_cookie *foc,
+			struct tcp_fastopen_cookie *valid_foc)
+{
+	struct fastopen_queue *fastopenq =
+		&inet_csk(sk)->icsk_accept_queue.fastopenq;
+
+	if (foc->len < 0)	/* no Fast Open option */
+		return false;
+
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    fastopenq->max_qlen == 0)
+		return false;
+
+	tcp_fastopen_cookie_gen(saddr, daddr, valid_foc);
+
+	if (foc->len == 0) {
+		/* Client requesting a cookie */
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+		return false;
+	}
+
+	if (foc->len != TCP_FASTOPEN_COOKIE_SIZE ||
+	    memcmp(foc->val, valid_foc->val, TCP_FASTOPEN_COOKIE_SIZE)) {
+		/* Stale or forged: regular handshake, with a fresh cookie */
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		return false;
+	}
+	valid_foc->len = -1;
+
+	if (atomic_read(&fastopenq->qlen) >= fastopenq->max_qlen) {
+		NET_INC_STATS_BH(sock_net(sk),
+				 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+		return false;
+	}
+	return true;
+}
+
+/* Server side: finish the @child created by listener @sk from the Fast
+ * Open SYN @skb.  The child keeps @req to retransmit the SYN-ACK from its
+ * own timer, and gets the data of the SYN queued for reading.  Called
+ * with both sockets locked, before the child is queued for accept().
+ */
+void tcp_fastopen_child_init(struct sock *sk, struct sock *child,
+			     struct sk_buff *skb, struct request_sock *req)
+{
+	struct tcp_sock *tp = tcp_sk(child);
+
+	atomic_inc(&inet_csk(sk)->icsk_accept_queue.fastopenq.qlen);
+	sock_hold(sk);
+	tcp_rsk(req)->listener = sk;
+	tp->fastopen_rsk = req;
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never
+	 * scaled. So correct it appropriately.
+	 */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+
+	/* Timer to retransmit the SYN-ACK, see tcp_retransmit_timer() */
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	/* What tcp_rcv_state_process() otherwise does once the
+	 * handshake completes.
+	 */
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_metrics(child);
+	tcp_init_congestion_control(child);
+	tcp_mtup_init(child);
+	tcp_init_buffer_space(child);
+
+	tp->rcv_nxt = TCP_SKB_CB(skb)->seq + 1;
+	if (TCP_SKB_CB(skb)->end_seq != tp->rcv_nxt) {
+		/* The caller still uses and frees the SYN, queue a clone.
+		 * Without one the data is not acked and comes again.
+		 */
+		skb = skb_clone(skb, GFP_ATOMIC);
+		if (skb) {
+			skb_dst_drop(skb);
+			__skb_pull(skb, tcp_hdr(skb)->doff * 4);
+			skb_set_owner_r(skb, child);
+			__skb_queue_tail(&child->sk_receive_queue, skb);
+			tp->syn_data_acked = 1;
+			tp->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+		}
+	}
+	tp->rcv_wup = tp->rcv_nxt;
+	tcp_rsk(req)->rcv_nxt = tp->rcv_nxt;
+
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+}
+
+/* Server side: the SYN-ACK of the Fast Open child @sk got acked, or the
+ * child is going away.  Release its request and the listener.
+ */
+void tcp_fastopen_remove(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct request_sock *req = tp->fastopen_rsk;
+	struct sock *lsk = tcp_rsk(req)->listener;
+
+	tp->fastopen_rsk = NULL;
+	atomic_dec(&inet_csk(lsk)->icsk_accept_queue.fastopenq.qlen);
+	sock_put(lsk);
+	reqsk_free(req);
+}
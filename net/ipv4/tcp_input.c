@@ -358,7 +358,7 @@ static void tcp_fixup_rcvbuf(struct sock *sk)
 /* 4. Try to fixup all. It is made immediately after connection enters
  *    established state.
  */
-static void tcp_init_buffer_space(struct sock *sk)
+void tcp_init_buffer_space(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	int maxwin;
@@ -867,7 +867,7 @@ static void tcp_dsack_seen(struct tcp_sock *tp)
 
 /* Initialize metrics on socket. */
 
-static void tcp_init_metrics(struct sock *sk)
+void tcp_init_metrics(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct dst_entry *dst = __sk_dst_get(sk);
@@ -1246,6 +1246,7 @@ struct tcp_sacktag_state {
 	int reord;
 	int fack_count;
 	int flag;
+	struct rate_sample *rate;
 };
 
 /* Check if skb is fully within the SACK block. In presence of GSO skbs,
@@ -1357,6 +1358,7 @@ static u8 tcp_sacktag_one(struct sk_buff *skb, struct sock *sk,
 		sacked |= TCPCB_SACKED_ACKED;
 		state->flag |= FLAG_DATA_SACKED;
 		tp->sacked_out += pcount;
+		tp->delivered += pcount;  /* Out-of-order packets delivered */
 
 		fack_count += pcount;
 
@@ -1420,6 +1422,7 @@ static int tcp_shifted_skb(struct sock *sk, struct sk_buff *skb,
 
 	/* We discard results */
 	tcp_sacktag_one(skb, sk, state, dup_sack, pcount);
+	tcp_rate_skb_delivered(sk, skb, state->rate);
 
 	/* Difference in this won't matter, both ACKed by the same cumul. ACK */
 	TCP_SKB_CB(prev)->sacked |= (TCP_SKB_CB(skb)->sacked & TCPCB_EVER_RETRANS);
@@ -1662,6 +1665,7 @@ static struct sk_buff *tcp_sacktag_walk(struct sk_buff *skb, struct sock *sk,
 								  state,
 								  dup_sack,
 								  tcp_skb_pcount(skb));
+			tcp_rate_skb_delivered(sk, skb, state->rate);
 
 			if (!before(TCP_SKB_CB(skb)->seq,
 				    tcp_highest_sack_seq(tp)))
@@ -1718,7 +1722,7 @@ static int tcp_sack_cache_ok(struct tcp_sock *tp, struct tcp_sack_block *cache)
 
 static int
 tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb,
-			u32 prior_snd_una)
+			u32 prior_snd_una, struct rate_sample *rs)
 {
 	const struct inet_connection_sock *icsk = inet_csk(sk);
 	struct tcp_sock *tp = tcp_sk(sk);
@@ -1737,6 +1741,7 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb,
 
 	state.flag = 0;
 	state.reord = tp->packets_out;
+	state.rate = rs;
 
 	if (!tp->sacked_out) {
 		if (WARN_ON(tp->fackets_out))
@@ -3227,6 +3232,9 @@ static inline void tcp_ack_update_rtt(struct sock *sk, const int flag,
 static void tcp_cong_avoid(struct sock *sk, u32 ack, u32 in_flight)
 {
 	const struct inet_connection_sock *icsk = inet_csk(sk);
+
+	if (!icsk->icsk_ca_ops->cong_avoid)	/* cwnd set by cong_control */
+		return;
 	icsk->icsk_ca_ops->cong_avoid(sk, ack, in_flight);
 	tcp_sk(sk)->snd_cwnd_stamp = tcp_time_stamp;
 }
@@ -3272,7 +3280,7 @@ static u32 tcp_tso_acked(struct sock *sk, struct sk_buff *skb)
  * arrived at the other end.
  */
 static int tcp_clean_rtx_queue(struct sock *sk, int prior_fackets,
-			       u32 prior_snd_una)
+			       u32 prior_snd_una, struct rate_sample *rs)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	const struct inet_connection_sock *icsk = inet_csk(sk);
@@ -3286,6 +3294,7 @@ static int tcp_clean_rtx_queue(struct sock *sk, int prior_fackets,
 	s32 seq_rtt = -1;
 	s32 ca_seq_rtt = -1;
 	ktime_t last_ackt = net_invalid_timestamp();
+	u32 last_sent_us = 0;
 
 	while ((skb = tcp_write_queue_head(sk)) && skb != tcp_send_head(sk)) {
 		struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
@@ -3318,6 +3327,7 @@ static int tcp_clean_rtx_queue(struct sock *sk, int prior_fackets,
 		} else {
 			ca_seq_rtt = now - scb->when;
 			last_ackt = skb->tstamp;
+			last_sent_us = scb->tx.sent_us;
 			if (seq_rtt < 0) {
 				seq_rtt = ca_seq_rtt;
 			}
@@ -3333,6 +3343,10 @@ static int tcp_clean_rtx_queue(struct sock *sk, int prior_fackets,
 		tp->packets_out -= acked_pcount;
 		pkts_acked += acked_pcount;
 
+		if (!(sacked & TCPCB_SACKED_ACKED))
+			tp->delivered += acked_pcount;
+		tcp_rate_skb_delivered(sk, skb, rs);
+
 		/* Initial outgoing SYN's get put onto the write_queue
 		 * just like anything else we transmit.  It is not
 		 * true data, and if we misinform our callers that
@@ -3393,6 +3407,9 @@ static int tcp_clean_rtx_queue(struct sock *sk, int prior_fackets,
 
 		tp->fackets_out -= min(pkts_acked, tp->fackets_out);
 
+		if (ca_ops->cong_control && ca_seq_rtt >= 0)
+			rs->rtt_us = (s32)(tcp_clock_us() - last_sent_us);
+
 		if (ca_ops->pkts_acked) {
 			s32 rtt_us = -1;
 
@@ -3677,6 +3694,8 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 	int prior_sacked = tp->sacked_out;
 	int newly_acked_sacked = 0;
 	int frto_cwnd = 0;
+	u32 prior_delivered = tp->delivered;
+	struct rate_sample rs = { .prior_delivered = 0, .rtt_us = -1 };
 
 	/* If the ack is older than previous acks
 	 * then we can probably ignore it.
@@ -3704,6 +3723,7 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 
 	prior_fackets = tp->fackets_out;
 	prior_in_flight = tcp_packets_in_flight(tp);
+	rs.prior_in_flight = prior_in_flight;
 
 	if (!(flag & FLAG_SLOWPATH) && after(ack, prior_snd_una)) {
 		/* Window is constant, pure forward advance.
@@ -3726,7 +3746,8 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 		flag |= tcp_ack_update_window(sk, skb, ack, ack_seq);
 
 		if (TCP_SKB_CB(skb)->sacked)
-			flag |= tcp_sacktag_write_queue(sk, skb, prior_snd_una);
+			flag |= tcp_sacktag_write_queue(sk, skb, prior_snd_una,
+							&rs);
 
 		if (TCP_ECN_rcv_ecn_echo(tp, tcp_hdr(skb)))
 			flag |= FLAG_ECE;
@@ -3745,7 +3766,7 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 		goto no_queue;
 
 	/* See if we can take anything off of the retransmit queue. */
-	flag |= tcp_clean_rtx_queue(sk, prior_fackets, prior_snd_una);
+	flag |= tcp_clean_rtx_queue(sk, prior_fackets, prior_snd_una, &rs);
 
 	newly_acked_sacked = (prior_packets - prior_sacked) -
 			     (tp->packets_out - tp->sacked_out);
@@ -3768,6 +3789,11 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
 	}
 
+	if (icsk->icsk_ca_ops->cong_control) {
+		tcp_rate_gen(sk, tp->delivered - prior_delivered, &rs);
+		icsk->icsk_ca_ops->cong_control(sk, &rs);
+	}
+
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
 		dst_confirm(__sk_dst_get(sk));
 
@@ -3788,7 +3814,7 @@ invalid_ack:
 
 old_ack:
 	if (TCP_SKB_CB(skb)->sacked) {
-		tcp_sacktag_write_queue(sk, skb, prior_snd_una);
+		tcp_sacktag_write_queue(sk, skb, prior_snd_una, &rs);
 		if (icsk->icsk_ca_state == TCP_CA_Open)
 			tcp_try_keep_open(sk);
 	}
@@ -3802,7 +3828,7 @@ old_ack:
  * the fast version below fails.
  */
 void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
-		       u8 **hvpp, int estab)
+		       u8 **hvpp, int estab, struct tcp_fastopen_cookie *foc)
 {
 	unsigned char *ptr;
 	struct tcphdr *th = tcp_hdr(skb);
@@ -3910,6 +3936,27 @@ void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
 					break;
 				}
 				break;
+
+			case TCPOPT_EXP:
+				/* Fast Open option shares code 254 using a
+				 * 16 bits magic number.  Only the SYN of the
+				 * client and the SYN-ACK of the server carry
+				 * it, a zero length cookie is a request.
+				 */
+				if (opsize < TCPOLEN_EXP_FASTOPEN_BASE ||
+				    get_unaligned_be16(ptr) != TCPOPT_FASTOPEN_MAGIC ||
+				    foc == NULL || !th->syn || estab)
+					break;
+				opsize -= TCPOLEN_EXP_FASTOPEN_BASE;
+				if (opsize == 0 ||
+				    (opsize >= TCP_FASTOPEN_COOKIE_MIN &&
+				     opsize <= TCP_FASTOPEN_COOKIE_MAX &&
+				     !(opsize & 1))) {
+					foc->len = opsize;
+					memcpy(foc->val, ptr + 2, opsize);
+				}
+				opsize += TCPOLEN_EXP_FASTOPEN_BASE;
+				break;
 			}
 
 			ptr += opsize-2;
@@ -3952,7 +3999,7 @@ static int tcp_fast_parse_options(struct sk_buff *skb, struct tcphdr *th,
 		if (tcp_parse_aligned_timestamp(tp, th))
 			return 1;
 	}
-	tcp_parse_options(skb, &tp->rx_opt, hvpp, 1);
+	tcp_parse_options(skb, &tp->rx_opt, hvpp, 1, NULL);
 	return 1;
 }
 
@@ -5498,6 +5545,56 @@ discard:
 }
 EXPORT_SYMBOL(tcp_rcv_established);
 
+/* Client side of Fast Open: the SYN-ACK @synack arrived.  Cache the cookie
+ * and MSS of the server for later connections, and retransmit the data
+ * sent in the SYN if the server did not ack it.  Returns true when it
+ * did so, meaning the ACK of the SYN-ACK is already on its way.
+ */
+static bool tcp_rcv_fastopen_synack(struct sock *sk, struct sk_buff *synack,
+				    struct tcp_fastopen_cookie *cookie)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *data = tp->syn_data ? tcp_write_queue_head(sk) : NULL;
+	u16 mss = tp->rx_opt.mss_clamp;
+	bool syn_drop;
+
+	if (mss == tp->rx_opt.user_mss) {
+		struct tcp_options_received opt;
+		u8 *hash_location;
+
+		/* Get original SYNACK MSS value if user MSS sets mss_clamp */
+		tcp_clear_options(&opt);
+		opt.user_mss = opt.mss_clamp = 0;
+		tcp_parse_options(synack, &opt, &hash_location, 0, NULL);
+		mss = opt.mss_clamp;
+	}
+
+	if (!tp->syn_fastopen)  /* Ignore an unsolicited cookie */
+		cookie->len = -1;
+
+	/* The SYN-ACK neither has cookie nor acknowledges the data. Presumably
+	 * the remote receives only the retransmitted (regular) SYNs: either
+	 * the original SYN-data or the corresponding SYN-ACK is lost.
+	 */
+	syn_drop = (cookie->len <= 0 && data && data != tcp_send_head(sk) &&
+		    inet_csk(sk)->icsk_retransmits);
+
+	tcp_fastopen_cache_set(sk, mss, cookie, syn_drop);
+
+	if (data && data != tcp_send_head(sk)) {
+		/* Retransmit unacked data in SYN */
+		tcp_for_write_queue_from(data, sk) {
+			if (data == tcp_send_head(sk) ||
+			    tcp_retransmit_skb(sk, data))
+				break;
+		}
+		tcp_rearm_rto(sk);
+		return true;
+	}
+	tp->syn_data_acked = tp->syn_data;
+	return false;
+}
+
 static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 					 struct tcphdr *th, unsigned len)
 {
@@ -5505,9 +5602,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct tcp_cookie_values *cvp = tp->cookie_values;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 	int saved_clamp = tp->rx_opt.mss_clamp;
 
-	tcp_parse_options(skb, &tp->rx_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tp->rx_opt, &hash_location, 0, &foc);
 
 	if (th->ack) {
 		/* rfc793:
@@ -5518,10 +5616,11 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 		 *        a reset (unless the RST bit is set, if so drop
 		 *        the segment and return)"
 		 *
-		 *  We do not send data with SYN, so that RFC-correct
-		 *  test reduces to:
+		 *  With Fast Open the SYN may carry data, which the
+		 *  SYN-ACK need not ack.
 		 */
-		if (TCP_SKB_CB(skb)->ack_seq != tp->snd_nxt)
+		if (!after(TCP_SKB_CB(skb)->ack_seq, tp->snd_una) ||
+		    after(TCP_SKB_CB(skb)->ack_seq, tp->snd_nxt))
 			goto reset_and_undo;
 
 		if (tp->rx_opt.saw_tstamp && tp->rx_opt.rcv_tsecr &&
@@ -5661,6 +5760,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 			sk_wake_async(sk, SOCK_WAKE_IO, POLL_OUT);
 		}
 
+		if ((tp->syn_fastopen || tp->syn_data) &&
+		    tcp_rcv_fastopen_synack(sk, skb, &foc))
+			return -1;
+
 		if (sk->sk_write_pending ||
 		    icsk->icsk_accept_queue.rskq_defer_accept ||
 		    icsk->icsk_ack.pingpong) {
@@ -5780,6 +5883,7 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct request_sock *req = tp->fastopen_rsk;
 	int queued = 0;
 	int res;
 
@@ -5844,10 +5948,25 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 	if (th->ack) {
 		int acceptable = tcp_ack(sk, skb, FLAG_SLOWPATH) > 0;
 
+		/* A passive Fast Open socket got its SYN-ACK acked, possibly
+		 * after close() moved it to FIN_WAIT1: stop the SYN-ACK
+		 * timer and release the request.
+		 */
+		if (req != NULL) {
+			if (!acceptable)
+				return 1;
+			tcp_fastopen_remove(sk);
+			tcp_rearm_rto(sk);
+		}
+
 		switch (sk->sk_state) {
 		case TCP_SYN_RECV:
 			if (acceptable) {
-				tp->copied_seq = tp->rcv_nxt;
+				/* The Fast Open child has been readable since
+				 * tcp_fastopen_child_init().
+				 */
+				if (req == NULL)
+					tp->copied_seq = tp->rcv_nxt;
 				smp_mb();
 				tcp_set_state(sk, TCP_ESTABLISHED);
 				sk->sk_state_change(sk);
@@ -5869,23 +5988,26 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 				if (tp->rx_opt.tstamp_ok)
 					tp->advmss -= TCPOLEN_TSTAMP_ALIGNED;
 
-				/* Make sure socket is routed, for
-				 * correct metrics.
-				 */
-				icsk->icsk_af_ops->rebuild_header(sk);
+				if (req == NULL) {
+					/* Make sure socket is routed, for
+					 * correct metrics.
+					 */
+					icsk->icsk_af_ops->rebuild_header(sk);
 
-				tcp_init_metrics(sk);
+					tcp_init_metrics(sk);
 
-				tcp_init_congestion_control(sk);
+					tcp_init_congestion_control(sk);
 
-				/* Prevent spurious tcp_cwnd_restart() on
-				 * first data packet.
-				 */
-				tp->lsndtime = tcp_time_stamp;
+					/* Prevent spurious tcp_cwnd_restart()
+					 * on first data packet.
+					 */
+					tp->lsndtime = tcp_time_stamp;
 
-				tcp_mtup_init(sk);
+					tcp_mtup_init(sk);
+				}
 				tcp_initialize_rcv_mss(sk);
-				tcp_init_buffer_space(sk);
+				if (req == NULL)
+					tcp_init_buffer_space(sk);
 				tcp_fast_path_on(tp);
 			} else {
 				return 1;
@@ -73,6 +73,7 @@
 #include <net/xfrm.h>
 #include <net/netdma.h>
 #include <net/secure_seq.h>
+#include <net/busy_poll.h>
 
 #include <linux/inet.h>
 #include <linux/ipv6.h>
@@ -302,8 +303,18 @@ static void do_pmtu_discovery(struct sock *sk, const struct iphdr *iph, u32 mtu)
 	 * There is a small race when the user changes this flag in the
 	 * route, but I think that's acceptable.
 	 */
-	if ((dst = __sk_dst_check(sk, 0)) == NULL)
-		return;
+	dst = __sk_dst_check(sk, 0);
+	if (!dst) {
+		/* The new path MTU invalidated the route the socket shared
+		 * with its nexthop: route again, the destination gets a
+		 * route of its own that carries it.
+		 */
+		if (inet_sk_rebuild_header(sk))
+			return;
+		dst = __sk_dst_get(sk);
+		if (!dst)
+			return;
+	}
 
 	dst->ops->update_pmtu(dst, mtu);
 
@@ -1250,10 +1261,78 @@ static const struct tcp_request_sock_ops tcp_request_sock_ipv4_ops = {
 };
 #endif
 
+/*
+ *	Fast Open: create the child socket right away from a SYN carrying a
+ *	valid cookie, queue it for accept() with the data of the SYN, and
+ *	send a SYN-ACK acking that data.  The SYN-ACK is built before the
+ *	child, as building it picks the receive window the child inherits.
+ *	The child keeps @req until its SYN-ACK gets acked.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct request_values *rvp)
+{
+	struct inet_request_sock *ireq = inet_rsk(req);
+	struct ip_options_rcu *opt = ireq->opt;
+	struct request_sock *areq;
+	struct sk_buff *skb_synack;
+	struct dst_entry *dst;
+	struct flowi4 fl4;
+	struct sock *child;
+
+	areq = inet_reqsk_alloc(&tcp_request_sock_ops);
+	if (!areq)
+		return -1;
+
+	dst = inet_csk_route_req(sk, &fl4, req);
+	if (!dst)
+		goto free_areq;
+
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+	skb_synack = tcp_make_synack(sk, dst, req, rvp);
+	if (!skb_synack) {
+		dst_release(dst);
+		goto free_areq;
+	}
+	__tcp_v4_send_check(skb_synack, ireq->loc_addr, ireq->rmt_addr);
+
+	/* No RTT sample yet, the SYN-ACK has not even been sent.
+	 * syn_recv_sock() takes over dst and the IP options of @req.
+	 */
+	tcp_rsk(req)->snt_synack = 0;
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
+	if (child == NULL) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		kfree_skb(skb_synack);
+		goto free_areq;
+	}
+
+	/* A lost SYN-ACK is retransmitted by the child's timer */
+	ip_build_and_send_pkt(skb_synack, sk, ireq->loc_addr, ireq->rmt_addr,
+			      opt);
+
+	tcp_fastopen_child_init(sk, child, skb, req);
+
+	/* The child is accepted with a request of its own, @req stays
+	 * with the child for SYN-ACK retransmits.
+	 */
+	inet_csk_reqsk_queue_add(sk, areq, child);
+	sk->sk_data_ready(sk, 0);
+	bh_unlock_sock(child);
+	sock_put(child);
+	return 0;
+
+free_areq:
+	__reqsk_free(areq);
+	return -1;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_extend_values tmp_ext;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
+	struct tcp_fastopen_cookie valid_foc = { .len = -1 };
 	u8 *hash_location;
 	struct request_sock *req;
 	struct inet_request_sock *ireq;
@@ -1297,7 +1376,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0, &foc);
 
 	if (tmp_opt.cookie_plus > 0 &&
 	    tmp_opt.saw_tstamp &&
@@ -1404,6 +1483,18 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_rsk(req)->snt_isn = isn;
 	tcp_rsk(req)->snt_synack = tcp_time_stamp;
 
+	tmp_ext.fastopen_cookie = NULL;
+	if (!want_cookie &&
+	    tcp_fastopen_check(sk, saddr, daddr, &foc, &valid_foc)) {
+		dst_release(dst);
+		if (tcp_v4_conn_req_fastopen(sk, skb, req,
+					     (struct request_values *)&tmp_ext))
+			goto drop_and_free;
+		return 0;
+	}
+	if (valid_foc.len > 0)
+		tmp_ext.fastopen_cookie = &valid_foc;
+
 	if (tcp_v4_send_synack(sk, dst, req,
 			       (struct request_values *)&tmp_ext) ||
 	    want_cookie)
@@ -1710,6 +1801,7 @@ process:
 	if (sk_filter(sk, skb))
 		goto discard_and_relse;
 
+	sk_mark_napi_id(sk, skb);
 	skb->dev = NULL;
 
 	if (sk->sk_state == TCP_LISTEN) {
@@ -1779,6 +1871,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1805,7 +1898,7 @@ struct inet_peer *tcp_v4_get_peer(struct sock *sk, bool *release_it)
 	struct inet_sock *inet = inet_sk(sk);
 	struct inet_peer *peer;
 
-	if (!rt ||
+	if (!rt || (rt->dst.flags & DST_NOPEER) ||
 	    inet->cork.fl.u.ip4.daddr != inet->inet_daddr) {
 		peer = inet_getpeer_v4(inet->inet_daddr, 1);
 		*release_it = true;
@@ -2617,6 +2710,7 @@ struct proto tcp_prot = {
 	.sendmsg		= tcp_sendmsg,
 	.sendpage		= tcp_sendpage,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
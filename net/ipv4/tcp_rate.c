@@ -0,0 +1,151 @@
+/*
+ * TCP delivery rate sampling: estimate how fast data is delivered to the
+ * receiver, for congestion control modules with a cong_control hook.
+ *
+ * Each skb remembers, when it is (re)transmitted, how many packets had
+ * been delivered so far and when.  Once the skb is (S)ACKed, the packets
+ * delivered since then divided by the time elapsed give a rate sample:
+ *
+ *   send_rate = #pkts_delivered / (last_snd_time - first_snd_time)
+ *   ack_rate  = #pkts_delivered / (last_ack_time - first_ack_time)
+ *   bw = min(send_rate, ack_rate)
+ *
+ * The lower of the two rates is used, as ACKs can be compressed or
+ * stretched on the way back.  Samples taken while the sender did not
+ * have enough data to fill the pipe are marked application limited:
+ * they only tell that the bandwidth is at least that high.
+ *
+ * All timestamps are 32 bit microseconds from tcp_clock_us().
+ */
+
+#include <net/tcp.h>
+
+/* Snapshot the current delivery information in @skb, about to be
+ * (re)transmitted, to generate a rate sample once it is delivered.
+ */
+void tcp_rate_skb_sent(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+	u32 now = tcp_clock_us();
+
+	/* In general we need to start delivery rate samples from the
+	 * time we received the most recent ACK, to ensure we include
+	 * the full time the network needs to deliver all in-flight
+	 * packets.  If there are no packets in flight yet, then we
+	 * know that any ACKs after now indicate that the network was
+	 * able to deliver those packets completely in the sampling
+	 * interval between now and the next ACK.
+	 */
+	if (!tp->packets_out) {
+		tp->first_tx_mstamp = now;
+		tp->delivered_mstamp = now;
+	}
+
+	scb->tx.sent_us = now;
+	scb->tx.first_tx_mstamp = tp->first_tx_mstamp;
+	scb->tx.delivered_mstamp = tp->delivered_mstamp;
+	scb->tx.delivered = tp->delivered;
+	scb->tx.is_app_limited = tp->app_limited ? 1 : 0;
+}
+
+/* When an skb is sacked or acked, we fill in the rate sample with the
+ * (prior_delivered count, prior_mstamp) of the most recently sent skb
+ * among those delivered by this ACK.
+ */
+void tcp_rate_skb_delivered(struct sock *sk, struct sk_buff *skb,
+			    struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+
+	if (!scb->tx.delivered_mstamp)
+		return;
+
+	if (!rs->prior_delivered ||
+	    after(scb->tx.delivered, rs->prior_delivered)) {
+		rs->prior_delivered = scb->tx.delivered;
+		rs->prior_mstamp = scb->tx.delivered_mstamp;
+		rs->is_app_limited = scb->tx.is_app_limited;
+		rs->is_retrans = scb->sacked & TCPCB_RETRANS;
+
+		/* Find the duration of the "send phase" of this window */
+		rs->interval_us = (s32)(scb->tx.sent_us -
+					scb->tx.first_tx_mstamp);
+
+		/* Record send time of most recently ACKed packet */
+		tp->first_tx_mstamp = scb->tx.sent_us;
+	}
+	/* Mark off the skb delivered once it's sacked to avoid being
+	 * used again when it's cumulatively acked.  For acked packets
+	 * we don't need to reset since it'll be freed soon.
+	 */
+	if (scb->sacked & TCPCB_SACKED_ACKED)
+		scb->tx.delivered_mstamp = 0;
+}
+
+/* Update the connection delivery information and generate a rate sample,
+ * once an ACK newly (S)ACKed @delivered packets.
+ */
+void tcp_rate_gen(struct sock *sk, u32 delivered, struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 now = tcp_clock_us();
+	long snd_us, ack_us;
+
+	/* Clear app limited if bubble is acked and gone. */
+	if (tp->app_limited && after(tp->delivered, tp->app_limited))
+		tp->app_limited = 0;
+
+	if (delivered)
+		tp->delivered_mstamp = now;
+
+	rs->acked_sacked = delivered;	/* freshly ACKed or SACKed */
+	/* Return an invalid sample if no timing information is available. */
+	if (!rs->prior_mstamp) {
+		rs->delivered = -1;
+		rs->interval_us = -1;
+		return;
+	}
+	rs->delivered = tp->delivered - rs->prior_delivered;
+
+	/* Model sending data and receiving ACKs as separate pipeline phases
+	 * for a window.  Usually the ACK phase is longer, but with ACK
+	 * compression the send phase can be longer.  To be safe we use the
+	 * longer phase.
+	 */
+	snd_us = rs->interval_us;				/* send phase */
+	ack_us = (s32)(now - rs->prior_mstamp);			/* ack phase */
+	rs->interval_us = max(snd_us, ack_us);
+
+	if (unlikely(rs->interval_us <= 0)) {
+		rs->interval_us = -1;
+		return;
+	}
+
+	/* Record the last non-app-limited or the highest app-limited bw */
+	if (!rs->is_app_limited ||
+	    ((u64)rs->delivered * tp->rate_interval_us >=
+	     (u64)tp->rate_delivered * rs->interval_us)) {
+		tp->rate_delivered = rs->delivered;
+		tp->rate_interval_us = rs->interval_us;
+		tp->rate_app_limited = rs->is_app_limited;
+	}
+}
+
+/* If a gap is detected between sends, mark the socket application-limited. */
+void tcp_rate_check_app_limited(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (/* We have less than one packet to send. */
+	    tp->write_seq - tp->snd_nxt < tp->mss_cache &&
+	    /* Nothing in sending host's qdisc queues or NIC tx queue. */
+	    sk_wmem_alloc_get(sk) < sizeof(struct sk_buff) &&
+	    /* We are not limited by CWND. */
+	    tcp_packets_in_flight(tp) < tp->snd_cwnd &&
+	    /* All lost packets have been retransmitted. */
+	    tp->lost_out <= tp->retrans_out)
+		tp->app_limited =
+			(tp->delivered + tcp_packets_in_flight(tp)) ? : 1;
+}
@@ -70,6 +70,9 @@ void tcp_init_xmit_timers(struct sock *sk)
 {
 	inet_csk_init_xmit_timers(sk, &tcp_write_timer, &tcp_delack_timer,
 				  &tcp_keepalive_timer);
+	hrtimer_init(&tcp_sk(sk)->pacing_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_ABS_PINNED);
+	tcp_sk(sk)->pacing_timer.function = tcp_pace_kick;
 }
 EXPORT_SYMBOL(tcp_init_xmit_timers);
 
@@ -343,6 +346,31 @@ static void tcp_probe_timer(struct sock *sk)
 	}
 }
 
+/*
+ *	Timer for a passive Fast Open socket to retransmit its SYN-ACK.
+ *	The child socket exists already, so the SYN-ACK is retransmitted
+ *	here rather than from the listener's request queue.
+ */
+static void tcp_fastopen_synack_timer(struct sock *sk)
+{
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	/* one more retry than regular requests, the client sent data */
+	int max_retries = icsk->icsk_syn_retries ? :
+			  sysctl_tcp_synack_retries + 1;
+	struct request_sock *req = tcp_sk(sk)->fastopen_rsk;
+
+	req->rsk_ops->syn_ack_timeout(sk, req);
+
+	if (req->retrans >= max_retries) {
+		tcp_write_err(sk);
+		return;
+	}
+	req->rsk_ops->rtx_syn_ack(sk, req, NULL);
+	req->retrans++;
+	inet_csk_reset_xmit_timer(sk, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT << req->retrans, TCP_RTO_MAX);
+}
+
 /*
  *	The TCP retransmit timer.
  */
@@ -352,6 +380,11 @@ void tcp_retransmit_timer(struct sock *sk)
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
 
+	if (tp->fastopen_rsk) {
+		tcp_fastopen_synack_timer(sk);
+		return;
+	}
+
 	if (!tp->packets_out)
 		goto out;
 
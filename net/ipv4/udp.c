@@ -102,6 +102,8 @@
 #include <linux/seq_file.h>
 #include <net/net_namespace.h>
 #include <net/icmp.h>
+#include <net/busy_poll.h>
+#include <net/qtaguid.h>
 #include <net/route.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
@@ -136,6 +138,7 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	uid_t uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net) &&
@@ -144,6 +147,8 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (*saddr_comp)(sk, sk2)) {
 			if (bitmap)
 				__set_bit(udp_sk(sk2)->udp_port_hash >> log,
@@ -166,6 +171,7 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	uid_t uid = sock_i_uid(sk);
 	int res = 0;
 
 	spin_lock(&hslot2->lock);
@@ -176,6 +182,8 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (*saddr_comp)(sk, sk2)) {
 			res = 1;
 			break;
@@ -406,7 +414,8 @@ static struct sock *udp4_lib_lookup2(struct net *net,
 {
 	struct sock *sk, *result;
 	struct hlist_nulls_node *node;
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 begin:
 	result = NULL;
@@ -417,8 +426,18 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
-			if (score == SCORE2_MAX)
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			} else if (score == SCORE2_MAX)
 				goto exact_match;
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -444,6 +463,9 @@ exact_match:
 
 /* UDP is nearly always wildcards out the wazoo, it makes no sense to try
  * harder than this. -DaveM
+ *
+ * Sockets of a SO_REUSEPORT group tie on the score, one of them is
+ * picked from the hash of the 4-tuple, see __inet_lookup_listener().
  */
 static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 		__be16 sport, __be32 daddr, __be16 dport,
@@ -454,7 +476,8 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash2, slot2, slot = udp_hashfn(net, hnum, udptable->mask);
 	struct udp_hslot *hslot2, *hslot = &udptable->hash[slot];
-	int score, badness;
+	int score, badness, matches = 0, reuseport = 0;
+	u32 hash = 0;
 
 	rcu_read_lock();
 	if (hslot->count > 10) {
@@ -490,6 +513,17 @@ begin:
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -707,7 +741,8 @@ static void udp4_hwcsum(struct sk_buff *skb, __be32 src, __be32 dst)
 	}
 }
 
-static int udp_send_skb(struct sk_buff *skb, struct flowi4 *fl4)
+static int udp_send_skb(struct sk_buff *skb, struct flowi4 *fl4,
+			unsigned int gso_size)
 {
 	struct sock *sk = skb->sk;
 	struct inet_sock *inet = inet_sk(sk);
@@ -727,6 +762,22 @@ static int udp_send_skb(struct sk_buff *skb, struct flowi4 *fl4)
 	uh->len = htons(len);
 	uh->check = 0;
 
+	if (gso_size && len - sizeof(*uh) > gso_size) {	/* UDP_SEGMENT */
+		if (offset + sizeof(*uh) + gso_size > dst_mtu(skb_dst(skb)) ||
+		    is_udplite || sk->sk_no_check == UDP_CSUM_NOXMIT ||
+		    skb->ip_summed != CHECKSUM_PARTIAL ||
+		    skb_dst(skb)->header_len) {
+			kfree_skb(skb);
+			return -EINVAL;
+		}
+		skb_shinfo(skb)->gso_size = gso_size;
+		skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+		skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(len - sizeof(*uh),
+							 gso_size);
+		udp4_hwcsum(skb, fl4->saddr, fl4->daddr);
+		goto send;
+	}
+
 	if (is_udplite)  				 /*     UDP-Lite      */
 		csum = udplite_csum(skb);
 
@@ -778,7 +829,7 @@ static int udp_push_pending_frames(struct sock *sk)
 	if (!skb)
 		goto out;
 
-	err = udp_send_skb(skb, fl4);
+	err = udp_send_skb(skb, fl4, 0);
 
 out:
 	up->len = 0;
@@ -819,6 +870,7 @@ int udp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 
 	ipc.opt = NULL;
 	ipc.tx_flags = 0;
+	ipc.gso_size = 0;
 
 	getfrag = is_udplite ? udplite_getfrag : ip_generic_getfrag;
 
@@ -959,12 +1011,13 @@ back_from_confirm:
 
 	/* Lockless fast path for the non-corking case. */
 	if (!corkreq) {
+		ipc.gso_size = up->gso_size;
 		skb = ip_make_skb(sk, fl4, getfrag, msg->msg_iov, ulen,
 				  sizeof(struct udphdr), &ipc, &rt,
 				  msg->msg_flags);
 		err = PTR_ERR(skb);
 		if (skb && !IS_ERR(skb))
-			err = udp_send_skb(skb, fl4);
+			err = udp_send_skb(skb, fl4, ipc.gso_size);
 		goto out;
 	}
 
@@ -1002,6 +1055,8 @@ do_append_data:
 	release_sock(sk);
 
 out:
+	if (!err && rt)
+		qtaguid_sock_snd(sk, rt->dst.dev->ifindex, len);
 	ip_rt_put(rt);
 	if (free)
 		kfree(ipc.opt);
@@ -1235,10 +1290,17 @@ try_again:
 	}
 	if (inet->cmsg_flags)
 		ip_cmsg_recv(msg, skb);
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) {
+		int gso_size = skb_shinfo(skb)->gso_size;
+
+		put_cmsg(msg, SOL_UDP, UDP_GRO, sizeof(gso_size), &gso_size);
+	}
 
 	err = len;
 	if (flags & MSG_TRUNC)
 		err = ulen;
+	if (!(flags & MSG_PEEK))
+		qtaguid_sock_rcv(sk, skb->skb_iif, ulen);
 
 out_free:
 	skb_free_datagram_locked(sk, skb);
@@ -1355,8 +1417,10 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
 	int rc;
 
-	if (inet_sk(sk)->inet_daddr)
+	if (inet_sk(sk)->inet_daddr) {
 		sock_rps_save_rxhash(sk, skb->rxhash);
+		sk_mark_napi_id(sk, skb);
+	}
 
 	rc = ip_queue_rcv_skb(sk, skb);
 	if (rc < 0) {
@@ -1376,6 +1440,37 @@ static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 
 }
 
+/*
+ * GRO coalesces datagrams only for UDP_GRO sockets, but the train can
+ * still reach one that did not ask for it: a multicast peer, or a socket
+ * that just cleared the option.  Split it back into datagrams.
+ */
+static int udp_queue_rcv_segs(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff *segs, *next;
+
+	__skb_push(skb, skb->data - skb_mac_header(skb));
+	segs = skb_gso_segment(skb, NETIF_F_SG | NETIF_F_HW_CSUM);
+	if (IS_ERR_OR_NULL(segs)) {
+		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
+				 IS_UDPLITE(sk));
+		atomic_inc(&sk->sk_drops);
+		kfree_skb(skb);
+		return -1;
+	}
+	consume_skb(skb);
+
+	for (skb = segs; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		__skb_pull(skb, skb_transport_offset(skb));
+		/* No resubmission to another protocol from here */
+		if (udp_queue_rcv_skb(sk, skb) > 0)
+			kfree_skb(skb);
+	}
+	return 0;
+}
+
 /* returns:
  *  -1: error
  *   0: success
@@ -1390,6 +1485,10 @@ int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	int rc;
 	int is_udplite = IS_UDPLITE(sk);
 
+	if (unlikely(skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4 &&
+		     !up->gro_enabled))
+		return udp_queue_rcv_segs(sk, skb);
+
 	/*
 	 *	Charge it to the socket, dropping if the queue is full.
 	 */
@@ -1770,6 +1869,21 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		}
 		break;
 
+	/* Only IPv4 sockets segment and coalesce datagrams */
+	case UDP_SEGMENT:
+		if (sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		if (val < 0 || val > USHRT_MAX)
+			return -EINVAL;
+		up->gso_size = val;
+		break;
+
+	case UDP_GRO:
+		if (sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		up->gro_enabled = val ? 1 : 0;
+		break;
+
 	/*
 	 * 	UDP-Lite's partial checksum coverage (RFC 3828).
 	 */
@@ -1852,6 +1966,18 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->encap_type;
 		break;
 
+	case UDP_SEGMENT:
+		if (sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		val = up->gso_size;
+		break;
+
+	case UDP_GRO:
+		if (sk->sk_family != AF_INET)
+			return -ENOPROTOOPT;
+		val = up->gro_enabled;
+		break;
+
 	/* The following two cannot be changed on UDP sockets, the return is
 	 * always 0 (which corresponds to the full checksum coverage of UDP). */
 	case UDPLITE_SEND_CSCOV:
@@ -2244,6 +2370,52 @@ int udp4_ufo_send_check(struct sk_buff *skb)
 	return 0;
 }
 
+/* Split a UDP_SEGMENT datagram train into datagrams of gso_size payload,
+ * the last one possibly shorter.  Each gets its own length and checksum,
+ * the IP headers are fixed up by inet_gso_segment().
+ */
+static struct sk_buff *udp4_gso_segment(struct sk_buff *skb, u32 features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct udphdr *uh;
+	unsigned int mss;
+	unsigned int ulen;
+	unsigned int oldlen;
+	__be32 delta;
+
+	if (!pskb_may_pull(skb, sizeof(*uh)))
+		goto out;
+
+	mss = skb_shinfo(skb)->gso_size;
+	if (unlikely(skb->len <= sizeof(*uh) + mss))
+		goto out;
+
+	oldlen = (u16)~skb->len;
+	__skb_pull(skb, sizeof(*uh));
+
+	segs = skb_segment(skb, features);
+	if (IS_ERR(segs))
+		goto out;
+
+	skb = segs;
+	do {
+		uh = udp_hdr(skb);
+		ulen = skb_tail_pointer(skb) - skb_transport_header(skb) +
+		       skb->data_len;
+		delta = htonl(oldlen + ulen);
+
+		uh->len = htons(ulen);
+		uh->check = ~csum_fold((__force __wsum)((__force u32)uh->check +
+						       (__force u32)delta));
+		if (skb->ip_summed != CHECKSUM_PARTIAL)
+			uh->check = csum_fold(csum_partial(uh, sizeof(*uh),
+							   skb->csum)) ? :
+				    CSUM_MANGLED_0;
+	} while ((skb = skb->next));
+out:
+	return segs;
+}
+
 struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, u32 features)
 {
 	struct sk_buff *segs = ERR_PTR(-EINVAL);
@@ -2251,6 +2423,9 @@ struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb, u32 features)
 	int offset;
 	__wsum csum;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return udp4_gso_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -2286,3 +2461,118 @@ out:
 	return segs;
 }
 
+
+/* GRO for sockets with UDP_GRO set: datagrams of a flow as long as the
+ * first one are chained behind it.  A shorter one ends the train, a
+ * longer one starts a new one.
+ */
+static struct sk_buff **udp_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb,
+					struct udphdr *uh)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct udphdr *uh2;
+	unsigned int len;
+	unsigned int mss;
+
+	skb_gro_pull(skb, sizeof(*uh));
+	len = skb_gro_len(skb);
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = udp_hdr(p);
+		if (*(u32 *)&uh->source ^ *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		mss = skb_shinfo(p)->gso_size;
+		if (NAPI_GRO_CB(p)->flush || len > mss ||
+		    skb_gro_receive(head, skb) || len < mss)
+			pp = head;
+		break;
+	}
+
+	NAPI_GRO_CB(skb)->flush |= !len;
+
+	return pp;
+}
+
+struct sk_buff **udp4_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	const struct iphdr *iph;
+	struct sk_buff **pp = NULL;
+	struct udphdr *uh;
+	unsigned int hlen;
+	unsigned int off;
+	struct sock *sk;
+
+	off = skb_gro_offset(skb);
+	hlen = off + sizeof(*uh);
+	uh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!uh))
+			goto flush;
+	}
+
+	/* UDP_SEGMENT senders always fill in the checksum */
+	if (!uh->check || ntohs(uh->len) != skb_gro_len(skb))
+		goto flush;
+
+	iph = skb_gro_network_header(skb);
+
+	switch (skb->ip_summed) {
+	case CHECKSUM_COMPLETE:
+		if (!csum_tcpudp_magic(iph->saddr, iph->daddr,
+				       skb_gro_len(skb), IPPROTO_UDP,
+				       skb->csum)) {
+			skb->ip_summed = CHECKSUM_UNNECESSARY;
+			break;
+		}
+
+		/* fall through */
+	case CHECKSUM_NONE:
+		goto flush;
+	}
+
+	sk = __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			       iph->daddr, uh->dest, skb->dev->ifindex,
+			       &udp_table);
+	if (!sk)
+		goto flush;
+
+	if (udp_sk(sk)->gro_enabled)
+		pp = udp_gro_receive(head, skb, uh);
+	else
+		NAPI_GRO_CB(skb)->flush = 1;
+	sock_put(sk);
+
+	return pp;
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+int udp4_gro_complete(struct sk_buff *skb)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	struct udphdr *uh = udp_hdr(skb);
+	int len = skb->len - skb_transport_offset(skb);
+
+	uh->len = htons(len);
+	uh->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr, len,
+				       IPPROTO_UDP, 0);
+	skb->csum_start = skb_transport_header(skb) - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+
+	return 0;
+}
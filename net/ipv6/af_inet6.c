@@ -867,13 +867,6 @@ out:
 	return segs;
 }
 
-struct ipv6_gro_cb {
-	struct napi_gro_cb napi;
-	int proto;
-};
-
-#define IPV6_GRO_CB(skb) ((struct ipv6_gro_cb *)(skb)->cb)
-
 static struct sk_buff **ipv6_gro_receive(struct sk_buff **head,
 					 struct sk_buff *skb)
 {
@@ -897,6 +890,7 @@ static struct sk_buff **ipv6_gro_receive(struct sk_buff **head,
 			goto out;
 	}
 
+	NAPI_GRO_CB(skb)->network_offset = off;
 	skb_gro_pull(skb, sizeof(*iph));
 	skb_set_transport_header(skb, skb_gro_offset(skb));
 
@@ -916,13 +910,16 @@ static struct sk_buff **ipv6_gro_receive(struct sk_buff **head,
 		if (!ops || !ops->gro_receive)
 			goto out_unlock;
 
-		iph = ipv6_hdr(skb);
+		/* The extension headers are linear now */
+		iph = (struct ipv6hdr *)(skb->data + off);
+		NAPI_GRO_CB(skb)->frag0 = NULL;
+		NAPI_GRO_CB(skb)->frag0_len = 0;
 	}
 
-	IPV6_GRO_CB(skb)->proto = proto;
+	NAPI_GRO_CB(skb)->proto = proto;
 
 	flush--;
-	nlen = skb_network_header_len(skb);
+	nlen = skb_gro_offset(skb) - off;
 
 	for (p = *head; p; p = p->next) {
 		struct ipv6hdr *iph2;
@@ -930,11 +927,12 @@ static struct sk_buff **ipv6_gro_receive(struct sk_buff **head,
 		if (!NAPI_GRO_CB(p)->same_flow)
 			continue;
 
-		iph2 = ipv6_hdr(p);
+		iph2 = skb_gro_held_header(p, skb, off);
 
-		/* All fields must match except length. */
-		if (nlen != skb_network_header_len(p) ||
-		    memcmp(iph, iph2, offsetof(struct ipv6hdr, payload_len)) ||
+		/* All fields must match except length.  Equal extension
+		 * headers, their lengths included, have equal sizes.
+		 */
+		if (memcmp(iph, iph2, offsetof(struct ipv6hdr, payload_len)) ||
 		    memcmp(&iph->nexthdr, &iph2->nexthdr,
 			   nlen - offsetof(struct ipv6hdr, nexthdr))) {
 			NAPI_GRO_CB(p)->same_flow = 0;
@@ -947,7 +945,7 @@ static struct sk_buff **ipv6_gro_receive(struct sk_buff **head,
 	NAPI_GRO_CB(skb)->flush |= flush;
 
 	csum = skb->csum;
-	skb_postpull_rcsum(skb, iph, skb_network_header_len(skb));
+	skb_postpull_rcsum(skb, iph, nlen);
 
 	pp = ops->gro_receive(head, skb);
 
@@ -972,7 +970,7 @@ static int ipv6_gro_complete(struct sk_buff *skb)
 				 sizeof(*iph));
 
 	rcu_read_lock();
-	ops = rcu_dereference(inet6_protos[IPV6_GRO_CB(skb)->proto]);
+	ops = rcu_dereference(inet6_protos[NAPI_GRO_CB(skb)->proto]);
 	if (WARN_ON(!ops || !ops->gro_complete))
 		goto out_unlock;
 
@@ -15,14 +15,18 @@
 #define DEBUG
 
 #include <linux/file.h>
+#include <linux/hash.h>
 #include <linux/inetdevice.h>
 #include <linux/module.h>
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter/xt_qtaguid.h>
+#include <linux/percpu.h>
 #include <linux/ratelimit.h>
 #include <linux/skbuff.h>
 #include <linux/workqueue.h>
 #include <net/addrconf.h>
+#include <net/genetlink.h>
+#include <net/qtaguid.h>
 #include <net/sock.h>
 #include <net/tcp.h>
 #include <net/udp.h>
@@ -104,6 +108,20 @@ static bool qtu_proc_handling_passive;
 module_param_named(tag_tracking_passive, qtu_proc_handling_passive, bool,
 		   S_IRUGO | S_IWUSR);
 
+/*
+ * Setting sock_accounting to Y:
+ *  - TCP and UDP data of sockets that have a file is accounted by their
+ *    sendmsg()/recvmsg(), see qtaguid_sock_account().
+ *  - the iptables matches don't account the local TCP and UDP packets of
+ *    those sockets anymore, and skip the socket lookup on output when the
+ *    rule doesn't need it. Forwarded packets, and the ones of kernel or
+ *    orphaned sockets, or of no socket at all, are still accounted there.
+ * Only the payload is seen, so the headers are estimated, and packets
+ * without data (e.g. pure ACKs) are not accounted.
+ */
+static bool sock_accounting;
+module_param(sock_accounting, bool, S_IRUGO | S_IWUSR);
+
 #define QTU_DEV_NAME "xt_qtaguid"
 
 uint qtaguid_debug_mask = DEFAULT_DEBUG_MASK;
@@ -155,6 +173,10 @@ static struct proc_dir_entry *iface_stat_fmt_procfile;
  *   iface_stat_list_lock
  *     struct iface_stat->tag_stat_list_lock
  *
+ * qtaguid_genl_dump_stats()
+ *   iface_stat_list_lock
+ *     struct iface_stat->tag_stat_list_lock
+ *
  * qtudev_open()
  *   uid_tag_data_tree_lock
  *
@@ -185,18 +207,23 @@ static struct proc_dir_entry *iface_stat_fmt_procfile;
  *     iface_stat_list_lock
  *
  * qtaguid_mt()
+ *   iface_stat_update_from_skb()
+ *     rcu_read_lock_bh()
  *   account_for_uid()
  *     if_tag_stat_update()
- *       get_sock_stat()
- *         sock_tag_list_lock
- *       struct iface_stat->tag_stat_list_lock
- *         tag_stat_update()
- *           get_active_counter_set()
- *             tag_counter_set_list_lock
- *         tag_stat_update()
- *           get_active_counter_set()
- *             tag_counter_set_list_lock
+ *       rcu_read_lock_bh()
+ *         (iface_stat_list, sock->sk_qtaguid_tag, iface_stat->tag_stat_hash,
+ *          tag_counter_set_hash)
+ *         only when a new tag_stat is needed:
+ *         struct iface_stat->tag_stat_list_lock
  *
+ * qtaguid_sock_account()
+ *   if_tag_stat_update()
+ *     (same as above)
+ *
+ * The packet path takes no locks: the lists and hashes it looks things up
+ * in are RCU protected (entries are freed with call_rcu_bh()), and it
+ * only updates the counters of the cpu it runs on.
  *
  * qtaguid_ctrl_parse()
  *   ctrl_cmd_delete()
@@ -223,10 +250,13 @@ static struct proc_dir_entry *iface_stat_fmt_procfile;
 static LIST_HEAD(iface_stat_list);
 static DEFINE_SPINLOCK(iface_stat_list_lock);
 
+/* The packet path finds the sock_tags through sock->sk_qtaguid_tag */
 static struct rb_root sock_tag_tree = RB_ROOT;
 static DEFINE_SPINLOCK(sock_tag_list_lock);
 
 static struct rb_root tag_counter_set_tree = RB_ROOT;
+/* Same entries as tag_counter_set_tree, for the packet path */
+static struct hlist_head tag_counter_set_hash[1 << TAG_COUNTER_SET_HASH_BITS];
 static DEFINE_SPINLOCK(tag_counter_set_list_lock);
 
 static struct rb_root uid_tag_data_tree = RB_ROOT;
@@ -236,6 +266,16 @@ static struct rb_root proc_qtu_data_tree = RB_ROOT;
 /* No proc_qtu_data_tree_lock; use uid_tag_data_tree_lock */
 
 static struct qtaguid_event_counts qtu_events;
+
+/*
+ * Every stats dump starts a new seq. The packet path stamps the tag_stats
+ * it updates with the current one, so a dump only needs to return the
+ * tag_stats stamped at or after the seq the reader got last time.
+ * stats_delete_seq is the seq of the last tag_stat deletion: readers that
+ * are older than it need a full dump to notice the missing rows.
+ */
+static atomic_long_t stats_seq = ATOMIC_LONG_INIT(1);
+static unsigned long stats_delete_seq;
 /*----------------------------------------------*/
 static bool can_manipulate_uids(void)
 {
@@ -269,6 +309,153 @@ static inline void dc_add_byte_packets(struct data_counters *counters, int set,
 	counters->bpc[set][direction][ifs_proto].packets += packets;
 }
 
+/*
+ * Percpu counters for new tag stats and ifaces, which get created with
+ * spinlocks held. Refilled from process context once half of it is used.
+ */
+#define DC_POOL_SIZE 32
+static struct data_counters_cpu __percpu *dc_pool[DC_POOL_SIZE];
+static int dc_pool_count;
+static DEFINE_SPINLOCK(dc_pool_lock);
+
+static void dc_pool_fill(struct work_struct *work)
+{
+	struct data_counters_cpu __percpu *dcc;
+
+	spin_lock_bh(&dc_pool_lock);
+	while (dc_pool_count < DC_POOL_SIZE) {
+		spin_unlock_bh(&dc_pool_lock);
+		dcc = alloc_percpu(struct data_counters_cpu);
+		if (!dcc) {
+			pr_err("qtaguid: counters pool refill failed\n");
+			return;
+		}
+		spin_lock_bh(&dc_pool_lock);
+		if (dc_pool_count < DC_POOL_SIZE)
+			dc_pool[dc_pool_count++] = dcc;
+		else
+			free_percpu(dcc);
+	}
+	spin_unlock_bh(&dc_pool_lock);
+}
+
+static DECLARE_WORK(dc_pool_work, dc_pool_fill);
+
+static struct data_counters_cpu __percpu *data_counters_cpu_alloc(void)
+{
+	struct data_counters_cpu __percpu *dcc = NULL;
+
+	spin_lock_bh(&dc_pool_lock);
+	if (dc_pool_count)
+		dcc = dc_pool[--dc_pool_count];
+	if (dc_pool_count < DC_POOL_SIZE / 2)
+		schedule_work(&dc_pool_work);
+	spin_unlock_bh(&dc_pool_lock);
+	return dcc;
+}
+
+/* Sum up the per cpu counters into res */
+void data_counters_fold(struct data_counters *res,
+			const struct data_counters_cpu __percpu *dcc)
+{
+	struct data_counters snap;
+	uint64_t *src, *dst;
+	unsigned int start;
+	int cpu, i;
+
+	memset(res, 0, sizeof(*res));
+	for_each_possible_cpu(cpu) {
+		const struct data_counters_cpu *c = per_cpu_ptr(dcc, cpu);
+
+		do {
+			start = u64_stats_fetch_begin(&c->syncp);
+			snap = c->dc;
+		} while (u64_stats_fetch_retry(&c->syncp, start));
+
+		src = (uint64_t *)&snap;
+		dst = (uint64_t *)res;
+		for (i = 0; i < sizeof(snap) / sizeof(*src); i++)
+			dst[i] += src[i];
+	}
+}
+
+static inline struct hlist_head *tag_stat_head(struct iface_stat *iface_entry,
+					       tag_t tag)
+{
+	return &iface_entry->tag_stat_hash[hash_64(tag, TAG_STAT_HASH_BITS)];
+}
+
+/* Caller must hold rcu_read_lock_bh() or the tag_stat_list_lock */
+static struct tag_stat *tag_stat_hash_search(struct iface_stat *iface_entry,
+					     tag_t tag)
+{
+	struct tag_stat *ts_entry;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu(ts_entry, pos,
+				 tag_stat_head(iface_entry, tag), hash_node)
+		if (ts_entry->tn.tag == tag)
+			return ts_entry;
+	return NULL;
+}
+
+static void tag_stat_free_rcu(struct rcu_head *head)
+{
+	struct tag_stat *ts_entry = container_of(head, struct tag_stat, rcu);
+
+	free_percpu(ts_entry->counters);
+	kfree(ts_entry);
+}
+
+static inline struct hlist_head *tag_counter_set_head(tag_t tag)
+{
+	return &tag_counter_set_hash[hash_64(tag, TAG_COUNTER_SET_HASH_BITS)];
+}
+
+static void tag_counter_set_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct tag_counter_set, rcu));
+}
+
+/*
+ * The sock_tag holds a ref on the socket, so its sk is valid until the
+ * sock_tag is unpublished.
+ * sock_tag_list_lock should be held.
+ */
+static void sock_tag_publish(struct sock_tag *st_entry)
+{
+	rcu_assign_pointer(st_entry->sk->sk_qtaguid_tag, st_entry);
+}
+
+static void sock_tag_unpublish(struct sock_tag *st_entry)
+{
+	RCU_INIT_POINTER(st_entry->sk->sk_qtaguid_tag, NULL);
+}
+
+/*
+ * Get the tag of a tagged socket.
+ * Caller must hold rcu_read_lock_bh().
+ */
+static bool sock_tag_get_tag(const struct sock *sk, tag_t *tag)
+{
+	struct sock_tag *st_entry;
+	unsigned int start;
+
+	st_entry = rcu_dereference_bh(sk->sk_qtaguid_tag);
+	if (!st_entry)
+		return false;
+	do {
+		start = u64_stats_fetch_begin(&st_entry->syncp);
+		*tag = st_entry->tag;
+	} while (u64_stats_fetch_retry(&st_entry->syncp, start));
+	return true;
+}
+
+static void sock_tag_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct sock_tag, rcu));
+}
+
 static struct tag_node *tag_node_tree_search(struct rb_root *root, tag_t tag)
 {
 	struct rb_node *node = root->rb_node;
@@ -417,7 +604,7 @@ static void sock_tag_tree_erase(struct rb_root *st_to_free_tree)
 			 get_uid_from_tag(st_entry->tag));
 		rb_erase(&st_entry->sock_node, st_to_free_tree);
 		sockfd_put(st_entry->socket);
-		kfree(st_entry);
+		call_rcu_bh(&st_entry->rcu, sock_tag_free_rcu);
 	}
 }
 
@@ -726,27 +913,32 @@ static int read_proc_bool(char *page, char **start, off_t off,
 	return len;
 }
 
+/* Caller must hold rcu_read_lock_bh() */
 static int get_active_counter_set(tag_t tag)
 {
 	int active_set = 0;
 	struct tag_counter_set *tcs;
+	struct hlist_node *pos;
 
 	MT_DEBUG("qtaguid: get_active_counter_set(tag=0x%llx)"
 		 " (uid=%u)\n",
 		 tag, get_uid_from_tag(tag));
 	/* For now we only handle UID tags for active sets */
 	tag = get_utag_from_tag(tag);
-	spin_lock_bh(&tag_counter_set_list_lock);
-	tcs = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
-	if (tcs)
-		active_set = tcs->active_set;
-	spin_unlock_bh(&tag_counter_set_list_lock);
+	hlist_for_each_entry_rcu(tcs, pos, tag_counter_set_head(tag),
+				 hash_node) {
+		if (tcs->tn.tag == tag) {
+			active_set = ACCESS_ONCE(tcs->active_set);
+			break;
+		}
+	}
 	return active_set;
 }
 
 /*
  * Find the entry for tracking the specified interface.
- * Caller must hold iface_stat_list_lock
+ * Caller must hold iface_stat_list_lock or rcu_read_lock_bh().
+ * Entries are never removed from the list.
  */
 static struct iface_stat *get_iface_entry(const char *ifname)
 {
@@ -759,7 +951,7 @@ static struct iface_stat *get_iface_entry(const char *ifname)
 	}
 
 	/* Iterate over interfaces */
-	list_for_each_entry(iface_entry, &iface_stat_list, list) {
+	list_for_each_entry_rcu(iface_entry, &iface_stat_list, list) {
 		if (!strcmp(ifname, iface_entry->ifname))
 			goto done;
 	}
@@ -786,9 +978,9 @@ static int pp_iface_stat_line(bool header, char *outp,
 			       "tx_other_bytes tx_other_packets\n"
 			);
 	} else {
-		struct data_counters *cnts;
+		struct data_counters dc, *cnts = &dc;
 		int cnt_set = 0;   /* We only use one set for the device */
-		cnts = &iface_entry->totals_via_skb;
+		data_counters_fold(cnts, iface_entry->totals_via_skb);
 		len = snprintf(
 			outp, char_count,
 			"%s "
@@ -989,6 +1181,14 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		kfree(new_iface);
 		return NULL;
 	}
+	new_iface->totals_via_skb = data_counters_cpu_alloc();
+	if (!new_iface->totals_via_skb) {
+		pr_err("qtaguid: iface_stat: create(%s): "
+		       "counters alloc failed\n", net_dev->name);
+		kfree(new_iface->ifname);
+		kfree(new_iface);
+		return NULL;
+	}
 	spin_lock_init(&new_iface->tag_stat_list_lock);
 	new_iface->tag_stat_tree = RB_ROOT;
 	_iface_stat_set_active(new_iface, net_dev, true);
@@ -1002,6 +1202,7 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		pr_err("qtaguid: iface_stat: create(%s): "
 		       "work alloc failed\n", new_iface->ifname);
 		_iface_stat_set_active(new_iface, net_dev, false);
+		free_percpu(new_iface->totals_via_skb);
 		kfree(new_iface->ifname);
 		kfree(new_iface);
 		return NULL;
@@ -1009,7 +1210,7 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 	isw->iface_entry = new_iface;
 	INIT_WORK(&isw->iface_work, iface_create_proc_worker);
 	schedule_work(&isw->iface_work);
-	list_add(&new_iface->list, &iface_stat_list);
+	list_add_rcu(&new_iface->list, &iface_stat_list);
 	return new_iface;
 }
 
@@ -1184,6 +1385,7 @@ done_put:
 	in_dev_put(in_dev);
 }
 
+/* Caller must hold sock_tag_list_lock */
 static struct sock_tag *get_sock_stat_nl(const struct sock *sk)
 {
 	MT_DEBUG("qtaguid: get_sock_stat_nl(sk=%p)\n", sk);
@@ -1213,23 +1415,38 @@ static int ipx_proto(const struct sk_buff *skb,
 
 static void
 data_counters_update(struct data_counters *dc, int set,
-		     enum ifs_tx_rx direction, int proto, int bytes)
+		     enum ifs_tx_rx direction, int proto, int bytes,
+		     int packets)
 {
 	switch (proto) {
 	case IPPROTO_TCP:
-		dc_add_byte_packets(dc, set, direction, IFS_TCP, bytes, 1);
+		dc_add_byte_packets(dc, set, direction, IFS_TCP, bytes,
+				    packets);
 		break;
 	case IPPROTO_UDP:
-		dc_add_byte_packets(dc, set, direction, IFS_UDP, bytes, 1);
+		dc_add_byte_packets(dc, set, direction, IFS_UDP, bytes,
+				    packets);
 		break;
 	case IPPROTO_IP:
 	default:
 		dc_add_byte_packets(dc, set, direction, IFS_PROTO_OTHER, bytes,
-				    1);
+				    packets);
 		break;
 	}
 }
 
+/* Caller must have BHs disabled */
+static void
+data_counters_cpu_update(struct data_counters_cpu __percpu *dcc, int set,
+			 enum ifs_tx_rx direction, int proto, int bytes,
+			 int packets)
+{
+	dcc = this_cpu_ptr(dcc);
+	u64_stats_update_begin(&dcc->syncp);
+	data_counters_update(&dcc->dc, set, direction, proto, bytes, packets);
+	u64_stats_update_end(&dcc->syncp);
+}
+
 /*
  * Update stats for the specified interface. Do nothing if the entry
  * does not exist (when a device was never configured with an IP address).
@@ -1338,37 +1555,55 @@ static void iface_stat_update_from_skb(const struct sk_buff *skb,
 		 par->hooknum, __func__, el_dev->name, el_dev->type,
 		 par->family, proto, direction);
 
-	spin_lock_bh(&iface_stat_list_lock);
+	rcu_read_lock_bh();
 	entry = get_iface_entry(el_dev->name);
 	if (entry == NULL) {
 		IF_DEBUG("qtaguid[%d]: iface_stat: %s(%s): not tracked\n",
 			 par->hooknum, __func__, el_dev->name);
-		spin_unlock_bh(&iface_stat_list_lock);
+		rcu_read_unlock_bh();
 		return;
 	}
 
 	IF_DEBUG("qtaguid[%d]: %s(%s): entry=%p\n", par->hooknum,  __func__,
 		 el_dev->name, entry);
 
-	data_counters_update(&entry->totals_via_skb, 0, direction, proto,
-			     bytes);
-	spin_unlock_bh(&iface_stat_list_lock);
+	data_counters_cpu_update(entry->totals_via_skb, 0, direction, proto,
+				 bytes, 1);
+	rcu_read_unlock_bh();
+}
+
+/*
+ * Only write the seq once per dump period, so the tag_stat cache line is
+ * not dirtied for every packet.
+ */
+static inline void tag_stat_touch(struct tag_stat *tag_entry)
+{
+	unsigned long seq = atomic_long_read(&stats_seq);
+
+	if (ACCESS_ONCE(tag_entry->seq) != seq)
+		ACCESS_ONCE(tag_entry->seq) = seq;
 }
 
+/* Caller must hold rcu_read_lock_bh() */
 static void tag_stat_update(struct tag_stat *tag_entry,
-			enum ifs_tx_rx direction, int proto, int bytes)
+			enum ifs_tx_rx direction, int proto, int bytes,
+			int packets)
 {
 	int active_set;
 	active_set = get_active_counter_set(tag_entry->tn.tag);
 	MT_DEBUG("qtaguid: tag_stat_update(tag=0x%llx (uid=%u) set=%d "
-		 "dir=%d proto=%d bytes=%d)\n",
+		 "dir=%d proto=%d bytes=%d packets=%d)\n",
 		 tag_entry->tn.tag, get_uid_from_tag(tag_entry->tn.tag),
-		 active_set, direction, proto, bytes);
-	data_counters_update(&tag_entry->counters, active_set, direction,
-			     proto, bytes);
-	if (tag_entry->parent_counters)
-		data_counters_update(tag_entry->parent_counters, active_set,
-				     direction, proto, bytes);
+		 active_set, direction, proto, bytes, packets);
+	data_counters_cpu_update(tag_entry->counters, active_set, direction,
+				 proto, bytes, packets);
+	tag_stat_touch(tag_entry);
+	if (tag_entry->parent) {
+		data_counters_cpu_update(tag_entry->parent->counters,
+					 active_set, direction, proto, bytes,
+					 packets);
+		tag_stat_touch(tag_entry->parent);
+	}
 }
 
 /*
@@ -1388,33 +1623,51 @@ static struct tag_stat *create_if_tag_stat(struct iface_stat *iface_entry,
 		pr_err("qtaguid: iface_stat: tag stat alloc failed\n");
 		goto done;
 	}
+	new_tag_stat_entry->counters = data_counters_cpu_alloc();
+	if (!new_tag_stat_entry->counters) {
+		pr_err("qtaguid: iface_stat: tag stat alloc failed\n");
+		kfree(new_tag_stat_entry);
+		new_tag_stat_entry = NULL;
+		goto done;
+	}
 	new_tag_stat_entry->tn.tag = tag;
+	new_tag_stat_entry->seq = atomic_long_read(&stats_seq);
 	tag_stat_tree_insert(new_tag_stat_entry, &iface_entry->tag_stat_tree);
 done:
 	return new_tag_stat_entry;
 }
 
+/*
+ * Make a new entry visible to the packet path, once it is fully set up.
+ * iface_entry->tag_stat_list_lock should be held.
+ */
+static void publish_if_tag_stat(struct iface_stat *iface_entry,
+				struct tag_stat *ts_entry)
+{
+	hlist_add_head_rcu(&ts_entry->hash_node,
+			   tag_stat_head(iface_entry, ts_entry->tn.tag));
+}
+
 static void if_tag_stat_update(const char *ifname, uid_t uid,
 			       const struct sock *sk, enum ifs_tx_rx direction,
-			       int proto, int bytes)
+			       int proto, int bytes, int packets)
 {
 	struct tag_stat *tag_stat_entry;
 	tag_t tag, acct_tag;
 	tag_t uid_tag;
-	struct data_counters *uid_tag_counters;
-	struct sock_tag *sock_tag_entry;
+	struct tag_stat *uid_tag_stat;
 	struct iface_stat *iface_entry;
 	struct tag_stat *new_tag_stat = NULL;
 	MT_DEBUG("qtaguid: if_tag_stat_update(ifname=%s "
-		"uid=%u sk=%p dir=%d proto=%d bytes=%d)\n",
-		 ifname, uid, sk, direction, proto, bytes);
-
+		"uid=%u sk=%p dir=%d proto=%d bytes=%d packets=%d)\n",
+		 ifname, uid, sk, direction, proto, bytes, packets);
 
+	rcu_read_lock_bh();
 	iface_entry = get_iface_entry(ifname);
 	if (!iface_entry) {
 		pr_err_ratelimited("qtaguid: tag_stat: stat_update() "
 				   "%s not found\n", ifname);
-		return;
+		goto unlock_rcu;
 	}
 	/* It is ok to process data when an iface_entry is inactive */
 
@@ -1425,35 +1678,35 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 	 * Look for a tagged sock.
 	 * It will have an acct_uid.
 	 */
-	spin_lock_bh(&sock_tag_list_lock);
-	sock_tag_entry = sk ? get_sock_stat_nl(sk) : NULL;
-	if (sock_tag_entry) {
-		tag = sock_tag_entry->tag;
-		acct_tag = get_atag_from_tag(tag);
-		uid_tag = get_utag_from_tag(tag);
-	}
-	spin_unlock_bh(&sock_tag_list_lock);
-	if (!sock_tag_entry) {
-		acct_tag = make_atag_from_value(0);
-		tag = combine_atag_with_uid(acct_tag, uid);
-		uid_tag = make_tag_from_uid(uid);
-	}
+	if (!sk || !sock_tag_get_tag(sk, &tag))
+		tag = combine_atag_with_uid(make_atag_from_value(0), uid);
+	acct_tag = get_atag_from_tag(tag);
+	uid_tag = get_utag_from_tag(tag);
 	MT_DEBUG("qtaguid: tag_stat: stat_update(): "
 		 " looking for tag=0x%llx (uid=%u) in ife=%p\n",
 		 tag, get_uid_from_tag(tag), iface_entry);
-	/* Loop over tag list under this interface for {acct_tag,uid_tag} */
-	spin_lock_bh(&iface_entry->tag_stat_list_lock);
 
-	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
-					      tag);
+	tag_stat_entry = tag_stat_hash_search(iface_entry, tag);
 	if (tag_stat_entry) {
 		/*
 		 * Updating the {acct_tag, uid_tag} entry handles both stats:
 		 * {0, uid_tag} will also get updated.
 		 */
-		tag_stat_update(tag_stat_entry, direction, proto, bytes);
-		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
-		return;
+		tag_stat_update(tag_stat_entry, direction, proto, bytes,
+				packets);
+		goto unlock_rcu;
+	}
+
+	/* The entry has to be created, which is only done under the lock */
+	spin_lock_bh(&iface_entry->tag_stat_list_lock);
+
+	/* Someone might have beaten us to it */
+	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
+					      tag);
+	if (tag_stat_entry) {
+		tag_stat_update(tag_stat_entry, direction, proto, bytes,
+				packets);
+		goto unlock;
 	}
 
 	/* Loop over tag list under this interface for {0,uid_tag} */
@@ -1468,9 +1721,10 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		new_tag_stat = create_if_tag_stat(iface_entry, uid_tag);
 		if (!new_tag_stat)
 			goto unlock;
-		uid_tag_counters = &new_tag_stat->counters;
+		publish_if_tag_stat(iface_entry, new_tag_stat);
+		uid_tag_stat = new_tag_stat;
 	} else {
-		uid_tag_counters = &tag_stat_entry->counters;
+		uid_tag_stat = tag_stat_entry;
 	}
 
 	if (acct_tag) {
@@ -1478,7 +1732,8 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		new_tag_stat = create_if_tag_stat(iface_entry, tag);
 		if (!new_tag_stat)
 			goto unlock;
-		new_tag_stat->parent_counters = uid_tag_counters;
+		new_tag_stat->parent = uid_tag_stat;
+		publish_if_tag_stat(iface_entry, new_tag_stat);
 	} else {
 		/*
 		 * For new_tag_stat to be still NULL here would require:
@@ -1490,9 +1745,11 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		 */
 		BUG_ON(!new_tag_stat);
 	}
-	tag_stat_update(new_tag_stat, direction, proto, bytes);
+	tag_stat_update(new_tag_stat, direction, proto, bytes, packets);
 unlock:
 	spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+unlock_rcu:
+	rcu_read_unlock_bh();
 }
 
 static int iface_netdev_event_handler(struct notifier_block *nb,
@@ -1598,6 +1855,8 @@ static int __init iface_stat_init(struct proc_dir_entry *parent_procdir)
 {
 	int err;
 
+	dc_pool_fill(NULL);
+
 	iface_stat_procdir = proc_mkdir(iface_stat_procdirname, parent_procdir);
 	if (!iface_stat_procdir) {
 		pr_err("qtaguid: iface_stat: init failed to create proc entry\n");
@@ -1725,14 +1984,86 @@ static void account_for_uid(const struct sk_buff *skb,
 	if_tag_stat_update(el_dev->name, uid,
 			   skb->sk ? skb->sk : alternate_sk,
 			   direction,
-			   proto, skb->len);
+			   proto, skb->len, 1);
 }
 
+/*
+ * Called from process context, after the data was copied.
+ * The ifindex is 0 when the protocol doesn't know it, the socket's route
+ * is then used.
+ */
+static void qtaguid_sock_account(struct sock *sk, int ifindex,
+				 enum ifs_tx_rx direction, int bytes)
+{
+	struct dst_entry *dst = NULL;
+	const struct net_device *dev;
+	const struct file *filp;
+	int packets, hdr_len, mss;
+	uid_t uid;
+
+	if (!sock_accounting || unlikely(module_passive) || bytes <= 0)
+		return;
+
+	/* The match accounts the sockets without a file */
+	filp = sk->sk_socket ? sk->sk_socket->file : NULL;
+	if (!filp)
+		return;
+	uid = filp->f_cred->fsuid;
+
+	switch (sk->sk_protocol) {
+	case IPPROTO_TCP:
+		mss = tcp_sk(sk)->mss_cache;
+		packets = mss ? DIV_ROUND_UP(bytes, mss) : 1;
+		hdr_len = tcp_sk(sk)->tcp_header_len;
+		break;
+	case IPPROTO_UDP:
+		packets = 1;
+		hdr_len = sizeof(struct udphdr);
+		break;
+	default:
+		packets = 1;
+		hdr_len = 0;
+		break;
+	}
+	hdr_len += sk->sk_family == AF_INET6 ?
+		sizeof(struct ipv6hdr) : sizeof(struct iphdr);
+
+	rcu_read_lock();
+	if (ifindex) {
+		dev = dev_get_by_index_rcu(sock_net(sk), ifindex);
+	} else {
+		dst = sk_dst_get(sk);
+		dev = dst ? dst->dev : NULL;
+	}
+	MT_DEBUG("qtaguid: sock_account(sk=%p dev=%s dir=%d proto=%d "
+		 "bytes=%d packets=%d)\n", sk, dev ? dev->name : "none",
+		 direction, sk->sk_protocol, bytes, packets);
+	if (dev)
+		if_tag_stat_update(dev->name, uid, sk, direction,
+				   sk->sk_protocol, bytes + packets * hdr_len,
+				   packets);
+	rcu_read_unlock();
+	dst_release(dst);
+}
+
+void qtaguid_sock_snd(struct sock *sk, int ifindex, int bytes)
+{
+	qtaguid_sock_account(sk, ifindex, IFS_TX, bytes);
+}
+EXPORT_SYMBOL(qtaguid_sock_snd);
+
+void qtaguid_sock_rcv(struct sock *sk, int ifindex, int bytes)
+{
+	qtaguid_sock_account(sk, ifindex, IFS_RX, bytes);
+}
+EXPORT_SYMBOL(qtaguid_sock_rcv);
+
 static bool qtaguid_mt(const struct sk_buff *skb, struct xt_action_param *par)
 {
 	const struct xt_qtaguid_match_info *info = par->matchinfo;
 	const struct file *filp;
 	bool got_sock = false;
+	bool sock_acct = false;
 	struct sock *sk;
 	uid_t sock_uid;
 	bool res;
@@ -1769,6 +2100,22 @@ static bool qtaguid_mt(const struct sk_buff *skb, struct xt_action_param *par)
 	/* default: Fall through and do UID releated work */
 	}
 
+	if (do_tag_stat && sock_accounting &&
+	    (par->hooknum == NF_INET_LOCAL_IN ||
+	     par->hooknum == NF_INET_LOCAL_OUT)) {
+		int proto = ipx_proto(skb, par);
+
+		/* Sockets with a file account these by themselves */
+		sock_acct = proto == IPPROTO_TCP || proto == IPPROTO_UDP;
+		sk = skb->sk;
+		if (sock_acct && !info->match && sk &&
+		    sk->sk_state != TCP_TIME_WAIT &&
+		    sk->sk_socket && sk->sk_socket->file) {
+			res = (info->match ^ info->invert) == 0;
+			goto ret_res;
+		}
+	}
+
 	sk = skb->sk;
 	if (sk == NULL) {
 		/*
@@ -1828,7 +2175,7 @@ static bool qtaguid_mt(const struct sk_buff *skb, struct xt_action_param *par)
 		goto put_sock_ret_res;
 	}
 	sock_uid = filp->f_cred->fsuid;
-	if (do_tag_stat)
+	if (do_tag_stat && !sock_acct)
 		account_for_uid(skb, sk, sock_uid, par);
 
 	/*
@@ -2085,6 +2432,7 @@ static int ctrl_cmd_delete(const char *input)
 
 		if (!acct_tag || st_entry->tag == tag) {
 			rb_erase(&st_entry->sock_node, &sock_tag_tree);
+			sock_tag_unpublish(st_entry);
 			/* Can't sockfd_put() within spinlock, do it later. */
 			sock_tag_tree_insert(st_entry, &st_to_free_tree);
 			tr_entry = lookup_tag_ref(st_entry->tag, NULL);
@@ -2118,7 +2466,8 @@ static int ctrl_cmd_delete(const char *input)
 			 get_uid_from_tag(tcs_entry->tn.tag),
 			 tcs_entry->active_set);
 		rb_erase(&tcs_entry->tn.node, &tag_counter_set_tree);
-		kfree(tcs_entry);
+		hlist_del_rcu(&tcs_entry->hash_node);
+		call_rcu_bh(&tcs_entry->rcu, tag_counter_set_free_rcu);
 	}
 	spin_unlock_bh(&tag_counter_set_list_lock);
 
@@ -2149,7 +2498,10 @@ static int ctrl_cmd_delete(const char *input)
 					 entry_uid);
 				rb_erase(&ts_entry->tn.node,
 					 &iface_entry->tag_stat_tree);
-				kfree(ts_entry);
+				hlist_del_rcu(&ts_entry->hash_node);
+				call_rcu_bh(&ts_entry->rcu, tag_stat_free_rcu);
+				stats_delete_seq =
+					atomic_long_read(&stats_seq);
 			}
 		}
 		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
@@ -2232,6 +2584,7 @@ static int ctrl_cmd_counter_set(const char *input)
 		}
 		tcs->tn.tag = tag;
 		tag_counter_set_tree_insert(tcs, &tag_counter_set_tree);
+		hlist_add_head_rcu(&tcs->hash_node, tag_counter_set_head(tag));
 		CT_DEBUG("qtaguid: ctrl_counterset(%s): added tcs tag=0x%llx "
 			 "(uid=%u) set=%d\n",
 			 input, tag, get_uid_from_tag(tag), counter_set);
@@ -2335,7 +2688,9 @@ static int ctrl_cmd_tag(const char *input)
 		BUG_ON(IS_ERR_OR_NULL(prev_tag_ref_entry));
 		BUG_ON(prev_tag_ref_entry->num_sock_tags <= 0);
 		prev_tag_ref_entry->num_sock_tags--;
+		u64_stats_update_begin(&sock_tag_entry->syncp);
 		sock_tag_entry->tag = full_tag;
+		u64_stats_update_end(&sock_tag_entry->syncp);
 	} else {
 		CT_DEBUG("qtaguid: ctrl_tag(%s): newtag for sk=%p\n",
 			 input, el_socket->sk);
@@ -2378,6 +2733,7 @@ static int ctrl_cmd_tag(const char *input)
 				 &pqd_entry->sock_tag_list);
 
 		sock_tag_tree_insert(sock_tag_entry, &sock_tag_tree);
+		sock_tag_publish(sock_tag_entry);
 		atomic64_inc(&qtu_events.sockets_tagged);
 	}
 	spin_unlock_bh(&uid_tag_data_tree_lock);
@@ -2441,6 +2797,7 @@ static int ctrl_cmd_untag(const char *input)
 	 * so it can do whatever it wants to it.
 	 */
 	rb_erase(&sock_tag_entry->sock_node, &sock_tag_tree);
+	sock_tag_unpublish(sock_tag_entry);
 
 	tag_ref_entry = lookup_tag_ref(sock_tag_entry->tag, &utd_entry);
 	BUG_ON(!tag_ref_entry);
@@ -2483,7 +2840,7 @@ static int ctrl_cmd_untag(const char *input)
 		 atomic_long_read(&el_socket->file->f_count) - 1);
 	sockfd_put(el_socket);
 
-	kfree(sock_tag_entry);
+	call_rcu_bh(&sock_tag_entry->rcu, sock_tag_free_rcu);
 	atomic64_inc(&qtu_events.sockets_untagged);
 
 	return 0;
@@ -2567,10 +2924,11 @@ struct proc_print_info {
 	int char_count;
 };
 
-static int pp_stats_line(struct proc_print_info *ppi, int cnt_set)
+/* cnts holds ts_entry's folded counters, it is not used for the header */
+static int pp_stats_line(struct proc_print_info *ppi,
+			 struct data_counters *cnts, int cnt_set)
 {
 	int len;
-	struct data_counters *cnts;
 
 	if (!ppi->item_index) {
 		if (ppi->item_index++ < ppi->items_to_skip)
@@ -2601,7 +2959,6 @@ static int pp_stats_line(struct proc_print_info *ppi, int cnt_set)
 		}
 		if (ppi->item_index++ < ppi->items_to_skip)
 			return 0;
-		cnts = &ppi->ts_entry->counters;
 		len = snprintf(
 			ppi->outp, ppi->char_count,
 			"%d %s 0x%llx %u %u "
@@ -2642,9 +2999,12 @@ static bool pp_sets(struct proc_print_info *ppi)
 {
 	int len;
 	int counter_set;
+	struct data_counters cnts;
+
+	data_counters_fold(&cnts, ppi->ts_entry->counters);
 	for (counter_set = 0; counter_set < IFS_MAX_COUNTER_SETS;
 	     counter_set++) {
-		len = pp_stats_line(ppi, counter_set);
+		len = pp_stats_line(ppi, &cnts, counter_set);
 		if (len >= ppi->char_count) {
 			*ppi->outp = '\0';
 			return false;
@@ -2677,7 +3037,7 @@ static int qtaguid_stats_proc_read(char *page, char **num_items_returned,
 	ppi.items_to_skip = items_to_skip;
 
 	if (unlikely(module_passive)) {
-		len = pp_stats_line(&ppi, 0);
+		len = pp_stats_line(&ppi, NULL, 0);
 		/* The header should always be shorter than the buffer. */
 		BUG_ON(len >= ppi.char_count);
 		(*num_items_returned)++;
@@ -2696,7 +3056,7 @@ static int qtaguid_stats_proc_read(char *page, char **num_items_returned,
 		return 0;
 
 	/* The idx is there to help debug when things go belly up. */
-	len = pp_stats_line(&ppi, 0);
+	len = pp_stats_line(&ppi, NULL, 0);
 	/* Don't advance the outp unless the whole line was printed */
 	if (len >= ppi.char_count) {
 		*ppi.outp = '\0';
@@ -2731,6 +3091,189 @@ static int qtaguid_stats_proc_read(char *page, char **num_items_returned,
 	return ppi.outp - page;
 }
 
+/*------------------------------------------*/
+/*
+ * Binary stats via generic netlink, see linux/netfilter/xt_qtaguid.h.
+ * cb->args[] keeps the dump state across calls:
+ *  0: the seq message was sent
+ *  1: rows older than this seq are skipped, 0 for a full dump
+ *  2: list node of the iface_stat being dumped, 0 before the first one.
+ *     iface_stats are never freed and new ones go in at the head, so it
+ *     stays valid and new ifaces don't shift it.
+ *  3, 4: low and high half of the last tag dumped for that iface
+ *  5: 3 and 4 are valid
+ */
+static struct genl_family qtaguid_genl_family = {
+	.id		= GENL_ID_GENERATE,
+	.name		= QTAGUID_GENL_NAME,
+	.version	= QTAGUID_GENL_VERSION,
+	.maxattr	= QTAGUID_A_MAX,
+};
+
+static const struct nla_policy qtaguid_genl_policy[QTAGUID_A_MAX + 1] = {
+	[QTAGUID_A_SINCE_SEQ]	= { .type = NLA_U64 },
+};
+
+/* Find the first tag_stat with a tag bigger than the given one */
+static struct tag_stat *tag_stat_tree_next(struct rb_root *root, tag_t tag)
+{
+	struct rb_node *node = root->rb_node;
+	struct tag_stat *res = NULL;
+
+	while (node) {
+		struct tag_stat *ts_entry = rb_entry(node, struct tag_stat,
+						     tn.node);
+
+		if (tag_compare(ts_entry->tn.tag, tag) > 0) {
+			res = ts_entry;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	return res;
+}
+
+static int qtaguid_genl_put_seq(struct sk_buff *skb,
+				struct netlink_callback *cb,
+				unsigned long seq, bool full)
+{
+	void *hdr;
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+			  &qtaguid_genl_family, NLM_F_MULTI,
+			  QTAGUID_CMD_GET_STATS);
+	if (!hdr)
+		return -EMSGSIZE;
+	NLA_PUT_U64(skb, QTAGUID_A_SEQ, seq);
+	if (full)
+		NLA_PUT_FLAG(skb, QTAGUID_A_FULL);
+	return genlmsg_end(skb, hdr);
+
+nla_put_failure:
+	genlmsg_cancel(skb, hdr);
+	return -EMSGSIZE;
+}
+
+static int qtaguid_genl_put_stats(struct sk_buff *skb,
+				  struct netlink_callback *cb,
+				  struct iface_stat *iface_entry,
+				  struct tag_stat *ts_entry)
+{
+	struct qtaguid_stats stats;
+	struct data_counters cnts;
+	void *hdr;
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+			  &qtaguid_genl_family, NLM_F_MULTI,
+			  QTAGUID_CMD_GET_STATS);
+	if (!hdr)
+		return -EMSGSIZE;
+
+	stats.acct_tag = get_atag_from_tag(ts_entry->tn.tag);
+	stats.uid = get_uid_from_tag(ts_entry->tn.tag);
+	stats.__pad = 0;
+	data_counters_fold(&cnts, ts_entry->counters);
+	memcpy(stats.counters, cnts.bpc, sizeof(stats.counters));
+
+	NLA_PUT_STRING(skb, QTAGUID_A_IFNAME, iface_entry->ifname);
+	NLA_PUT(skb, QTAGUID_A_STATS, sizeof(stats), &stats);
+	return genlmsg_end(skb, hdr);
+
+nla_put_failure:
+	genlmsg_cancel(skb, hdr);
+	return -EMSGSIZE;
+}
+
+static int qtaguid_genl_dump_stats(struct sk_buff *skb,
+				   struct netlink_callback *cb)
+{
+	struct nlattr *attrs[QTAGUID_A_MAX + 1];
+	struct iface_stat *iface_entry;
+	struct tag_stat *ts_entry;
+	struct list_head *pos;
+	struct rb_node *node;
+	unsigned long since, seq;
+	int err;
+	tag_t tag;
+
+	if (!cb->args[0]) {
+		err = nlmsg_parse(cb->nlh, GENL_HDRLEN, attrs, QTAGUID_A_MAX,
+				  qtaguid_genl_policy);
+		if (err)
+			return err;
+		since = 0;
+		if (attrs[QTAGUID_A_SINCE_SEQ])
+			since = nla_get_u64(attrs[QTAGUID_A_SINCE_SEQ]);
+
+		/* Rows updated from now on belong to the next dump */
+		seq = atomic_long_inc_return(&stats_seq) - 1;
+		if (since > seq || since <= ACCESS_ONCE(stats_delete_seq))
+			since = 0;
+		CT_DEBUG("qtaguid: genl stats dump pid=%u tgid=%u uid=%u "
+			 "seq=%lu since=%lu\n",
+			 current->pid, current->tgid, current_fsuid(),
+			 seq, since);
+
+		if (qtaguid_genl_put_seq(skb, cb, seq, !since) < 0)
+			return -EMSGSIZE;
+		cb->args[0] = 1;
+		cb->args[1] = since;
+	}
+
+	if (unlikely(module_passive))
+		return skb->len;
+
+	since = cb->args[1];
+	spin_lock_bh(&iface_stat_list_lock);
+	pos = (struct list_head *)cb->args[2] ?: iface_stat_list.next;
+	for (; pos != &iface_stat_list; pos = pos->next) {
+		iface_entry = list_entry(pos, struct iface_stat, list);
+		cb->args[2] = (long)pos;
+		spin_lock_bh(&iface_entry->tag_stat_list_lock);
+		if (cb->args[5]) {
+			tag = (tag_t)cb->args[4] << 32 | (u32)cb->args[3];
+			ts_entry = tag_stat_tree_next(
+				&iface_entry->tag_stat_tree, tag);
+			node = ts_entry ? &ts_entry->tn.node : NULL;
+		} else {
+			node = rb_first(&iface_entry->tag_stat_tree);
+		}
+		for (; node; node = rb_next(node)) {
+			ts_entry = rb_entry(node, struct tag_stat, tn.node);
+			tag = ts_entry->tn.tag;
+			if (ts_entry->seq < since)
+				continue;
+			/* Same rules as the stats proc file */
+			if (!can_read_other_uid_stats(get_uid_from_tag(tag)))
+				continue;
+			if (qtaguid_genl_put_stats(skb, cb, iface_entry,
+						   ts_entry) < 0) {
+				spin_unlock_bh(
+					&iface_entry->tag_stat_list_lock);
+				goto out;
+			}
+			cb->args[3] = (u32)tag;
+			cb->args[4] = tag >> 32;
+			cb->args[5] = 1;
+		}
+		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+		cb->args[2] = (long)pos->next;
+		cb->args[5] = 0;
+	}
+out:
+	spin_unlock_bh(&iface_stat_list_lock);
+	return skb->len;
+}
+
+static struct genl_ops qtaguid_genl_ops[] = {
+	{
+		.cmd	= QTAGUID_CMD_GET_STATS,
+		.policy	= qtaguid_genl_policy,
+		.dumpit	= qtaguid_genl_dump_stats,
+	},
+};
+
 /*------------------------------------------*/
 static int qtudev_open(struct inode *inode, struct file *file)
 {
@@ -2849,6 +3392,7 @@ static int qtudev_release(struct inode *inode, struct file *file)
 		free_tag_ref_from_utd_entry(tr, utd_entry);
 
 		rb_erase(&st_entry->sock_node, &sock_tag_tree);
+		sock_tag_unpublish(st_entry);
 		list_del(&st_entry->list);
 		/* Can't sockfd_put() within spinlock, do it later. */
 		sock_tag_tree_insert(st_entry, &st_to_free_tree);
@@ -2953,10 +3497,16 @@ static struct xt_match qtaguid_mt_reg __read_mostly = {
 
 static int __init qtaguid_mt_init(void)
 {
+	/* The binary stats are a straight copy of the counters */
+	BUILD_BUG_ON(sizeof(((struct qtaguid_stats *)0)->counters)
+		     != sizeof(struct data_counters));
 	if (qtaguid_proc_register(&xt_qtaguid_procdir)
 	    || iface_stat_init(xt_qtaguid_procdir)
 	    || xt_register_match(&qtaguid_mt_reg)
-	    || misc_register(&qtu_device))
+	    || misc_register(&qtu_device)
+	    || genl_register_family_with_ops(&qtaguid_genl_family,
+					     qtaguid_genl_ops,
+					     ARRAY_SIZE(qtaguid_genl_ops)))
 		return -1;
 	return 0;
 }
@@ -11,8 +11,11 @@
 #define __XT_QTAGUID_INTERNAL_H__
 
 #include <linux/types.h>
+#include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock_types.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/workqueue.h>
 
 /* Iface handling */
@@ -197,6 +200,20 @@ static inline uint64_t dc_sum_packets(struct data_counters *counters,
 		+ counters->bpc[set][direction][IFS_PROTO_OTHER].packets;
 }
 
+/*
+ * The packet path only ever touches the counters of the cpu it runs on,
+ * they are summed up when the stats are read.
+ * The percpu allocator can not be used from the atomic contexts the stats
+ * get created in, so the counters come from a pool a worker keeps filled.
+ */
+struct data_counters_cpu {
+	struct data_counters dc;
+	struct u64_stats_sync syncp;
+} ____cacheline_aligned_in_smp;
+
+void data_counters_fold(struct data_counters *res,
+			const struct data_counters_cpu __percpu *dcc);
+
 
 /* Generic X based nodes used as a base for rb_tree ops */
 struct tag_node {
@@ -206,14 +223,22 @@ struct tag_node {
 
 struct tag_stat {
 	struct tag_node tn;
-	struct data_counters counters;
+	/* For the lockless lookup from the packet path */
+	struct hlist_node hash_node;  /* in iface_stat.tag_stat_hash */
+	struct rcu_head rcu;
+
+	struct data_counters_cpu __percpu *counters;
 	/*
 	 * If this tag is acct_tag based, we need to count against the
 	 * matching parent uid_tag.
 	 */
-	struct data_counters *parent_counters;
+	struct tag_stat *parent;
+	/* Last stats_seq the counters were updated in, for delta dumps */
+	unsigned long seq;
 };
 
+#define TAG_STAT_HASH_BITS 5
+
 struct iface_stat {
 	struct list_head list;  /* in iface_stat_list */
 	char *ifname;
@@ -222,7 +247,7 @@ struct iface_stat {
 	struct net_device *net_dev;
 
 	struct byte_packet_counters totals_via_dev[IFS_MAX_DIRECTIONS];
-	struct data_counters totals_via_skb;
+	struct data_counters_cpu __percpu *totals_via_skb;
 	/*
 	 * We keep the last_known, because some devices reset their counters
 	 * just before NETDEV_UP, while some will reset just before
@@ -238,6 +263,8 @@ struct iface_stat {
 	struct proc_dir_entry *proc_ptr;
 
 	struct rb_root tag_stat_tree;
+	/* Same entries as the tree, RCU protected */
+	struct hlist_head tag_stat_hash[1 << TAG_STAT_HASH_BITS];
 	spinlock_t tag_stat_list_lock;
 };
 
@@ -255,7 +282,9 @@ struct iface_stat_work {
  */
 struct sock_tag {
 	struct rb_node sock_node;
-	struct sock *sk;  /* Only used as a number, never dereferenced */
+	struct rcu_head rcu;
+	/* Points back to us via sk_qtaguid_tag while we hold the socket */
+	struct sock *sk;
 	/* The socket is needed for sockfd_put() */
 	struct socket *socket;
 	/* Used to associate with a given pid */
@@ -263,6 +292,8 @@ struct sock_tag {
 	pid_t pid;
 
 	tag_t tag;
+	/* Lets the packet path read the tag while it is being retagged */
+	struct u64_stats_sync syncp;
 };
 
 struct qtaguid_event_counts {
@@ -300,9 +331,13 @@ struct qtaguid_event_counts {
 /* Track the set active_set for the given tag. */
 struct tag_counter_set {
 	struct tag_node tn;
+	struct hlist_node hash_node;  /* in tag_counter_set_hash */
+	struct rcu_head rcu;
 	int active_set;
 };
 
+#define TAG_COUNTER_SET_HASH_BITS 6
+
 /*----------------------------------------------*/
 /*
  * The qtu uid data is used to track resources that are created directly or
@@ -272,6 +272,7 @@ struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
 	struct packet_fanout	*fanout;
+	unsigned int		rollover_next;	/* fanout member to try */
 	struct tpacket_stats	stats;
 	union  tpacket_stats_u	stats_u;
 	struct packet_ring_buffer	rx_ring;
@@ -304,7 +305,7 @@ struct packet_fanout {
 	unsigned int		num_members;
 	u16			id;
 	u8			type;
-	u8			defrag;
+	u16			flags;
 	atomic_t		rr_cur;
 	struct list_head	list;
 	struct sock		*arr[PACKET_FANOUT_MAX];
@@ -1179,16 +1180,14 @@ static int fanout_rr_next(struct packet_fanout *f, unsigned int num)
 	return x;
 }
 
-static struct sock *fanout_demux_hash(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
+static unsigned int fanout_demux_hash(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
 {
-	u32 idx, hash = skb->rxhash;
+	u32 hash = skb->rxhash;
 
-	idx = ((u64)hash * num) >> 32;
-
-	return f->arr[idx];
+	return ((u64)hash * num) >> 32;
 }
 
-static struct sock *fanout_demux_lb(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
+static unsigned int fanout_demux_lb(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
 {
 	int cur, old;
 
@@ -1196,14 +1195,62 @@ static struct sock *fanout_demux_lb(struct packet_fanout *f, struct sk_buff *skb
 	while ((old = atomic_cmpxchg(&f->rr_cur, cur,
 				     fanout_rr_next(f, num))) != cur)
 		cur = old;
-	return f->arr[cur];
+	return cur;
 }
 
-static struct sock *fanout_demux_cpu(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
+static unsigned int fanout_demux_cpu(struct packet_fanout *f, struct sk_buff *skb, unsigned int num)
 {
 	unsigned int cpu = smp_processor_id();
 
-	return f->arr[cpu % num];
+	return cpu % num;
+}
+
+/* Whether @po would queue @skb rather than drop it */
+static bool packet_rcv_has_room(struct packet_sock *po, struct sk_buff *skb)
+{
+	struct sock *sk = &po->sk;
+	bool has_room;
+
+	if (!po->rx_ring.pg_vec)
+		return atomic_read(&sk->sk_rmem_alloc) + skb->truesize <=
+			(unsigned int)sk->sk_rcvbuf;
+
+	spin_lock(&sk->sk_receive_queue.lock);
+	if (po->tp_version == TPACKET_V3)
+		has_room = !prb_queue_frozen(GET_PBDQC_FROM_RB(&po->rx_ring));
+	else
+		has_room = packet_lookup_frame(po, &po->rx_ring,
+					       po->rx_ring.head,
+					       TP_STATUS_KERNEL) != NULL;
+	spin_unlock(&sk->sk_receive_queue.lock);
+
+	return has_room;
+}
+
+/* Pick the first member after the one last rolled over to from @idx that
+ * has room for @skb, not considering @skip.  Stays at @idx when all of
+ * them are full.
+ */
+static unsigned int fanout_demux_rollover(struct packet_fanout *f,
+					  struct sk_buff *skb,
+					  unsigned int idx, unsigned int skip,
+					  unsigned int num)
+{
+	struct packet_sock *po = pkt_sk(f->arr[idx]);
+	unsigned int i, j;
+
+	i = j = min(po->rollover_next, num - 1);
+	do {
+		if (i != skip && packet_rcv_has_room(pkt_sk(f->arr[i]), skb)) {
+			if (i != j)
+				po->rollover_next = i;
+			return i;
+		}
+		if (++i == num)
+			i = 0;
+	} while (i != j);
+
+	return idx;
 }
 
 static struct sk_buff *fanout_check_defrag(struct sk_buff *skb)
@@ -1249,7 +1296,7 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 	struct packet_fanout *f = pt->af_packet_priv;
 	unsigned int num = f->num_members;
 	struct packet_sock *po;
-	struct sock *sk;
+	unsigned int idx;
 
 	if (!net_eq(dev_net(dev), read_pnet(&f->net)) ||
 	    !num) {
@@ -1260,23 +1307,31 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 	switch (f->type) {
 	case PACKET_FANOUT_HASH:
 	default:
-		if (f->defrag) {
+		if (f->flags & PACKET_FANOUT_FLAG_DEFRAG) {
 			skb = fanout_check_defrag(skb);
 			if (!skb)
 				return 0;
 		}
 		skb_get_rxhash(skb);
-		sk = fanout_demux_hash(f, skb, num);
+		idx = fanout_demux_hash(f, skb, num);
 		break;
 	case PACKET_FANOUT_LB:
-		sk = fanout_demux_lb(f, skb, num);
+		idx = fanout_demux_lb(f, skb, num);
 		break;
 	case PACKET_FANOUT_CPU:
-		sk = fanout_demux_cpu(f, skb, num);
+		idx = fanout_demux_cpu(f, skb, num);
+		break;
+	case PACKET_FANOUT_ROLLOVER:
+		idx = fanout_demux_rollover(f, skb, 0, (unsigned int) -1, num);
 		break;
 	}
 
-	po = pkt_sk(sk);
+	po = pkt_sk(f->arr[idx]);
+	if ((f->flags & PACKET_FANOUT_FLAG_ROLLOVER) &&
+	    unlikely(!packet_rcv_has_room(po, skb))) {
+		idx = fanout_demux_rollover(f, skb, idx, idx, num);
+		po = pkt_sk(f->arr[idx]);
+	}
 
 	return po->prot_hook.func(skb, dev, &po->prot_hook, orig_dev);
 }
@@ -1316,13 +1371,18 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	struct packet_sock *po = pkt_sk(sk);
 	struct packet_fanout *f, *match;
 	u8 type = type_flags & 0xff;
-	u8 defrag = (type_flags & PACKET_FANOUT_FLAG_DEFRAG) ? 1 : 0;
+	u16 flags = type_flags & ~0xff;
 	int err;
 
+	if (type == PACKET_FANOUT_ROLLOVER &&
+	    (flags & PACKET_FANOUT_FLAG_ROLLOVER))
+		return -EINVAL;
+
 	switch (type) {
 	case PACKET_FANOUT_HASH:
 	case PACKET_FANOUT_LB:
 	case PACKET_FANOUT_CPU:
+	case PACKET_FANOUT_ROLLOVER:
 		break;
 	default:
 		return -EINVAL;
@@ -1347,7 +1407,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 		}
 	}
 	err = -EINVAL;
-	if (match && match->defrag != defrag)
+	if (match && match->flags != flags)
 		goto out;
 	if (!match) {
 		err = -ENOMEM;
@@ -1357,7 +1417,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 		write_pnet(&match->net, sock_net(sk));
 		match->id = id;
 		match->type = type;
-		match->defrag = defrag;
+		match->flags = flags;
 		atomic_set(&match->rr_cur, 0);
 		INIT_LIST_HEAD(&match->list);
 		spin_lock_init(&match->lock);
@@ -1377,6 +1437,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 		if (atomic_read(&match->sk_ref) < PACKET_FANOUT_MAX) {
 			__dev_remove_pack(&po->prot_hook);
 			po->fanout = match;
+			po->rollover_next = 0;
 			atomic_inc(&match->sk_ref);
 			__fanout_link(sk, po);
 			err = 0;
@@ -2767,7 +2828,10 @@ static int packet_recvmsg(struct kiocb *iocb, struct socket *sock,
 			/* This is a hint as to how much should be linear. */
 			vnet_hdr.hdr_len = skb_headlen(skb);
 			vnet_hdr.gso_size = sinfo->gso_size;
-			if (sinfo->gso_type & SKB_GSO_TCPV4)
+			/* no virtio_net_hdr type for GRE encapsulated TCP */
+			if (sinfo->gso_type & SKB_GSO_GRE)
+				goto out_free;
+			else if (sinfo->gso_type & SKB_GSO_TCPV4)
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
 			else if (sinfo->gso_type & SKB_GSO_TCPV6)
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
@@ -2775,6 +2839,9 @@ static int packet_recvmsg(struct kiocb *iocb, struct socket *sock,
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_UDP;
 			else if (sinfo->gso_type & SKB_GSO_FCOE)
 				goto out_free;
+			/* no virtio_net_hdr type for UDP segmentation */
+			else if (sinfo->gso_type & SKB_GSO_UDP_L4)
+				goto out_free;
 			else
 				BUG();
 			if (sinfo->gso_type & SKB_GSO_TCP_ECN)
@@ -3365,7 +3432,8 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 			len = sizeof(int);
 		val = (po->fanout ?
 		       ((u32)po->fanout->id |
-			((u32)po->fanout->type << 16)) :
+			((u32)po->fanout->type << 16) |
+			((u32)po->fanout->flags << 16)) :
 		       0);
 		data = &val;
 		break;
@@ -39,34 +39,106 @@
  * - updates to tree and tree walking are only done under the rtnl mutex.
  */
 
+/*
+ * What dequeue_skb() hands out is either a single skb, or a bulk batch of
+ * skbs chained through ->next.  A GSO skb is only ever the last member of
+ * a batch, so the ->next of a GSO skb always points to its own segments
+ * (once dev_hard_start_xmit() has split it) and never to more of the batch.
+ */
+static inline struct sk_buff *qdisc_batch_next(const struct sk_buff *skb)
+{
+	return skb_is_gso(skb) ? NULL : skb->next;
+}
+
+static unsigned int qdisc_batch_len(const struct sk_buff *skb)
+{
+	unsigned int len = 1;
+
+	while ((skb = qdisc_batch_next(skb)) != NULL)
+		len++;
+	return len;
+}
+
+static void qdisc_batch_free(struct sk_buff *skb)
+{
+	while (skb) {
+		struct sk_buff *next = qdisc_batch_next(skb);
+
+		kfree_skb(skb);
+		skb = next;
+	}
+}
+
 static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 {
-	skb_dst_force(skb);
+	struct sk_buff *p;
+
+	for (p = skb; p; p = qdisc_batch_next(p))
+		skb_dst_force(p);
 	q->gso_skb = skb;
 	q->qstats.requeues++;
-	q->q.qlen++;	/* it's still part of the queue */
+	/* it's still part of the queue */
+	q->q.qlen += qdisc_batch_len(skb);
 	__netif_schedule(q);
 
 	return 0;
 }
 
+/*
+ * Byte budget of one bulk dequeue: what the byte queue limit of the queue
+ * still allows.  Drivers without byte queue accounting never queue a byte
+ * there, cap their batches at about one GSO frame's worth.
+ */
+static inline int qdisc_avail_bulklimit(const struct netdev_queue *txq)
+{
+#ifdef CONFIG_BQL
+	if (txq->dql.num_queued)
+		return dql_avail(&txq->dql);
+#endif
+	return GSO_MAX_SIZE;
+}
+
+static void try_bulk_dequeue_skb(struct Qdisc *q, struct sk_buff *skb,
+				 const struct netdev_queue *txq)
+{
+	int bytelimit = qdisc_avail_bulklimit(txq) - skb->len;
+
+	while (bytelimit > 0) {
+		struct sk_buff *nskb = q->dequeue(q);
+
+		if (!nskb)
+			break;
+
+		bytelimit -= nskb->len; /* covers GSO len */
+		skb->next = nskb;
+		skb = nskb;
+		if (skb_is_gso(skb))
+			break;
+	}
+	skb->next = NULL;
+}
+
 static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 {
 	struct sk_buff *skb = q->gso_skb;
+	const struct netdev_queue *txq = q->dev_queue;
 
 	if (unlikely(skb)) {
 		struct net_device *dev = qdisc_dev(q);
-		struct netdev_queue *txq;
 
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 		if (!netif_tx_queue_frozen_or_stopped(txq)) {
 			q->gso_skb = NULL;
-			q->q.qlen--;
+			q->q.qlen -= qdisc_batch_len(skb);
 		} else
 			skb = NULL;
-	} else {
+	} else if (!(q->flags & TCQ_F_ONETXQUEUE)) {
+		skb = q->dequeue(q);
+	} else if (!netif_tx_queue_frozen_or_stopped(txq)) {
 		skb = q->dequeue(q);
+		if (skb && !skb_is_gso(skb))
+			try_bulk_dequeue_skb(q, skb, txq);
 	}
 
 	return skb;
@@ -85,7 +157,7 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 		 * detect it by checking xmit owner and drop the packet when
 		 * deadloop is detected. Return OK to try the next skb.
 		 */
-		kfree_skb(skb);
+		qdisc_batch_free(skb);
 		if (net_ratelimit())
 			pr_warning("Dead loop on netdevice %s, fix it urgently!\n",
 				   dev_queue->dev->name);
@@ -103,7 +175,42 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 }
 
 /*
- * Transmit one skb, and handle the return status as required. Holding the
+ * Hand a batch to the driver one skb at a time, telling it through
+ * skb->xmit_more that it can hold off kicking the hardware until the last
+ * one.  On failure *skbp is left pointing to what was not sent.
+ */
+static int qdisc_xmit_batch(struct sk_buff **skbp, struct net_device *dev,
+			    struct netdev_queue *txq)
+{
+	struct sk_buff *skb = *skbp;
+	int rc;
+
+	for (;;) {
+		struct sk_buff *next = qdisc_batch_next(skb);
+
+		if (next)
+			skb->next = NULL;
+		rc = dev_hard_start_xmit(skb, dev, txq, next != NULL);
+		if (unlikely(!dev_xmit_complete(rc))) {
+			if (next)
+				skb->next = next;
+			break;
+		}
+		skb = next;
+		if (!skb)
+			break;
+		if (unlikely(netif_xmit_stopped(txq))) {
+			rc = NETDEV_TX_BUSY;
+			break;
+		}
+	}
+	*skbp = skb;
+	return rc;
+}
+
+/*
+ * Transmit one skb or a bulk batch, and handle the return status as
+ * required. Holding the
  * __QDISC_STATE_RUNNING bit guarantees that only one CPU can execute this
  * function.
  *
@@ -122,7 +229,7 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
 	if (!netif_tx_queue_frozen_or_stopped(txq))
-		ret = dev_hard_start_xmit(skb, dev, txq);
+		ret = qdisc_xmit_batch(&skb, dev, txq);
 
 	HARD_TX_UNLOCK(dev, txq);
 
@@ -612,7 +719,7 @@ void qdisc_reset(struct Qdisc *qdisc)
 		ops->reset(qdisc);
 
 	if (qdisc->gso_skb) {
-		kfree_skb(qdisc->gso_skb);
+		qdisc_batch_free(qdisc->gso_skb);
 		qdisc->gso_skb = NULL;
 		qdisc->q.qlen = 0;
 	}
@@ -648,7 +755,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	module_put(ops->owner);
 	dev_put(qdisc_dev(qdisc));
 
-	kfree_skb(qdisc->gso_skb);
+	qdisc_batch_free(qdisc->gso_skb);
 	/*
 	 * gen_estimator est_timer() might access qdisc->q.lock,
 	 * wait a RCU grace period before freeing qdisc.
@@ -696,6 +803,8 @@ static void attach_one_default_qdisc(struct net_device *dev,
 			netdev_info(dev, "activation failed\n");
 			return;
 		}
+		if (!netif_is_multiqueue(dev))
+			qdisc->flags |= TCQ_F_ONETXQUEUE;
 	}
 	dev_queue->qdisc_sleeping = qdisc;
 }
@@ -15,6 +15,7 @@
 #include <linux/string.h>
 #include <linux/errno.h>
 #include <linux/if_arp.h>
+#include <linux/ip.h>
 #include <linux/netdevice.h>
 #include <linux/init.h>
 #include <linux/skbuff.h>
@@ -281,6 +282,16 @@ static inline int teql_resolve(struct sk_buff *skb,
 	res = mn ? __teql_resolve(skb, skb_res, dev, txq, mn) : 0;
 	rcu_read_unlock();
 
+	/* IPv4 routes shared by a directly connected nexthop have none */
+	if (!mn && dst->ops->family == AF_INET) {
+		__be32 nexthop = ip_hdr(skb)->daddr;
+
+		mn = dst_neigh_lookup(dst, &nexthop);
+		if (IS_ERR(mn))
+			return PTR_ERR(mn);
+		res = __teql_resolve(skb, skb_res, dev, txq, mn);
+		neigh_release(mn);
+	}
 	return res;
 }
 
@@ -97,6 +97,7 @@
 #include <net/cls_cgroup.h>
 
 #include <net/sock.h>
+#include <net/busy_poll.h>
 #include <linux/netfilter.h>
 
 #include <linux/if_tun.h>
@@ -1075,12 +1076,36 @@ EXPORT_SYMBOL(sock_create_lite);
 static unsigned int sock_poll(struct file *file, poll_table *wait)
 {
 	struct socket *sock;
+	unsigned int mask;
 
 	/*
 	 *      We can't return errors to poll, so it's either yes or no.
 	 */
 	sock = file->private_data;
-	return sock->ops->poll(file, sock, wait);
+	mask = sock->ops->poll(file, sock, wait);
+
+	/*
+	 * The caller, e.g. epoll handing out the events, is about to read
+	 * from the socket: steer its flow here.
+	 */
+	if ((mask & (POLLIN | POLLRDNORM)) && sock->sk)
+		sock_rps_record_flow(sock->sk);
+
+	/*
+	 * select() and poll() ask for a busy poll through the key until one
+	 * socket in the set did one. Their wait table is only passed on the
+	 * first scan, up to the first ready file, and not at all with a zero
+	 * timeout, so this spins at most once per call, on the first socket
+	 * that has nothing to read.
+	 */
+	if (wait && (wait->key & POLL_BUSY_LOOP) &&
+	    !(mask & (POLLIN | POLLRDNORM)) && sock->sk &&
+	    sk_can_busy_loop(sock->sk)) {
+		if (sk_busy_loop(sock->sk, 0))
+			mask |= sock->ops->poll(file, sock, NULL);
+		mask |= POLL_BUSY_LOOP;
+	}
+	return mask;
 }
 
 static int sock_mmap(struct file *file, struct vm_area_struct *vma)
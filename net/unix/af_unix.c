@@ -114,6 +114,7 @@
 #include <linux/mount.h>
 #include <net/checksum.h>
 #include <linux/security.h>
+#include <linux/splice.h>
 
 static struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
 static DEFINE_SPINLOCK(unix_table_lock);
@@ -462,6 +463,12 @@ static void unix_sock_destructor(struct sock *sk)
 
 	skb_queue_purge(&sk->sk_receive_queue);
 
+	/* Left over from splicing linear data, see linear_to_page() */
+	if (sk->sk_sndmsg_page) {
+		__free_page(sk->sk_sndmsg_page);
+		sk->sk_sndmsg_page = NULL;
+	}
+
 	WARN_ON(atomic_read(&sk->sk_wmem_alloc));
 	WARN_ON(!sk_unhashed(sk));
 	WARN_ON(sk->sk_socket);
@@ -630,6 +637,11 @@ static int unix_stream_sendmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t);
 static int unix_stream_recvmsg(struct kiocb *, struct socket *,
 			       struct msghdr *, size_t, int);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *, int offset,
+				    size_t size, int flags);
+static ssize_t unix_stream_splice_read(struct socket *,  loff_t *ppos,
+				       struct pipe_inode_info *, size_t size,
+				       unsigned int flags);
 static int unix_dgram_sendmsg(struct kiocb *, struct socket *,
 			      struct msghdr *, size_t);
 static int unix_dgram_recvmsg(struct kiocb *, struct socket *,
@@ -659,7 +671,8 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
+	.splice_read =	unix_stream_splice_read,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -1722,6 +1735,11 @@ out:
 	return err;
 }
 
+/* Stream skbs carry up to this much data in order-0 pages, on top of
+ * the linear part: large writes would otherwise need high-order
+ * allocations, which get hard to come by on a long running system.
+ */
+#define UNIX_SKB_FRAGS_SZ (PAGE_SIZE << get_order(32768))
 
 static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			       struct msghdr *msg, size_t len)
@@ -1730,6 +1748,7 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	struct sock *sk = sock->sk;
 	struct sock *other = NULL;
 	int err, size;
+	int data_len;
 	struct sk_buff *skb;
 	int sent = 0;
 	struct scm_cookie tmp_scm;
@@ -1772,28 +1791,18 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		if (size > ((sk->sk_sndbuf >> 1) - 64))
 			size = (sk->sk_sndbuf >> 1) - 64;
 
-		if (size > SKB_MAX_ALLOC)
-			size = SKB_MAX_ALLOC;
+		size = min_t(int, size, SKB_MAX_HEAD(0) + UNIX_SKB_FRAGS_SZ);
+		data_len = max_t(int, 0, size - SKB_MAX_HEAD(0));
 
 		/*
 		 *	Grab a buffer
 		 */
 
-		skb = sock_alloc_send_skb(sk, size, msg->msg_flags&MSG_DONTWAIT,
-					  &err);
-
+		skb = sock_alloc_send_pskb(sk, size - data_len, data_len,
+					   msg->msg_flags & MSG_DONTWAIT, &err);
 		if (skb == NULL)
 			goto out_err;
 
-		/*
-		 *	If you pass two values to the sock_alloc_send_skb
-		 *	it tries to grab the large buffer with GFP_NOFS
-		 *	(which can fail easily), and if it fails grab the
-		 *	fallback size buffer which is under a page and will
-		 *	succeed. [Alan]
-		 */
-		size = min_t(int, size, skb_tailroom(skb));
-
 
 		/* Only send the fds in the first buffer */
 		err = unix_scm_to_skb(siocb->scm, skb, !fds_sent);
@@ -1804,7 +1813,11 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		max_level = err + 1;
 		fds_sent = true;
 
-		err = memcpy_fromiovec(skb_put(skb, size), msg->msg_iov, size);
+		skb_put(skb, size - data_len);
+		skb->data_len = data_len;
+		skb->len = size;
+		err = skb_copy_datagram_from_iovec(skb, 0, msg->msg_iov, sent,
+						   size);
 		if (err) {
 			kfree_skb(skb);
 			goto out_err;
@@ -1842,6 +1855,110 @@ out_err:
 	return sent ? : err;
 }
 
+/* Can data from @scm be glued to @skb queued by @sk? */
+static bool unix_skb_scm_eq(struct sk_buff *skb, struct sock *sk,
+			    struct scm_cookie *scm)
+{
+	return skb->sk == sk &&
+	       UNIXCB(skb).pid == scm->pid &&
+	       UNIXCB(skb).cred == scm->cred &&
+	       !UNIXCB(skb).fp;
+}
+
+/*
+ * Queue a page reference for the peer instead of copying the data, as
+ * splice() and sendfile() to the socket do.  The page goes to the last
+ * skb queued when it is ours, so a stream of pages does not take one
+ * skb each.  Readers dequeue skbs under the state lock before looking
+ * at them, so appending under it is safe.
+ */
+static ssize_t unix_stream_sendpage(struct socket *socket, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = socket->sk;
+	struct sock *other;
+	struct sk_buff *skb, *newskb = NULL;
+	struct scm_cookie scm;
+	struct msghdr msg = { .msg_controllen = 0 };
+	int err, i;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other || sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	err = scm_send(socket, &msg, &scm);
+	if (err < 0)
+		return err;
+
+	for (;;) {
+		err = -EPIPE;
+		if (sk->sk_shutdown & SEND_SHUTDOWN)
+			goto pipe_err;
+
+		unix_state_lock(other);
+		if (sock_flag(other, SOCK_DEAD) ||
+		    (other->sk_shutdown & RCV_SHUTDOWN))
+			goto pipe_err_unlock;
+
+		spin_lock(&other->sk_receive_queue.lock);
+		skb = newskb;
+		if (!skb) {
+			skb = skb_peek_tail(&other->sk_receive_queue);
+			if (skb && !unix_skb_scm_eq(skb, sk, &scm))
+				skb = NULL;
+		}
+		if (skb) {
+			i = skb_shinfo(skb)->nr_frags;
+			if (skb_can_coalesce(skb, i, page, offset)) {
+				skb_shinfo(skb)->frags[i - 1].size += size;
+				break;
+			}
+			if (i < MAX_SKB_FRAGS) {
+				get_page(page);
+				skb_fill_page_desc(skb, i, page, offset, size);
+				break;
+			}
+		}
+		spin_unlock(&other->sk_receive_queue.lock);
+		unix_state_unlock(other);
+
+		/* No room at the tail, start a new skb */
+		newskb = sock_alloc_send_pskb(sk, 0, 0, flags & MSG_DONTWAIT,
+					      &err);
+		if (!newskb)
+			goto out_err;
+		err = unix_scm_to_skb(&scm, newskb, false);
+		if (err < 0)
+			goto out_err;
+	}
+
+	skb->len += size;
+	skb->data_len += size;
+	skb->truesize += size;
+	atomic_add(size, &sk->sk_wmem_alloc);
+	if (newskb)
+		__skb_queue_tail(&other->sk_receive_queue, newskb);
+	spin_unlock(&other->sk_receive_queue.lock);
+	unix_state_unlock(other);
+
+	other->sk_data_ready(other, size);
+	scm_destroy(&scm);
+	return size;
+
+pipe_err_unlock:
+	unix_state_unlock(other);
+pipe_err:
+	if (!(flags & MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+out_err:
+	kfree_skb(newskb);
+	scm_destroy(&scm);
+	return err;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -2009,15 +2126,36 @@ static long unix_stream_data_wait(struct sock *sk, long timeo)
 
 
 
-static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
-			       struct msghdr *msg, size_t size,
-			       int flags)
+static unsigned int unix_skb_len(const struct sk_buff *skb)
 {
-	struct sock_iocb *siocb = kiocb_to_siocb(iocb);
-	struct scm_cookie tmp_scm;
+	return skb->len - UNIXCB(skb).consumed;
+}
+
+struct unix_stream_read_state {
+	int (*recv_actor)(struct sk_buff *, int,
+			  struct unix_stream_read_state *);
+	struct socket *socket;
+	struct msghdr *msg;
+	struct pipe_inode_info *pipe;
+	size_t size;
+	int flags;
+	unsigned int splice_flags;
+};
+
+/*
+ * Common to recvmsg() and splice(): hand the queued data to
+ * @state->recv_actor, which returns how much of a chunk it took.
+ */
+static int unix_stream_read_generic(struct unix_stream_read_state *state,
+				    struct scm_cookie *scm)
+{
+	struct socket *sock = state->socket;
 	struct sock *sk = sock->sk;
 	struct unix_sock *u = unix_sk(sk);
-	struct sockaddr_un *sunaddr = msg->msg_name;
+	struct msghdr *msg = state->msg;
+	struct sockaddr_un *sunaddr = msg ? msg->msg_name : NULL;
+	int flags = state->flags;
+	size_t size = state->size;
 	int copied = 0;
 	int check_creds = 0;
 	int target;
@@ -2035,17 +2173,13 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 	target = sock_rcvlowat(sk, flags&MSG_WAITALL, size);
 	timeo = sock_rcvtimeo(sk, flags&MSG_DONTWAIT);
 
-	msg->msg_namelen = 0;
+	if (msg)
+		msg->msg_namelen = 0;
 
 	/* Lock the socket to prevent queue disordering
 	 * while sleeps in memcpy_tomsg
 	 */
 
-	if (!siocb->scm) {
-		siocb->scm = &tmp_scm;
-		memset(&tmp_scm, 0, sizeof(tmp_scm));
-	}
-
 	err = mutex_lock_interruptible(&u->readlock);
 	if (err) {
 		err = sock_intr_errno(timeo);
@@ -2096,14 +2230,14 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		if (check_creds) {
 			/* Never glue messages from different writers */
-			if ((UNIXCB(skb).pid  != siocb->scm->pid) ||
-			    (UNIXCB(skb).cred != siocb->scm->cred)) {
+			if ((UNIXCB(skb).pid  != scm->pid) ||
+			    (UNIXCB(skb).cred != scm->cred)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
 		} else {
 			/* Copy credentials */
-			scm_set_cred(siocb->scm, UNIXCB(skb).pid, UNIXCB(skb).cred);
+			scm_set_cred(scm, UNIXCB(skb).pid, UNIXCB(skb).cred);
 			check_creds = 1;
 		}
 
@@ -2113,11 +2247,12 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		chunk = state->recv_actor(skb, chunk, state);
+		if (chunk < 0) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
-				copied = -EFAULT;
+				copied = chunk;
 			break;
 		}
 		copied += chunk;
@@ -2125,26 +2260,26 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
-				unix_detach_fds(siocb->scm, skb);
+				unix_detach_fds(scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len) {
+			if (unix_skb_len(skb)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
 
 			consume_skb(skb);
 
-			if (siocb->scm->fp)
+			if (scm->fp)
 				break;
 		} else {
 			/* It is questionable, see note in unix_dgram_recvmsg.
 			 */
 			if (UNIXCB(skb).fp)
-				siocb->scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+				scm->fp = scm_fp_dup(UNIXCB(skb).fp);
 
 			/* put message back and return */
 			skb_queue_head(&sk->sk_receive_queue, skb);
@@ -2153,11 +2288,91 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 	} while (size);
 
 	mutex_unlock(&u->readlock);
-	scm_recv(sock, msg, siocb->scm, flags);
+	if (msg)
+		scm_recv(sock, msg, scm, flags);
 out:
 	return copied ? : err;
 }
 
+static int unix_stream_read_actor(struct sk_buff *skb, int chunk,
+				  struct unix_stream_read_state *state)
+{
+	int err;
+
+	err = skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+				      state->msg->msg_iov, chunk);
+	return err ? -EFAULT : chunk;
+}
+
+static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
+			       struct msghdr *msg, size_t size,
+			       int flags)
+{
+	struct sock_iocb *siocb = kiocb_to_siocb(iocb);
+	struct scm_cookie tmp_scm;
+	struct unix_stream_read_state state = {
+		.recv_actor = unix_stream_read_actor,
+		.socket = sock,
+		.msg = msg,
+		.size = size,
+		.flags = flags
+	};
+
+	if (!siocb->scm) {
+		siocb->scm = &tmp_scm;
+		memset(&tmp_scm, 0, sizeof(tmp_scm));
+	}
+
+	return unix_stream_read_generic(&state, siocb->scm);
+}
+
+/*
+ * The readlock stays held while pages go to the pipe.  That is safe as
+ * unix_stream_sendpage(), called with the pipe locked, does not take it.
+ */
+static ssize_t unix_stream_splice(struct sock *sk,
+				  struct pipe_inode_info *pipe,
+				  struct splice_pipe_desc *spd)
+{
+	return splice_to_pipe(pipe, spd);
+}
+
+static int unix_stream_splice_actor(struct sk_buff *skb, int chunk,
+				    struct unix_stream_read_state *state)
+{
+	return skb_splice_bits(skb, state->socket->sk, UNIXCB(skb).consumed,
+			       state->pipe, chunk, state->splice_flags,
+			       unix_stream_splice);
+}
+
+static ssize_t unix_stream_splice_read(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t size, unsigned int flags)
+{
+	struct scm_cookie scm;
+	struct unix_stream_read_state state = {
+		.recv_actor = unix_stream_splice_actor,
+		.socket = sock,
+		.pipe = pipe,
+		.size = size,
+		.splice_flags = flags,
+	};
+	int ret;
+
+	if (unlikely(*ppos))
+		return -ESPIPE;
+
+	if (sock->file->f_flags & O_NONBLOCK || flags & SPLICE_F_NONBLOCK)
+		state.flags = MSG_DONTWAIT;
+
+	/* Credentials and passed files have no way to the pipe */
+	memset(&scm, 0, sizeof(scm));
+	ret = unix_stream_read_generic(&state, &scm);
+	scm_destroy(&scm);
+
+	return ret;
+}
+
 static int unix_shutdown(struct socket *sock, int mode)
 {
 	struct sock *sk = sock->sk;
@@ -2224,7 +2439,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)